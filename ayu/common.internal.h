@@ -7,6 +7,11 @@
 #include <ctime> // Will be using POSIX functions though
 #endif
 
+ // Define this to also register benchmarks as TestSets, named like the tests
+ // they go with plus "-bench".  They aren't part of the normal tests because
+ // they take a while and only print timings.
+//#define AYU_BENCHMARKS
+
 namespace ayu::in {
 
 #ifdef AYU_PROFILE
@@ -0,0 +1,678 @@
+#include "binary.h"
+
+#include <cstring>
+#include <unordered_map>
+#include "../../uni/hash.h"
+#include "../../uni/io.h"
+
+namespace ayu {
+namespace in {
+
+static constexpr TreeFlags binary_flags =
+    TreeFlags::PreferHex | TreeFlags::PreferCompact | TreeFlags::PreferExpanded;
+
+ // Limit nesting when decoding, because malformed data can contain cycles.
+static constexpr u32 binary_max_depth = 200;
+ // Malformed data can also point at the same node more than once, which can
+ // make a few kilobytes decode to an exponentially large tree.  The writer
+ // never shares nodes and each node takes at least one byte, so a valid image
+ // never decodes to more nodes than it has bytes.  decode_node counts down from
+ // that.
+
+///// WRITING
+
+struct BinaryWriter {
+    UniqueString out;
+    UniqueArray<Str> strings;
+    std::unordered_map<Str, u32> string_indexes;
+     // Error messages have to be kept alive while they're in the string table.
+    UniqueArray<UniqueString> error_messages;
+
+    u32 intern (Str s) {
+        auto [iter, added] = string_indexes.emplace(s, strings.size());
+        if (added) strings.push_back(s);
+        return iter->second;
+    }
+
+    void write_u32 (u32 v) {
+        char buf [4];
+        for (u32 i = 0; i < 4; i++) buf[i] = char(v >> (i * 8));
+        out.append(Str(buf, 4));
+    }
+
+    void patch_u32 (u32 at, u32 v) {
+        for (u32 i = 0; i < 4; i++) out.mut_data()[at + i] = char(v >> (i * 8));
+    }
+
+    void write_varint (u64 v) {
+        while (v >= 0x80) {
+            out.push_back(char(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(char(v));
+    }
+
+    void write_tag (BinaryKind kind, const Tree& t) {
+        out.push_back(char(u8(kind) | u8(t.flags & binary_flags) << 4));
+    }
+
+    u32 write_node (const Tree& t) {
+        require(out.size() <= u32(-1));
+        u32 at = out.size();
+        switch (t.form) {
+            case Form::Undefined: write_tag(BinaryKind::Undefined, t); break;
+            case Form::Null: write_tag(BinaryKind::Null, t); break;
+            case Form::Bool: {
+                write_tag(t.data.as_bool ? BinaryKind::True : BinaryKind::False, t);
+                break;
+            }
+            case Form::Number: {
+                if (t.floaty) {
+                    write_tag(BinaryKind::Floating, t);
+                    u64 bits;
+                    std::memcpy(&bits, &t.data.as_double, 8);
+                    write_u32(u32(bits));
+                    write_u32(u32(bits >> 32));
+                }
+                else {
+                    write_tag(BinaryKind::Integer, t);
+                    i64 v = t.data.as_i64;
+                    write_varint(u64(v) << 1 ^ u64(v >> 63));
+                }
+                break;
+            }
+            case Form::String: {
+                write_tag(BinaryKind::String, t);
+                write_varint(intern(Str(t)));
+                break;
+            }
+            case Form::Array: {
+                write_tag(BinaryKind::Array, t);
+                auto a = Slice<Tree>(t);
+                write_varint(a.size());
+                u32 table = out.size();
+                for (usize i = 0; i < a.size(); i++) write_u32(0);
+                for (usize i = 0; i < a.size(); i++) {
+                    patch_u32(table + i * 4, write_node(a[i]));
+                }
+                break;
+            }
+            case Form::Object: {
+                write_tag(BinaryKind::Object, t);
+                auto o = Slice<TreePair>(t);
+                write_varint(o.size());
+                u32 table = out.size();
+                for (auto& attr : o) {
+                    write_u32(intern(attr.first));
+                    write_u32(0);
+                }
+                for (usize i = 0; i < o.size(); i++) {
+                    patch_u32(table + i * 8 + 4, write_node(o[i].second));
+                }
+                break;
+            }
+            case Form::Error: {
+                write_tag(BinaryKind::Error, t);
+                try { std::rethrow_exception(std::exception_ptr(t)); }
+                catch (const std::exception& e) {
+                    write_varint(intern(error_messages.emplace_back(e.what())));
+                }
+                break;
+            }
+            default: never();
+        }
+        return at;
+    }
+
+    UniqueString write (const Tree& t) {
+        out.append("ayub");
+        write_u32(binary_version);
+        write_u32(0);
+        write_u32(0);
+        u32 root = write_node(t);
+        require(out.size() <= u32(-1));
+        u32 string_table = out.size();
+        write_u32(strings.size());
+        u32 end = 0;
+        for (auto& s : strings) {
+            end += s.size();
+            write_u32(end);
+        }
+        for (auto& s : strings) out.append(s);
+        require(out.size() <= u32(-1));
+        patch_u32(8, string_table);
+        patch_u32(12, root);
+        return move(out);
+    }
+};
+
+///// READING
+
+[[noreturn, gnu::cold]] NOINLINE
+static void raise_BinaryInvalid (Str why, u32 offset) {
+    raise(e_ParseFailed, cat(
+        "Invalid ayub data: ", why, " at offset ", offset
+    ));
+}
+
+static u32 read_u32 (Str data, u32 offset) {
+    if (offset > data.size() || data.size() - offset < 4) {
+        raise_BinaryInvalid("Offset out of range", offset);
+    }
+    u32 r = 0;
+    for (u32 i = 0; i < 4; i++) r |= u32(u8(data[offset + i])) << (i * 8);
+    return r;
+}
+
+ // Moves offset past the varint
+static u64 read_varint (Str data, u32& offset) {
+    u64 r = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        if (offset >= data.size()) {
+            raise_BinaryInvalid("Varint runs past end", offset);
+        }
+        u8 byte = data[offset++];
+        r |= u64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return r;
+    }
+    raise_BinaryInvalid("Varint too long", offset);
+}
+
+static u8 read_tag (Str data, u32 offset) {
+    if (offset >= data.size()) {
+        raise_BinaryInvalid("Node offset out of range", offset);
+    }
+    u8 tag = data[offset];
+    if ((tag & 0xf) > u8(BinaryKind::Error) ||
+        !!(TreeFlags(tag >> 4) & ~binary_flags)
+    ) raise_BinaryInvalid("Invalid node tag", offset);
+    return tag;
+}
+
+static BinaryKind kind_of (u8 tag) { return BinaryKind(tag & 0xf); }
+
+static Str read_string (Str data, u64 index, u32 at) {
+    u32 table = read_u32(data, 8);
+    u32 count = read_u32(data, table);
+    if (index >= count) raise_BinaryInvalid("String index out of range", at);
+    u32 strings = table + 4 + count * 4;
+    u32 begin = index ? read_u32(data, table + 4 + (index - 1) * 4) : 0;
+    u32 end = read_u32(data, table + 4 + index * 4);
+    if (begin > end || strings + u64(end) > data.size()) {
+        raise_BinaryInvalid("String out of range", at);
+    }
+    return data.slice(strings + begin, strings + end);
+}
+
+ // Reads the count of an array or object and returns the offset of its table.
+static u32 read_count (Str data, u32 offset, BinaryKind kind, u32& count) {
+    u8 tag = read_tag(data, offset);
+    if (kind_of(tag) != kind) {
+        raise(e_TreeWrongForm, cat(
+            "Expected ", kind == BinaryKind::Array ? "array" : "object",
+            " in ayub data at offset ", offset
+        ));
+    }
+    u32 p = offset + 1;
+    u64 n = read_varint(data, p);
+    u64 entry = kind == BinaryKind::Array ? 4 : 8;
+    if (n * entry > data.size() - p) {
+        raise_BinaryInvalid("Count too large", offset);
+    }
+    count = n;
+    return p;
+}
+
+static Tree decode_node (
+    Str data, u32 offset, bool borrow, u32 depth, usize& budget
+) {
+    if (depth > binary_max_depth) {
+        raise_BinaryInvalid("Nested too deeply", offset);
+    }
+    if (!budget) raise_BinaryInvalid("More nodes than bytes", offset);
+    budget--;
+    u8 tag = read_tag(data, offset);
+    auto flags = TreeFlags(tag >> 4);
+    u32 p = offset + 1;
+    switch (kind_of(tag)) {
+        case BinaryKind::Undefined: return Tree();
+        case BinaryKind::Null: return Tree(null, flags);
+        case BinaryKind::False: return Tree(false, flags);
+        case BinaryKind::True: return Tree(true, flags);
+        case BinaryKind::Integer: {
+            u64 z = read_varint(data, p);
+            return Tree(i64(z >> 1 ^ -(z & 1)), flags);
+        }
+        case BinaryKind::Floating: {
+            u64 bits = read_u32(data, p) | u64(read_u32(data, p + 4)) << 32;
+            double v;
+            std::memcpy(&v, &bits, 8);
+            return Tree(v, flags);
+        }
+        case BinaryKind::String: {
+            Str s = read_string(data, read_varint(data, p), offset);
+            if (borrow) {
+                return Tree(
+                    AnyString(StaticString(s)), flags | TreeFlags::Borrowed
+                );
+            }
+            else return Tree(s, flags);
+        }
+        case BinaryKind::Array: {
+            u32 count;
+            u32 table = read_count(data, offset, BinaryKind::Array, count);
+            auto a = UniqueArray<Tree>(Capacity(count));
+            for (u32 i = 0; i < count; i++) {
+                a.emplace_back_expect_capacity(decode_node(
+                    data, read_u32(data, table + i * 4), borrow, depth + 1,
+                    budget
+                ));
+            }
+            return Tree(move(a), flags);
+        }
+        case BinaryKind::Object: {
+            u32 count;
+            u32 table = read_count(data, offset, BinaryKind::Object, count);
+            auto o = UniqueArray<TreePair>(Capacity(count));
+            for (u32 i = 0; i < count; i++) {
+                Str key = read_string(
+                    data, read_u32(data, table + i * 8), table + i * 8
+                );
+                o.emplace_back_expect_capacity(key, decode_node(
+                    data, read_u32(data, table + i * 8 + 4), borrow, depth + 1,
+                    budget
+                ));
+            }
+            return Tree(move(o), flags);
+        }
+        case BinaryKind::Error: {
+            Str message = read_string(data, read_varint(data, p), offset);
+            try { raise(e_General, message); }
+            catch (...) { return Tree(std::current_exception(), flags); }
+        }
+        default: never();
+    }
+}
+
+} using namespace in;
+
+UniqueString tree_to_binary (const Tree& t) {
+    return BinaryWriter().write(t);
+}
+
+void tree_to_binary_file (const Tree& t, AnyString filename) {
+    string_to_file(tree_to_binary(t), move(filename));
+}
+
+BinaryView::BinaryView (Str d) : data(d) {
+    if (data.size() < 16 || data.chop(4) != "ayub") {
+        raise_BinaryInvalid("Missing header", 0);
+    }
+    u32 version = read_u32(data, 4);
+    if (version != binary_version) {
+        raise(e_ParseFailed, cat("Unsupported ayub version ", version));
+    }
+    offset = read_u32(data, 12);
+}
+
+Form BinaryView::form () const {
+    switch (kind_of(read_tag(data, offset))) {
+        case BinaryKind::Undefined: return Form::Undefined;
+        case BinaryKind::Null: return Form::Null;
+        case BinaryKind::False: case BinaryKind::True: return Form::Bool;
+        case BinaryKind::Integer: case BinaryKind::Floating: return Form::Number;
+        case BinaryKind::String: return Form::String;
+        case BinaryKind::Array: return Form::Array;
+        case BinaryKind::Object: return Form::Object;
+        case BinaryKind::Error: return Form::Error;
+        default: never();
+    }
+}
+
+TreeFlags BinaryView::flags () const {
+    return TreeFlags(read_tag(data, offset) >> 4);
+}
+
+u32 BinaryView::size () const {
+    u32 count;
+    auto kind = kind_of(read_tag(data, offset));
+    read_count(data, offset,
+        kind == BinaryKind::Object ? BinaryKind::Object : BinaryKind::Array,
+        count
+    );
+    return count;
+}
+
+BinaryView BinaryView::elem (u32 index) const {
+    u32 count;
+    u32 table = read_count(data, offset, BinaryKind::Array, count);
+    if (index >= count) {
+        raise(e_General, cat(
+            "Index ", index, " out of range for ayub array of size ", count
+        ));
+    }
+    return BinaryView(data, read_u32(data, table + index * 4));
+}
+
+Str BinaryView::key (u32 index) const {
+    u32 count;
+    u32 table = read_count(data, offset, BinaryKind::Object, count);
+    if (index >= count) {
+        raise(e_General, cat(
+            "Index ", index, " out of range for ayub object of size ", count
+        ));
+    }
+    return read_string(data, read_u32(data, table + index * 8), table + index * 8);
+}
+
+BinaryView BinaryView::value (u32 index) const {
+    u32 count;
+    u32 table = read_count(data, offset, BinaryKind::Object, count);
+    if (index >= count) {
+        raise(e_General, cat(
+            "Index ", index, " out of range for ayub object of size ", count
+        ));
+    }
+    return BinaryView(data, read_u32(data, table + index * 8 + 4));
+}
+
+std::optional<BinaryView> BinaryView::attr (Str k) const {
+    u32 count;
+    u32 table = read_count(data, offset, BinaryKind::Object, count);
+    for (u32 i = 0; i < count; i++) {
+        if (read_string(data, read_u32(data, table + i * 8), table) == k) {
+            return BinaryView(data, read_u32(data, table + i * 8 + 4));
+        }
+    }
+    return std::nullopt;
+}
+
+Tree BinaryView::decode (bool borrow) const {
+    usize budget = data.size();
+    return decode_node(data, offset, borrow, 0, budget);
+}
+
+Tree tree_from_binary (Str data, Str filename) {
+    try {
+        return BinaryView(data).decode();
+    }
+    catch (Error& e) {
+        if (e.code == e_ParseFailed && filename) {
+            e.details = cat(move(e.details), " in ", filename);
+        }
+        throw;
+    }
+}
+
+Tree tree_from_binary_file (AnyString filename) {
+    UniqueString s = string_from_file(filename);
+    return tree_from_binary(s, filename);
+}
+
+MappedTree tree_from_binary_file_mapped (AnyString filename) {
+    MappedTree r;
+    r.mapping = mapping_from_file(filename);
+    try {
+        r.tree = BinaryView(r.mapping.contents()).decode(true);
+    }
+    catch (Error& e) {
+        if (e.code == e_ParseFailed) {
+            e.details = cat(move(e.details), " in ", filename);
+        }
+        throw;
+    }
+    return r;
+}
+
+namespace in {
+
+ // A cache file is a header, the source filename, and then an ayub image.  The
+ // header is "ayuc" followed by these fields, little-endian, with no padding.
+struct CacheHeader {
+    u32 version;
+    u64 source_size;
+    i64 source_mtime;
+    u64 source_hash;
+    u32 filename_size;
+};
+static constexpr usize cache_header_size = 36;
+ // Bump the low bits if the header changes.
+constexpr u32 cache_version = binary_version << 8 | 2;
+
+static u64 read_cache_int (Str data, usize offset, usize size) {
+    expect(offset + size <= data.size());
+    u64 r = 0;
+    for (usize i = 0; i < size; i++) {
+        r |= u64(u8(data[offset + i])) << (i * 8);
+    }
+    return r;
+}
+
+static void write_cache_int (UniqueString& out, u64 v, usize size) {
+    for (usize i = 0; i < size; i++) out.push_back(char(v >> (i * 8)));
+}
+
+ // Reads the header of a cache file if it's for this source file (without
+ // checking its modification time or contents).
+static bool check_cache (
+    CacheHeader& head, Str cache, Str filename, const FileInfo& info
+) {
+    if (cache.size() < cache_header_size || cache.slice(0, 4) != "ayuc") {
+        return false;
+    }
+    head.version = read_cache_int(cache, 4, 4);
+    head.source_size = read_cache_int(cache, 8, 8);
+    head.source_mtime = read_cache_int(cache, 16, 8);
+    head.source_hash = read_cache_int(cache, 24, 8);
+    head.filename_size = read_cache_int(cache, 32, 4);
+    return head.version == cache_version &&
+        head.source_size == info.size &&
+        cache.size() - cache_header_size >= head.filename_size &&
+        cache.slice(
+            cache_header_size, cache_header_size + head.filename_size
+        ) == filename;
+}
+
+static void write_cache (
+    AnyString cache_filename, Str filename, const FileInfo& info,
+    u64 hash, Str image
+) {
+    UniqueString head;
+    head.append("ayuc");
+    write_cache_int(head, cache_version, 4);
+    write_cache_int(head, info.size, 8);
+    write_cache_int(head, info.mtime, 8);
+    write_cache_int(head, hash, 8);
+    write_cache_int(head, filename.size(), 4);
+    expect(head.size() == cache_header_size);
+     // Another process should never see a half-written cache.
+    auto file = AtomicFile(move(cache_filename));
+    file.write(head);
+    file.write(filename);
+    file.write(image);
+    file.commit();
+}
+
+} using namespace in;
+
+MappedTree tree_from_file_cached (
+    AnyString filename, AnyString cache_filename
+) {
+    FileInfo info;
+    if (!stat_utf8(filename.c_str(), info)) {
+         // Let this throw the appropriate error.
+        return tree_from_file_mapped(move(filename));
+    }
+    MappedTree r;
+    try {
+        r.mapping = mapping_from_file(cache_filename);
+        Str cache = r.mapping.contents();
+        CacheHeader head;
+        if (check_cache(head, cache, filename, info)) {
+            Str image = cache.slice(cache_header_size + head.filename_size);
+            if (head.source_mtime != info.mtime) {
+                 // The modification time can change without the contents
+                 // changing (for instance, when checking out files).  Compare
+                 // contents and if they're the same, update the time.
+                auto source = mapping_from_file(filename);
+                u64 hash = uni::hash64(source.contents());
+                if (hash != head.source_hash) goto miss;
+                r.tree = BinaryView(image).decode(true);
+                try {
+                    write_cache(cache_filename, filename, info, hash, image);
+                }
+                catch (std::exception&) { }
+            }
+            else r.tree = BinaryView(image).decode(true);
+            return r;
+        }
+    }
+    catch (std::exception&) { }
+    miss:
+    r = tree_from_file_mapped(filename);
+    try {
+        write_cache(
+            cache_filename, filename, info,
+            uni::hash64(r.mapping.contents()), tree_to_binary(r.tree)
+        );
+    }
+    catch (std::exception&) { }
+    return r;
+}
+
+} using namespace ayu;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../../tap/tap.h"
+#include "print.h"
+
+static tap::TestSet tests ("dirt/ayu/data/binary", []{
+    using namespace tap;
+
+    Tree all = Tree::array(
+        Tree(null), Tree(true), Tree(false), Tree(0), Tree(-1),
+        Tree(0x7fffffffffffffff), Tree(i64(0x8000000000000000)),
+        Tree(0xdeadbeef, TreeFlags::PreferHex), Tree(2.5), Tree(-0.0),
+        Tree(1.0/0.0), Tree(""), Tree("foo"),
+        Tree::array(Tree("foo"), Tree("bar")),
+        Tree(AnyArray<Tree>(), TreeFlags::PreferCompact),
+        Tree::object(
+            TreePair{"foo", Tree(1)},
+            TreePair{"bar", Tree::object(
+                TreePair{"foo", Tree(2)}
+            )}
+        ),
+        Tree(AnyArray<TreePair>(), TreeFlags::PreferExpanded)
+    );
+    auto encoded = tree_to_binary(all);
+    Tree decoded;
+    doesnt_throw([&]{ decoded = tree_from_binary(encoded); }, "Decode");
+    is(decoded, all, "Round-trip through binary");
+    bool flags_same = true;
+    for (u32 i = 0; i < all.size; i++) {
+        if (decoded[i].flags != all[i].flags) flags_same = false;
+        if (decoded[i].floaty != all[i].floaty) flags_same = false;
+    }
+    ok(flags_same, "Flags and floatiness survive round-trip");
+    ok(std::signbit(double(decoded[9])), "-0.0 survives round-trip");
+
+    Tree odd = Tree::array(Tree(), Tree(std::make_exception_ptr(
+        std::runtime_error("oops")
+    )));
+    Tree odd_decoded = tree_from_binary(tree_to_binary(odd));
+    is(odd_decoded[0u].form, Form::Undefined, "Undefined survives round-trip");
+    is(odd_decoded[1u].form, Form::Error, "Error survives round-trip");
+    UniqueString message;
+    try { std::rethrow_exception(std::exception_ptr(odd_decoded[1u])); }
+    catch (Error& e) { message = e.details; }
+    is(message, "oops", "Error message survives round-trip");
+
+    BinaryView root (encoded);
+    is(root.form(), Form::Array, "BinaryView::form");
+    is(root.size(), all.size, "BinaryView::size");
+    is(root.elem(12).decode(), Tree("foo"), "BinaryView::elem");
+    auto obj = root.elem(15);
+    is(obj.key(1), Str("bar"), "BinaryView::key");
+    auto bar = obj.attr("bar");
+    ok(!!bar, "BinaryView::attr finds attribute");
+    is(bar->value(0).decode(), Tree(2), "BinaryView::value");
+    ok(!obj.attr("baz"), "BinaryView::attr returns empty for missing key");
+    is(root.elem(7).flags(), TreeFlags::PreferHex, "BinaryView::flags");
+    throws_code<e_TreeWrongForm>([&]{ root.elem(12).size(); },
+        "BinaryView::size throws on non-container"
+    );
+     // "foo" appears as a string and a key several times but is only stored
+     // once.
+    usize foos = 0;
+    for (usize i = 0; i + 3 <= encoded.size(); i++) {
+        if (encoded.slice(i, i + 3) == "foo") foos++;
+    }
+    is(foos, 1u, "Strings are interned");
+
+     // Truncated and corrupted data should throw, not crash.
+    bool truncated_throws = true;
+    for (usize n = 0; n < encoded.size(); n++) {
+        try {
+            tree_from_binary(encoded.slice(0, n));
+             // The last bytes may be unused string table padding, but there
+             // isn't any, so everything short of the whole thing should fail.
+            truncated_throws = false;
+        }
+        catch (Error& e) {
+            if (e.code != e_ParseFailed) truncated_throws = false;
+        }
+    }
+    ok(truncated_throws, "Truncated data throws e_ParseFailed");
+    bool corrupted_ok = true;
+    for (usize i = 0; i < encoded.size(); i++) {
+        for (u8 bit = 0; bit < 8; bit++) {
+            UniqueString bad = encoded;
+            bad.mut_data()[i] ^= 1 << bit;
+            try { tree_from_binary(bad); }
+            catch (Error&) { }
+            catch (...) { corrupted_ok = false; }
+        }
+    }
+    ok(corrupted_ok, "Corrupted data doesn't crash");
+
+     // Point the array's only element back at the array.
+    UniqueString cyclic = tree_to_binary(Tree::array(Tree(0)));
+    {
+        u32 root_offset = BinaryView(cyclic).offset;
+        u32 table = root_offset + 2;
+        for (u32 i = 0; i < 4; i++) {
+            cyclic.mut_data()[table + i] = char(root_offset >> (i * 8));
+        }
+    }
+    throws_code<e_ParseFailed>([&]{ tree_from_binary(cyclic); },
+        "Cyclic data throws instead of recursing forever"
+    );
+
+     // A chain of arrays whose elements both point at the next array.  This
+     // would decode to 2^100 nodes.
+    UniqueString shared = "ayub";
+    auto push_u32 = [&shared](u32 v){
+        for (u32 i = 0; i < 4; i++) shared.push_back(char(v >> (i * 8)));
+    };
+    constexpr u32 chain = 100;
+    push_u32(binary_version);
+    push_u32(16 + chain * 10 + 1);
+    push_u32(16);
+    for (u32 i = 0; i < chain; i++) {
+        shared.push_back(char(BinaryKind::Array));
+        shared.push_back(char(2));
+        push_u32(16 + (i + 1) * 10);
+        push_u32(16 + (i + 1) * 10);
+    }
+    shared.push_back(char(BinaryKind::Null));
+    push_u32(0);
+    is(BinaryView(shared).elem(1).elem(0).form(), Form::Array,
+        "BinaryView can walk shared nodes"
+    );
+    throws_code<e_ParseFailed>([&]{ tree_from_binary(shared); },
+        "Data with shared nodes throws instead of decoding forever"
+    );
+
+    done_testing();
+});
+#endif
@@ -0,0 +1,93 @@
+// This module has a compact binary encoding for trees, called ayub.  It's
+// faster to load than the text format, and can be navigated without decoding
+// the whole thing.
+//
+// All integers are little-endian.  Offsets are from the start of the data.
+//     header: "ayub" u32(version) u32(string table offset) u32(root offset)
+//     string table: u32(count) u32(end of each string)... string bytes...
+//     node: u8(tag) payload
+//         The low 4 bits of the tag are the BinaryKind, and the high 4 bits
+//         are the tree's flags (only PreferHex, PreferCompact, and
+//         PreferExpanded are kept).
+//         Integer: zigzag varint
+//         Floating: 8 bytes
+//         String, Error: varint(string index)
+//         Array: varint(count) u32(element offset)...
+//         Object: varint(count) [u32(key string index) u32(value offset)]...
+// Every string (including keys) is only stored once in the string table.
+
+#pragma once
+
+#include <optional>
+#include "../common.h"
+#include "parse.h"
+#include "tree.h"
+
+namespace ayu {
+
+enum class BinaryKind : u8 {
+    Undefined,
+    Null,
+    False,
+    True,
+    Integer,
+    Floating,
+    String,
+    Array,
+    Object,
+    Error,
+};
+
+constexpr u32 binary_version = 1;
+
+ // Encode a tree.  Error trees are encoded with their what() message, and will
+ // decode to an error tree with the same message.
+UniqueString tree_to_binary (const Tree&);
+void tree_to_binary_file (const Tree&, AnyString filename);
+
+ // A read-only view of a node in encoded data.  The data is validated as it's
+ // accessed, so navigating malformed data throws e_ParseFailed instead of
+ // crashing.  This doesn't own the data, so don't let it outlive it.
+struct BinaryView {
+    Str data;
+    u32 offset;
+
+     // Checks the header and points to the root node.
+    explicit BinaryView (Str data);
+    BinaryView (Str data, u32 offset) : data(data), offset(offset) { }
+
+    Form form () const;
+    TreeFlags flags () const;
+     // Number of elements or attributes.  Throws if not an array or object.
+    u32 size () const;
+     // Throws if not an array or the index is out of range.
+    BinaryView elem (u32 index) const;
+     // Throws if not an object or the index is out of range.
+    Str key (u32 index) const;
+    BinaryView value (u32 index) const;
+     // Returns an empty optional if there's no attribute with that key.
+     // Throws if not an object.
+    std::optional<BinaryView> attr (Str key) const;
+
+     // Decode this node and everything below it.  If borrow is true, strings
+     // point into the data and are marked with TreeFlags::Borrowed.
+    Tree decode (bool borrow = false) const;
+};
+
+ // Decode a whole tree.  The filename is used for error reporting.
+Tree tree_from_binary (Str, Str filename = "");
+Tree tree_from_binary_file (AnyString filename);
+ // Like tree_from_file_mapped, but for binary files.
+MappedTree tree_from_binary_file_mapped (AnyString filename);
+
+ // Parses a text file, keeping a pre-parsed ayub image of it in cache_filename.
+ // The cache records the file's name, size, modification time, and a hash of
+ // its contents.  If the size and modification time still match (or if only
+ // the modification time changed but the contents hash the same), the tree is
+ // decoded from the cache instead of being parsed.  Otherwise the file is
+ // parsed and the cache is rewritten.  Failing to read or write the cache is
+ // not an error, since it's only an optimization.  Strings borrow from the
+ // mapping like tree_from_file_mapped.
+MappedTree tree_from_file_cached (AnyString filename, AnyString cache_filename);
+
+} // namespace ayu
@@ -0,0 +1,266 @@
+#include "char-scan.private.h"
+
+#include <bit>
+
+#if defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define AYU_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define AYU_SCAN_X86 0
+#endif
+
+namespace ayu::in {
+
+static ScanLevel detect_scan_level () noexcept {
+#if AYU_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return ScanLevel::AVX2;
+    else return ScanLevel::SSE2;
+#else
+    return ScanLevel::Scalar;
+#endif
+}
+
+ScanLevel max_scan_level () noexcept {
+    static ScanLevel r = detect_scan_level();
+    return r;
+}
+
+ScanLevel scan_level = max_scan_level();
+
+#if AYU_SCAN_X86
+
+ // The byte classes, written as ranges so they can be tested with a few
+ // compares instead of a table lookup per byte.
+ //   whitespace: ' ' and \t \n \v \f \r (0x09..0x0d)
+ //   word: 0x21..0x7e except " ' ( ) , : ; [ \ ] ` { | }
+ // The tests check these against char_props for every byte.
+
+///// SSE2
+
+ALWAYS_INLINE static
+__m128i in_range_128 (__m128i v, u8 lo, u8 hi) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(char(lo)));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(char(hi - lo))), t);
+}
+
+ALWAYS_INLINE static
+__m128i eq_128 (__m128i v, char c) {
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+static const char* scan_ws_sse2 (const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i ws = _mm_or_si128(eq_128(v, ' '), in_range_128(v, 0x09, 0x0d));
+        u32 mask = u32(_mm_movemask_epi8(ws));
+        if (mask != 0xffff) return p + std::countr_one(mask);
+        p += 16;
+    }
+    return p;
+}
+
+static const char* scan_word_sse2 (const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i not_word = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(eq_128(v, '"'), eq_128(v, ',')),
+                _mm_or_si128(eq_128(v, '`'), in_range_128(v, 0x27, 0x29))
+            ),
+            _mm_or_si128(
+                in_range_128(v, 0x3a, 0x3b),
+                _mm_or_si128(
+                    in_range_128(v, 0x5b, 0x5d), in_range_128(v, 0x7b, 0x7d)
+                )
+            )
+        );
+        __m128i word = _mm_andnot_si128(not_word, in_range_128(v, 0x21, 0x7e));
+        u32 mask = u32(_mm_movemask_epi8(word));
+        if (mask != 0xffff) return p + std::countr_one(mask);
+        p += 16;
+    }
+    return p;
+}
+
+static const char* scan_quoted_sse2 (const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i special = _mm_or_si128(eq_128(v, '"'), eq_128(v, '\\'));
+        u32 mask = u32(_mm_movemask_epi8(special));
+        if (mask) return p + std::countr_zero(mask);
+        p += 16;
+    }
+    return p;
+}
+
+static const char* scan_structural_sse2 (const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(
+                _mm_or_si128(eq_128(v, '"'), eq_128(v, '&')),
+                _mm_or_si128(eq_128(v, '*'), eq_128(v, '-'))
+            ),
+            _mm_or_si128(
+                in_range_128(v, 0x5b, 0x5d), in_range_128(v, 0x7b, 0x7d)
+            )
+        );
+        u32 mask = u32(_mm_movemask_epi8(special));
+        if (mask) return p + std::countr_zero(mask);
+        p += 16;
+    }
+    return p;
+}
+
+///// AVX2
+ // These call _mm256_zeroupper() explicitly before leaving, because not every
+ // optimization level inserts it, and leaving the upper halves dirty makes
+ // later SSE code (including the SSE2 tail) very slow.
+
+[[gnu::target("avx2")]] ALWAYS_INLINE static
+__m256i in_range_256 (__m256i v, u8 lo, u8 hi) {
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(char(lo)));
+    return _mm256_cmpeq_epi8(
+        _mm256_min_epu8(t, _mm256_set1_epi8(char(hi - lo))), t
+    );
+}
+
+[[gnu::target("avx2")]] ALWAYS_INLINE static
+__m256i eq_256 (__m256i v, char c) {
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+[[gnu::target("avx2")]] static
+const char* scan_ws_avx2 (const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ws = _mm256_or_si256(
+            eq_256(v, ' '), in_range_256(v, 0x09, 0x0d)
+        );
+        u32 mask = u32(_mm256_movemask_epi8(ws));
+        if (mask != 0xffffffff) {
+            _mm256_zeroupper();
+            return p + std::countr_one(mask);
+        }
+        p += 32;
+    }
+    _mm256_zeroupper();
+    return scan_ws_sse2(p, end);
+}
+
+[[gnu::target("avx2")]] static
+const char* scan_word_avx2 (const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i not_word = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(eq_256(v, '"'), eq_256(v, ',')),
+                _mm256_or_si256(eq_256(v, '`'), in_range_256(v, 0x27, 0x29))
+            ),
+            _mm256_or_si256(
+                in_range_256(v, 0x3a, 0x3b),
+                _mm256_or_si256(
+                    in_range_256(v, 0x5b, 0x5d), in_range_256(v, 0x7b, 0x7d)
+                )
+            )
+        );
+        __m256i word = _mm256_andnot_si256(
+            not_word, in_range_256(v, 0x21, 0x7e)
+        );
+        u32 mask = u32(_mm256_movemask_epi8(word));
+        if (mask != 0xffffffff) {
+            _mm256_zeroupper();
+            return p + std::countr_one(mask);
+        }
+        p += 32;
+    }
+    _mm256_zeroupper();
+    return scan_word_sse2(p, end);
+}
+
+[[gnu::target("avx2")]] static
+const char* scan_quoted_avx2 (const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i special = _mm256_or_si256(eq_256(v, '"'), eq_256(v, '\\'));
+        u32 mask = u32(_mm256_movemask_epi8(special));
+        if (mask) {
+            _mm256_zeroupper();
+            return p + std::countr_zero(mask);
+        }
+        p += 32;
+    }
+    _mm256_zeroupper();
+    return scan_quoted_sse2(p, end);
+}
+
+[[gnu::target("avx2")]] static
+const char* scan_structural_avx2 (const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(eq_256(v, '"'), eq_256(v, '&')),
+                _mm256_or_si256(eq_256(v, '*'), eq_256(v, '-'))
+            ),
+            _mm256_or_si256(
+                in_range_256(v, 0x5b, 0x5d), in_range_256(v, 0x7b, 0x7d)
+            )
+        );
+        u32 mask = u32(_mm256_movemask_epi8(special));
+        if (mask) {
+            _mm256_zeroupper();
+            return p + std::countr_zero(mask);
+        }
+        p += 32;
+    }
+    _mm256_zeroupper();
+    return scan_structural_sse2(p, end);
+}
+
+#endif
+
+///// DISPATCH
+ // The vectorized functions stop when there's less than a full vector left,
+ // and the scalar loops take care of the rest.  If the vectorized function
+ // found the end of the run, the scalar loop stops immediately.
+
+const char* scan_ws (const char* p, const char* end) noexcept {
+#if AYU_SCAN_X86
+    if (scan_level == ScanLevel::AVX2) p = scan_ws_avx2(p, end);
+    else if (scan_level == ScanLevel::SSE2) p = scan_ws_sse2(p, end);
+#endif
+    while (p < end && char_props[u8(*p)] & CHAR_IS_WS) p++;
+    return p;
+}
+
+const char* scan_word (const char* p, const char* end) noexcept {
+#if AYU_SCAN_X86
+    if (scan_level == ScanLevel::AVX2) p = scan_word_avx2(p, end);
+    else if (scan_level == ScanLevel::SSE2) p = scan_word_sse2(p, end);
+#endif
+    while (p < end && char_props[u8(*p)] & CHAR_CONTINUES_WORD) p++;
+    return p;
+}
+
+const char* scan_quoted (const char* p, const char* end) noexcept {
+#if AYU_SCAN_X86
+    if (scan_level == ScanLevel::AVX2) p = scan_quoted_avx2(p, end);
+    else if (scan_level == ScanLevel::SSE2) p = scan_quoted_sse2(p, end);
+#endif
+    while (p < end && *p != '"' && *p != '\\') p++;
+    return p;
+}
+
+const char* scan_structural (const char* p, const char* end) noexcept {
+#if AYU_SCAN_X86
+    if (scan_level == ScanLevel::AVX2) p = scan_structural_avx2(p, end);
+    else if (scan_level == ScanLevel::SSE2) p = scan_structural_sse2(p, end);
+#endif
+    while (p < end && !is_structural(*p)) p++;
+    return p;
+}
+
+} // ayu::in
@@ -0,0 +1,90 @@
+// Character classification and bulk scanning for the parser.  The scan_*
+// functions find the end of a run of bytes of the same class, using SSE2 or
+// AVX2 to classify 16 or 32 bytes at a time when the CPU supports it.
+
+#pragma once
+
+#include <array>
+#include "../common.h"
+
+namespace ayu::in {
+
+enum CharProps : u8 {
+    CHAR_IS_WS = 0x80,
+    CHAR_CONTINUES_WORD = 0x40,
+    CHAR_TERM_MASK = 0x0f,
+    CHAR_TERM_ERROR = 0,
+    CHAR_TERM_WORD = 1,
+    CHAR_TERM_DIGIT = 2,
+    CHAR_TERM_DOT = 3,
+    CHAR_TERM_PLUS = 4,
+    CHAR_TERM_MINUS = 5,
+    CHAR_TERM_STRING = 6,
+    CHAR_TERM_ARRAY = 7,
+    CHAR_TERM_OBJECT = 8,
+    CHAR_TERM_DECL = 9,
+    CHAR_TERM_SHORTCUT = 10,
+};
+ // Index this with u8(c), not c, because char is signed on most platforms.
+constexpr std::array<u8, 256> char_props = []{
+    std::array<u8, 256> r = {};
+    for (char c : {' ', '\f', '\n', '\r', '\t', '\v'}) {
+        r[c] = CHAR_IS_WS;
+    }
+    for (char c = '0'; c <= '9'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_DIGIT;
+    for (char c = 'a'; c <= 'z'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_WORD;
+    for (char c = 'A'; c <= 'Z'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_WORD;
+    for (char c : {
+        '!', '$', '%', '+', '-', '.', '/', '<', '>',
+        '?', '@', '^', '_', '~', '#', '&', '*', '='
+    }) r[c] = CHAR_CONTINUES_WORD;
+    for (char c : {'_', '/', '?', '#'}) r[c] |= CHAR_TERM_WORD;
+    r['.'] |= CHAR_TERM_DOT;
+    r['+'] |= CHAR_TERM_PLUS;
+    r['-'] |= CHAR_TERM_MINUS;
+    r['"'] |= CHAR_TERM_STRING;
+    r['['] |= CHAR_TERM_ARRAY;
+    r['{'] |= CHAR_TERM_OBJECT;
+    r['&'] |= CHAR_TERM_DECL;
+    r['*'] |= CHAR_TERM_SHORTCUT;
+    return r;
+}();
+
+ // Which implementation the scan_* functions use.  This is picked at startup
+ // from CPU feature detection.  Lowering it is allowed (the tests do so to
+ // compare implementations), but raising it above what the CPU supports will
+ // crash.
+enum class ScanLevel : u8 {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+extern ScanLevel scan_level;
+ // The highest level supported by this CPU and build.
+ScanLevel max_scan_level () noexcept;
+
+ // These all return the first byte in [p, end) that doesn't belong to the
+ // class, or end if there is no such byte.  Comments are not handled here.
+ // They never read outside of [p, end).
+
+ // Skips CHAR_IS_WS bytes.
+const char* scan_ws (const char* p, const char* end) noexcept;
+ // Skips CHAR_CONTINUES_WORD bytes.
+const char* scan_word (const char* p, const char* end) noexcept;
+ // Skips bytes in a quoted string until " or \.
+const char* scan_quoted (const char* p, const char* end) noexcept;
+ // Bytes that can start a string, comment, shortcut, array, or object, or end
+ // an array or object (plus \ and |, which are cheaper to include than not).
+constexpr bool is_structural (char c) {
+    switch (c) {
+        case '"': case '&': case '*': case '-':
+        case '[': case '\\': case ']': case '{': case '|': case '}':
+            return true;
+        default: return false;
+    }
+}
+ // Skips bytes that aren't is_structural.  This is for quickly finding the
+ // boundaries of items without fully parsing them.
+const char* scan_structural (const char* p, const char* end) noexcept;
+
+} // ayu::in
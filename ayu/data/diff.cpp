@@ -0,0 +1,549 @@
+#include "diff.h"
+
+#include <algorithm>
+#include "../reflection/describe.h"
+#include "../traversal/from-tree.h"
+#include "../traversal/to-tree.h"
+#include "print.h"
+
+namespace ayu {
+namespace in {
+
+ // Trees that share a buffer must be equal, so we don't need to look inside
+ // them.  Lazy trees also count, since as_lazy_ptr overlaps the other pointers.
+static bool same_buffer (const Tree& a, const Tree& b) {
+    if (a.form != b.form || a.size != b.size || !a.size) return false;
+    switch (a.form) {
+        case Form::String: case Form::Array: case Form::Object:
+            return a.data.as_char_ptr == b.data.as_char_ptr;
+        default: return false;
+    }
+}
+
+static bool same (const Tree& a, const Tree& b) {
+    return same_buffer(a, b) || a == b;
+}
+
+ // Myers' algorithm takes O((n+m)*d) time and O(d^2) memory, where d is the
+ // number of differences.  Past this many differences, give up and pair up the
+ // elements in order.
+constexpr i32 max_myers_d = 512;
+
+struct Differ {
+    UniqueArray<Tree> path;
+    TreePatch patch;
+
+    void emit (TreeEditOp op, const Tree& value = Tree()) {
+        patch.push_back(TreeEdit{op, UniqueArray<Tree>(Slice<Tree>(path)), value});
+    }
+
+    void diff (const Tree& a, const Tree& b) {
+        if (same_buffer(a, b)) return;
+        if (a.form == b.form) {
+            if (a.form == Form::Array) return diff_arrays(a, b);
+            if (a.form == Form::Object) return diff_objects(a, b);
+        }
+        if (!(a == b)) emit(TreeEditOp::Replace, b);
+    }
+
+     // If describing the changes to a container took more edits than it has
+     // elements, it's more compact to just replace the whole thing.
+    void maybe_replace (usize start, const Tree& b) {
+        if (patch.size() - start > b.size) {
+            patch.shrink(start);
+            emit(TreeEditOp::Replace, b);
+        }
+    }
+
+    void diff_objects (const Tree& a, const Tree& b) {
+        usize start = patch.size();
+        for (auto& [key, av] : Slice<TreePair>(a)) {
+            path.push_back(Tree(key));
+            if (const Tree* bv = b.attr(key)) diff(av, *bv);
+            else emit(TreeEditOp::Remove);
+            path.pop_back();
+        }
+        for (auto& [key, bv] : Slice<TreePair>(b)) {
+            if (!a.attr(key)) {
+                path.push_back(Tree(key));
+                emit(TreeEditOp::Insert, bv);
+                path.pop_back();
+            }
+        }
+        maybe_replace(start, b);
+    }
+
+     // Diff a run of elements with no matches between them.  Pair up as many
+     // as possible, then remove or insert the rest.  index is the position of
+     // as[0] in the original array.
+    void diff_run (Slice<Tree> as, Slice<Tree> bs, u32 index) {
+        usize common = std::min(as.size(), bs.size());
+        for (usize i = 0; i < common; i++) {
+            path.push_back(Tree(index + i));
+            diff(as[i], bs[i]);
+            path.pop_back();
+        }
+        for (usize i = common; i < as.size(); i++) {
+            path.push_back(Tree(index + i));
+            emit(TreeEditOp::Remove);
+            path.pop_back();
+        }
+        for (usize i = common; i < bs.size(); i++) {
+            path.push_back(Tree(index + as.size()));
+            emit(TreeEditOp::Insert, bs[i]);
+            path.pop_back();
+        }
+    }
+
+    void diff_arrays (const Tree& a, const Tree& b) {
+        usize start = patch.size();
+        auto as = Slice<Tree>(a);
+        auto bs = Slice<Tree>(b);
+         // Skip the common prefix and suffix, which is usually most of it.
+        u32 pre = 0;
+        while (pre < as.size() && pre < bs.size() && same(as[pre], bs[pre])) {
+            pre++;
+        }
+        u32 suf = 0;
+        while (suf < as.size() - pre && suf < bs.size() - pre &&
+            same(as[as.size() - 1 - suf], bs[bs.size() - 1 - suf])
+        ) suf++;
+        auto am = as.slice(pre, as.size() - suf);
+        auto bm = bs.slice(pre, bs.size() - suf);
+         // If the lengths are the same, elements were probably modified in
+         // place, so don't bother looking for insertions and deletions.
+        UniqueArray<Pair<u32, u32>> matches;
+        if (am.size() == bm.size() || !myers(am, bm, matches)) {
+            diff_run(am, bm, pre);
+        }
+        else {
+            u32 ai = 0, bi = 0;
+            for (auto [x, y] : matches) {
+                diff_run(am.slice(ai, x), bm.slice(bi, y), pre + ai);
+                ai = x + 1;
+                bi = y + 1;
+            }
+            diff_run(am.slice(ai), bm.slice(bi), pre + ai);
+        }
+        maybe_replace(start, b);
+    }
+
+     // Finds the positions of matching elements in the shortest edit script,
+     // or returns false if there are too many differences.  This is the
+     // simple version of the algorithm that records every round of the search
+     // and then backtracks.
+    static bool myers (
+        Slice<Tree> as, Slice<Tree> bs, UniqueArray<Pair<u32, u32>>& matches
+    ) {
+        i32 n = as.size();
+        i32 m = bs.size();
+        i32 max_d = std::min(n + m, max_myers_d);
+         // v[k] is the furthest x reached on diagonal k (where k = x - y).
+        UniqueArray<i32> v_buf (2 * max_d + 3, 0);
+        i32* v = v_buf.mut_data() + max_d + 1;
+         // A copy of v[-d..d] at the start of each round d, starting at d*d.
+        UniqueArray<i32> trace;
+        for (i32 d = 0; d <= max_d; d++) {
+            trace.append(Slice<i32>(v - d, v + d + 1));
+            for (i32 k = -d; k <= d; k += 2) {
+                i32 x = k == -d || (k != d && v[k-1] < v[k+1])
+                    ? v[k+1] : v[k-1] + 1;
+                i32 y = x - k;
+                while (x < n && y < m && same(as[x], bs[y])) { x++; y++; }
+                v[k] = x;
+                if (x >= n && y >= m) {
+                    backtrack(n, m, d, trace, matches);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static void backtrack (
+        i32 x, i32 y, i32 d, Slice<i32> trace,
+        UniqueArray<Pair<u32, u32>>& matches
+    ) {
+        for (; d >= 0; d--) {
+            const i32* v = &trace[d * d + d];
+            i32 k = x - y;
+            i32 prev_x = 0, prev_y = 0;
+            if (d > 0) {
+                i32 prev_k = k == -d || (k != d && v[k-1] < v[k+1])
+                    ? k + 1 : k - 1;
+                prev_x = v[prev_k];
+                prev_y = prev_x - prev_k;
+            }
+            while (x > prev_x && y > prev_y) {
+                x--; y--;
+                matches.push_back({u32(x), u32(y)});
+            }
+            x = prev_x;
+            y = prev_y;
+        }
+        std::reverse(matches.begin(), matches.end());
+    }
+};
+
+[[noreturn, gnu::cold]]
+static void raise_TreePatchInvalid (const TreeEdit& e, Str why) {
+    raise(e_TreePatchInvalid, cat(
+        "Can't apply edit at ",
+        tree_to_string(Tree(AnyArray<Tree>(Slice<Tree>(e.path)))), ": ", why
+    ));
+}
+
+static Tree apply (const Tree&, Slice<const TreeEdit*>, u32 depth);
+
+ // Edits that are directly inserting into or removing from this tree (instead
+ // of one of its children).
+static bool direct (const TreeEdit* e, u32 depth, TreeEditOp op) {
+    return e->op == op && e->path.size() == depth + 1;
+}
+
+struct PatchItem {
+    u32 index;
+    bool insert;
+    const TreeEdit* edit;
+};
+
+static void sort_items (UniqueArray<PatchItem>& items) {
+     // Inserts go before other edits with the same index, but otherwise keep
+     // the original order.
+    std::stable_sort(items.begin(), items.end(),
+        [](const PatchItem& a, const PatchItem& b){
+            return a.index < b.index ||
+                (a.index == b.index && a.insert && !b.insert);
+        }
+    );
+}
+
+ // Collects the non-insert edits for one index, and checks that a removal
+ // isn't combined with anything else.
+static bool collect_group (
+    Slice<PatchItem> items, usize& it, u32 index, u32 depth,
+    UniqueArray<const TreeEdit*>& group
+) {
+    group.clear();
+    bool remove = false;
+    while (it < items.size() && items[it].index == index) {
+        auto e = items[it++].edit;
+        remove |= direct(e, depth, TreeEditOp::Remove);
+        group.push_back(e);
+    }
+    if (remove && group.size() > 1) {
+        raise_TreePatchInvalid(*group[0], "Conflicting edits");
+    }
+    return remove;
+}
+
+static Tree apply_array (
+    const Tree& t, Slice<const TreeEdit*> edits, u32 depth
+) {
+    auto elems = Slice<Tree>(t);
+    UniqueArray<PatchItem> items (Capacity(edits.size()));
+    for (auto e : edits) {
+        auto& seg = e->path[depth];
+        if (seg.form != Form::Number || seg.floaty || seg.data.as_i64 < 0) {
+            raise_TreePatchInvalid(*e, "Expected an array index");
+        }
+        bool insert = direct(e, depth, TreeEditOp::Insert);
+        if (seg.data.as_i64 > i64(elems.size()) ||
+            (seg.data.as_i64 == i64(elems.size()) && !insert)
+        ) raise_TreePatchInvalid(*e, "Array index out of range");
+        items.push_back({u32(seg.data.as_i64), insert, e});
+    }
+    sort_items(items);
+
+    UniqueArray<Tree> r (Capacity(elems.size() + items.size()));
+    UniqueArray<const TreeEdit*> group;
+    usize it = 0;
+    for (u32 i = 0; i <= elems.size(); i++) {
+        while (it < items.size() && items[it].index == i && items[it].insert) {
+            r.push_back(items[it++].edit->value);
+        }
+        if (i == elems.size()) break;
+        if (collect_group(items, it, i, depth, group)) continue;
+        else if (group) r.push_back(apply(elems[i], group, depth + 1));
+        else r.push_back(elems[i]);
+    }
+    return Tree(move(r), t.flags);
+}
+
+static Tree apply_object (
+    const Tree& t, Slice<const TreeEdit*> edits, u32 depth
+) {
+    auto pairs = Slice<TreePair>(t);
+    UniqueArray<PatchItem> items (Capacity(edits.size()));
+    for (auto e : edits) {
+        auto& seg = e->path[depth];
+        if (seg.form != Form::String) {
+            raise_TreePatchInvalid(*e, "Expected an object key");
+        }
+        const Tree* v = t.attr(Str(seg));
+        bool insert = direct(e, depth, TreeEditOp::Insert);
+        u32 index;
+        if (insert) {
+            if (v) raise_TreePatchInvalid(*e, "Key already exists");
+            index = pairs.size();
+        }
+        else {
+            if (!v) raise_TreePatchInvalid(*e, "Key doesn't exist");
+            index = ((const char*)v - (const char*)&pairs[0].second)
+                  / sizeof(TreePair);
+        }
+        items.push_back({index, insert, e});
+    }
+    sort_items(items);
+
+    UniqueArray<TreePair> r (Capacity(pairs.size() + items.size()));
+    UniqueArray<const TreeEdit*> group;
+    usize it = 0;
+    for (u32 i = 0; i < pairs.size(); i++) {
+        if (collect_group(items, it, i, depth, group)) continue;
+        else if (group) {
+            r.push_back(TreePair{
+                pairs[i].first, apply(pairs[i].second, group, depth + 1)
+            });
+        }
+        else r.push_back(pairs[i]);
+    }
+    usize first_new = r.size();
+    for (; it < items.size(); it++) {
+        auto e = items[it].edit;
+        auto key = AnyString(e->path[depth]);
+        for (usize j = first_new; j < r.size(); j++) {
+            if (r[j].first == key) {
+                raise_TreePatchInvalid(*e, "Key inserted twice");
+            }
+        }
+        r.push_back(TreePair{move(key), e->value});
+    }
+    return Tree(move(r), t.flags);
+}
+
+static Tree apply (const Tree& t, Slice<const TreeEdit*> edits, u32 depth) {
+    expect(edits);
+    for (auto e : edits) {
+        if (e->path.size() == depth) {
+            if (e->op != TreeEditOp::Replace) {
+                raise_TreePatchInvalid(*e, "Only Replace can have an empty path");
+            }
+            if (edits.size() > 1) {
+                raise_TreePatchInvalid(*e, "Conflicting edits");
+            }
+            return e->value;
+        }
+    }
+    if (t.form == Form::Array) return apply_array(t, edits, depth);
+    else if (t.form == Form::Object) return apply_object(t, edits, depth);
+    else raise_TreePatchInvalid(*edits[0], cat(
+        "Can't edit inside a tree of form ", show(&t.form)
+    ));
+}
+
+} using namespace in;
+
+TreePatch tree_diff (const Tree& a, const Tree& b) {
+    Differ differ;
+    differ.diff(a, b);
+    return move(differ.patch);
+}
+
+Tree tree_patch (const Tree& t, Slice<TreeEdit> patch) {
+    if (!patch) return t;
+    auto edits = UniqueArray<const TreeEdit*>(
+        patch.size(), [&](usize i){ return &patch[i]; }
+    );
+    return apply(t, edits, 0);
+}
+
+} using namespace ayu;
+
+AYU_DESCRIBE(ayu::TreeEditOp,
+    values(
+        value("replace", TreeEditOp::Replace),
+        value("insert", TreeEditOp::Insert),
+        value("remove", TreeEditOp::Remove)
+    )
+)
+
+ // Serialized as [op [path...] value], without the value for remove.
+AYU_DESCRIBE(ayu::TreeEdit,
+    to_tree([](const TreeEdit& v){
+        auto op = item_to_tree(const_cast<TreeEditOp*>(&v.op));
+        auto path = Tree(AnyArray<Tree>(Slice<Tree>(v.path)));
+        if (v.op == TreeEditOp::Remove) return Tree::array(op, path);
+        else return Tree::array(op, path, v.value);
+    }),
+    from_tree([](TreeEdit& v, const Tree& t){
+        auto a = Slice<Tree>(t);
+        if (a.size() < 1) raise(e_LengthRejected, "TreeEdit needs an op");
+        item_from_tree(&v.op, a[0]);
+        u32 len = v.op == TreeEditOp::Remove ? 2 : 3;
+        if (a.size() != len) raise(e_LengthRejected, cat(
+            "TreeEdit with this op needs ", len, " elements"
+        ));
+         // The tree we're given may be borrowing from a file that's about to
+         // be unmapped.
+        auto path = Slice<Tree>(a[1]);
+        v.path = UniqueArray<Tree>(path.size(), [&](usize i){
+            return tree_unborrow(path[i]);
+        });
+        v.value = len == 3 ? tree_unborrow(a[2]) : Tree();
+        return true;
+    })
+)
+
+#ifndef TAP_DISABLE_TESTS
+#include "../../tap/tap.h"
+#include "parse.h"
+
+static tap::TestSet tests ("dirt/ayu/data/diff", []{
+    using namespace tap;
+
+    auto round_trip = [](Str a_s, Str b_s, Str name){
+        Tree a = tree_from_string(a_s);
+        Tree b = tree_from_string(b_s);
+        TreePatch patch;
+        if (!doesnt_throw([&]{ patch = tree_diff(a, b); }, cat(name, " (diff)"))) {
+            return patch;
+        }
+        try_is([&]{ return tree_patch(a, patch); }, b, cat(name, " (patch)"));
+        return patch;
+    };
+    auto patch_string = [](const TreePatch& p){
+        return tree_to_string(item_to_tree(const_cast<TreePatch*>(&p)));
+    };
+
+    auto p = round_trip("[1 2 3]", "[1 2 3]", "Equal arrays");
+    is(p.size(), 0u, "Equal arrays have an empty patch");
+    p = round_trip("4", "5", "Scalars");
+    is(patch_string(p), "[[replace [] 5]]", "Different scalars are replaced");
+    p = round_trip("4", "4.0", "Equal numbers");
+    is(p.size(), 0u, "Numbers that compare equal aren't replaced");
+    p = round_trip(
+        "{a:{b:[1 2 {c:3}]} d:4 e:[5 6 7 8]}",
+        "{a:{b:[1 2 {c:30}]} d:4 e:[5 6 7 8]}",
+        "Deep change"
+    );
+    is(patch_string(p), "[[replace [a b 2 c] 30]]", "Deep change has one edit");
+    p = round_trip(
+        "{a:1 b:2 c:3 d:4}", "{a:1 c:3 d:4 e:5}", "Object keys"
+    );
+    is(patch_string(p), "[[remove [b]] [insert [e] 5]]",
+        "Object key removal and insertion"
+    );
+    p = round_trip(
+        "[0 1 2 3 4 5 6 7 8 9]", "[0 1 2 3 x 4 5 6 7 8 9]", "Array insertion"
+    );
+    is(patch_string(p), "[[insert [4] x]]", "Array insertion has one edit");
+    p = round_trip(
+        "[0 1 2 3 4 5 6 7 8 9]", "[0 1 3 4 5 6 7 9]", "Array removals"
+    );
+    is(patch_string(p), "[[remove [2]] [remove [8]]]",
+        "Array removals refer to original indexes"
+    );
+    p = round_trip(
+        "[0 1 2 3 4 5 6 7 8 9]", "[0 a 2 3 b 5 6 7 8 9 c]", "Mixed array edits"
+    );
+    is(patch_string(p), "[[replace [1] a] [replace [4] b] [insert [10] c]]",
+        "Mixed array edits"
+    );
+    p = round_trip("[0 1 2 3 4 5]", "[a b]", "Complete array change");
+    is(patch_string(p), "[[replace [] [a b]]]",
+        "Changing everything replaces the whole array"
+    );
+    round_trip("[]", "[1 2 3]", "Insert into empty array");
+    round_trip("[1 2 3]", "[]", "Remove everything from array");
+    round_trip("{}", "{a:1}", "Insert into empty object");
+    round_trip("[{a:1} {b:2}]", "{a:1}", "Form change");
+
+     // Shared subtrees aren't examined
+    {
+        UniqueArray<Tree> elems;
+        for (u32 i = 0; i < 1000; i++) {
+            elems.push_back(Tree::array(Tree(i), Tree(cat("item ", i))));
+        }
+        Tree big (move(elems));
+        Tree a = Tree::object(TreePair{"big", big}, TreePair{"x", Tree(1)});
+        Tree b = Tree::object(TreePair{"big", big}, TreePair{"x", Tree(2)});
+        p = tree_diff(a, b);
+        is(patch_string(p), "[[replace [x] 2]]", "Shared subtree is skipped");
+        is(tree_diff(big, big).size(), 0u, "Diffing a tree with itself");
+        Tree patched = tree_patch(a, p);
+        ok(patched["big"].data.as_array_ptr == big.data.as_array_ptr,
+            "Patching shares untouched subtrees"
+        );
+    }
+
+     // Randomized edits
+    u64 rng = 12345;
+    auto rand = [&](u32 n){
+        rng = rng * 6364136223846793005 + 1442695040888963407;
+        return u32((rng >> 33) % n);
+    };
+    u32 failures = 0;
+    for (u32 trial = 0; trial < 200; trial++) {
+        UniqueArray<Tree> a_elems;
+        u32 len = rand(40);
+        for (u32 i = 0; i < len; i++) a_elems.push_back(Tree(rand(10)));
+        UniqueArray<Tree> b_elems = a_elems;
+        u32 edits = rand(8);
+        for (u32 e = 0; e < edits; e++) {
+            u32 what = rand(3);
+            if (what == 0 || !b_elems) {
+                b_elems.insert(rand(b_elems.size() + 1), Tree(rand(10)));
+            }
+            else if (what == 1) b_elems.erase(rand(b_elems.size()));
+            else b_elems[rand(b_elems.size())] = Tree(rand(10));
+        }
+        Tree a = Tree::array(
+            Tree(move(a_elems)), Tree::object(TreePair{"k", Tree(trial)})
+        );
+        Tree b = Tree::array(
+            Tree(move(b_elems)), Tree::object(TreePair{"k", Tree(trial)})
+        );
+        try {
+            if (tree_patch(a, tree_diff(a, b)) != b) {
+                if (!failures++) diag(cat(
+                    tree_to_string(a), " -> ", tree_to_string(b)
+                ));
+            }
+        }
+        catch (std::exception& ex) {
+            if (!failures++) diag(ex.what());
+        }
+    }
+    is(failures, 0u, "Random array edits round-trip");
+
+     // Serialization
+    {
+        TreePatch orig = tree_diff(
+            tree_from_string("{a:[1 2 3] b:4}"),
+            tree_from_string("{a:[1 3 5] c:6}")
+        );
+        Tree t = item_to_tree(&orig);
+        TreePatch back;
+        item_from_tree(&back, t);
+        is(item_to_tree(&back), t, "TreePatch round-trips through a tree");
+    }
+
+     // Invalid patches
+    Tree t = tree_from_string("{a:[1 2 3]}");
+    auto bad = [&](Str patch_s, Str name){
+        TreePatch patch;
+        item_from_tree(&patch, tree_from_string(patch_s));
+        throws_code<e_TreePatchInvalid>([&]{ tree_patch(t, patch); }, name);
+    };
+    bad("[[remove [b]]]", "Removing missing key");
+    bad("[[insert [a] 1]]", "Inserting existing key");
+    bad("[[replace [a 3] 1]]", "Index out of range");
+    bad("[[replace [a x] 1]]", "String index into array");
+    bad("[[replace [a 0 0] 1]]", "Editing inside a number");
+    bad("[[remove [a 0]] [replace [a 0] 1]]", "Conflicting edits");
+    bad("[[insert [] 1]]", "Insert with empty path");
+
+    done_testing();
+});
+#endif
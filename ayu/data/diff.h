@@ -0,0 +1,56 @@
+// This module computes the differences between two trees as a patch, which can
+// be applied to the first tree to get the second.  Patches only mention the
+// parts of the tree that changed, so they can be used for incremental saving or
+// for propagating changes without re-sending the whole tree.
+
+#pragma once
+
+#include "../common.h"
+#include "tree.h"
+
+namespace ayu {
+
+enum class TreeEditOp : u8 {
+     // Replace the tree at path with value.  An empty path replaces the whole
+     // tree.
+    Replace,
+     // Insert value into the array or object that contains path.  For arrays,
+     // the last element of path is the index in the original array to insert
+     // before (or the array's size to append).  For objects, it's the new key.
+    Insert,
+     // Remove the array element or object attribute at path.
+    Remove,
+};
+
+ // One change in a patch.  path is a list of array indexes (numbers) and
+ // object keys (strings), leading from the root of the tree to the item being
+ // changed.  value is undefined for Remove.
+struct TreeEdit {
+    TreeEditOp op;
+    UniqueArray<Tree> path;
+    Tree value;
+};
+
+using TreePatch = UniqueArray<TreeEdit>;
+
+ // Returns a patch that turns a into b.  Subtrees that are shared between a and
+ // b (that refer to the same buffer) are skipped without looking inside them,
+ // so diffing a tree against a modified copy of itself only costs as much as
+ // the path to the modifications.  Arrays are compared with Myers' algorithm,
+ // so inserting or removing elements produces Insert or Remove edits instead
+ // of replacing every following element.  Like operator==, this ignores flags.
+TreePatch tree_diff (const Tree& a, const Tree& b);
+
+ // Applies a patch to a tree, returning the new tree.  Subtrees that the patch
+ // doesn't touch are shared with the original tree.  Array indexes in the patch
+ // always refer to positions in the original array (not to positions after
+ // earlier edits), so the edits to one array can be in any order, except that
+ // multiple Inserts at the same index are inserted in the order they appear.
+ // Throws e_TreePatchInvalid if the patch doesn't fit the tree.
+Tree tree_patch (const Tree&, Slice<TreeEdit>);
+
+ // Tried to apply a patch that refers to items that don't exist, or that has
+ // conflicting edits to the same item.
+constexpr ErrorCode e_TreePatchInvalid = "ayu::e_TreePatchInvalid";
+
+} // namespace ayu
@@ -0,0 +1,913 @@
+#include "parse-stream.h"
+
+#include "../../uni/io.h"
+#include "parse.private.h"
+
+namespace ayu {
+namespace in {
+
+ // The lexer finds where tokens start and end, and hands complete tokens to
+ // Parser to be interpreted, so numbers, escapes, and error messages all work
+ // exactly the same as in the non-streaming parser.  The grammar is handled
+ // here with an explicit stack instead of recursion.
+
+enum class Lex : u8 {
+    Start,        // Checking for a BOM
+    Between,      // Whitespace between tokens
+    Dash,         // A - at the end of a chunk, could be a comment or a word
+    Comment,
+    Word,
+    WordColon,    // A word followed by a : at the end of a chunk
+    String,
+    StringEscape, // A string followed by a \ at the end of a chunk
+};
+
+enum class FrameKind : u8 {
+    Top,
+    Array,
+    Object,
+    DeclName,   // After &, waiting for the name
+    RefName,    // After *, waiting for the name
+    Decl,       // After &name, waiting for : or a value
+    DeclAlso,   // &name value, in the value
+    DeclOnly,   // &name: value, in or after the value
+};
+
+ // States for Top, Array, and DeclOnly
+constexpr u8 ExpectValue = 0;
+constexpr u8 AfterValue = 1;
+constexpr u8 AfterComma = 2;
+constexpr u8 TopDone = 3;
+ // States for Object
+constexpr u8 ExpectKey = 0;
+constexpr u8 ExpectColon = 1;
+constexpr u8 ExpectAttrValue = 2;
+constexpr u8 AfterAttrValue = 3;
+
+struct StreamFrame {
+    FrameKind kind;
+    u8 state;
+    SourcePos pos;
+     // For Decl frames
+    UniqueString name;
+};
+
+struct StreamParserData {
+    ParseHandler& handler;
+    AnyString filename;
+    bool list;
+
+    Lex lex = Lex::Start;
+     // The beginning of the current token if it started in this chunk
+    const char* tok_start;
+     // The beginning of the current token if it didn't
+    UniqueString token;
+    SourcePos token_pos;
+    SourcePos colon_pos;
+     // Set after & and *, which must be followed immediately by a name.
+    bool name_next = false;
+    u8 bom_matched = 0;
+
+     // Position tracking.  Lines are counted lazily, up to the position of
+     // each token as it starts.
+    const char* chunk_begin = null;
+    const char* counted = null;
+    u64 chunk_offset = 0;
+    i64 last_lf = -1;
+    u32 line = 1;
+
+    UniqueArray<StreamFrame> stack;
+    u32 depth = 0;
+    UniqueArray<UniqueString> shortcut_names;
+
+    StreamParserData (ParseHandler& h, AnyString f, bool l) :
+        handler(h), filename(move(f)), list(l)
+    {
+        stack.emplace_back(
+            FrameKind::Top, ExpectValue, SourcePos{1, 1}, UniqueString()
+        );
+    }
+
+///// POSITIONS AND ERRORS
+
+    SourcePos pos_at (const char* p) {
+        expect(p >= counted);
+        while (auto lf = (const char*)std::memchr(counted, '\n', p - counted)) {
+            line++;
+            last_lf = chunk_offset + (lf - chunk_begin);
+            counted = lf + 1;
+        }
+        counted = p;
+        return {line, u32(i64(chunk_offset + (p - chunk_begin)) - last_lf)};
+    }
+
+     // The position just after a token.
+    static SourcePos end_pos (Str text, SourcePos start) {
+        SourcePos r = start;
+        for (char c : text) {
+            if (c == '\n') { r.line++; r.col = 1; }
+            else r.col++;
+        }
+        return r;
+    }
+
+    [[noreturn, gnu::cold]] NOINLINE
+    void error (SourcePos pos, Str mess) {
+        raise(e_ParseFailed, cat(
+            mess, " at ", filename, ':', pos.line, ':', pos.col
+        ));
+    }
+
+     // Let Parser generate the error for a character that can't start a term.
+    [[noreturn, gnu::cold]] NOINLINE
+    void error_bad_char (const char* p) {
+        Parser parser (Str(p, 1), filename);
+        parser.base = pos_at(p);
+        Tree r;
+        parser.parse_term(p, r);
+        never();
+    }
+
+///// TOKENS
+
+    Str token_text (const char* end) {
+        if (token) {
+            token.append(Str(tok_start, end));
+            return token;
+        }
+        else return Str(tok_start, end);
+    }
+
+    void save_partial_token (const char* end) {
+        token.append(Str(tok_start, end));
+    }
+
+    Tree interpret (Str text, SourcePos pos) {
+         // The Tree doesn't outlive the token, so it may as well borrow.
+        Parser parser (text, filename, true);
+        parser.base = pos;
+        Tree r;
+        const char* end = parser.parse_term(parser.begin, r);
+        expect(end == parser.end);
+        return r;
+    }
+
+    void feed (Str chunk) {
+        const char* p = chunk.begin();
+        const char* end = chunk.end();
+        chunk_begin = counted = tok_start = p;
+        while (p < end) switch (lex) {
+            case Lex::Start: {
+                static constexpr Str bom = "\xef\xbb\xbf";
+                while (p < end && bom_matched < 3) {
+                    if (*p != bom[bom_matched]) {
+                         // Any prefix of a BOM is not valid input.
+                        if (bom_matched) {
+                            error({1, 1}, "Unrecognized byte <EF>");
+                        }
+                        break;
+                    }
+                    bom_matched++; p++;
+                }
+                if (bom_matched && bom_matched < 3) break;
+                lex = Lex::Between;
+                break;
+            }
+            case Lex::Between: p = between(p, end); break;
+            case Lex::Dash: {
+                if (*p == '-') {
+                    token.clear();
+                    lex = Lex::Comment;
+                    p++;
+                }
+                else lex = Lex::Word;
+                break;
+            }
+            case Lex::Comment: {
+                auto lf = (const char*)std::memchr(p, '\n', end - p);
+                if (lf) {
+                    p = lf + 1;
+                    lex = Lex::Between;
+                }
+                else p = end;
+                break;
+            }
+            case Lex::Word: {
+                for (;;) {
+                    p = scan_word(p, end);
+                    if (p == end) {
+                        save_partial_token(p);
+                    }
+                    else if (*p == ':') {
+                        if (p + 1 == end) {
+                            colon_pos = pos_at(p);
+                            save_partial_token(p + 1);
+                            p = end;
+                            lex = Lex::WordColon;
+                        }
+                         // Allow :: for c++ types
+                        else if (p[1] == ':') {
+                            p += 2;
+                            continue;
+                        }
+                        else end_word(p);
+                    }
+                    else if (*p == '"') {
+                         // Let Parser generate the error
+                        interpret(token_text(p + 1), token_pos);
+                        never();
+                    }
+                    else end_word(p);
+                    break;
+                }
+                break;
+            }
+            case Lex::WordColon: {
+                if (*p == ':') {
+                    token.push_back(':');
+                    lex = Lex::Word;
+                    p++;
+                    tok_start = p;
+                }
+                else end_word_colon();
+                break;
+            }
+            case Lex::StringEscape: {
+                 // Skip the escaped character
+                p++;
+                lex = Lex::String;
+                [[fallthrough]];
+            }
+            case Lex::String: {
+                for (;;) {
+                    p = scan_quoted(p, end);
+                    if (p == end) {
+                        save_partial_token(p);
+                    }
+                    else if (*p == '"') {
+                        p++;
+                        Str text = token_text(p);
+                        got_scalar(text, token_pos);
+                        token.clear();
+                        lex = Lex::Between;
+                    }
+                    else if (p + 1 == end) {
+                        p = end;
+                        save_partial_token(p);
+                        lex = Lex::StringEscape;
+                    }
+                    else {
+                        p += 2;
+                        continue;
+                    }
+                    break;
+                }
+                break;
+            }
+            default: never();
+        }
+         // Count the rest of the lines before moving to the next chunk.
+        pos_at(end);
+        chunk_offset += chunk.size();
+    }
+
+    const char* between (const char* p, const char* end) {
+        if (name_next) {
+             // No whitespace allowed after & or *
+            auto props = char_props[u8(*p)];
+            if (*p == '"') {
+                return start_token(p, end, Lex::String);
+            }
+            else if (props & CHAR_CONTINUES_WORD &&
+                (props & CHAR_TERM_MASK) >= CHAR_TERM_WORD &&
+                (props & CHAR_TERM_MASK) <= CHAR_TERM_MINUS
+            ) {
+                return start_token(p, end, Lex::Word);
+            }
+            else if (*p == '[' || *p == '{') {
+                error(pos_at(p), "Can't use non-string as shortcut name");
+            }
+            else error_bad_char(p);
+        }
+        p = scan_ws(p, end);
+        if (p == end) return p;
+        switch (char_props[u8(*p)] & CHAR_TERM_MASK) {
+            case CHAR_TERM_MINUS: {
+                if (p + 1 == end) {
+                     // Can't tell yet whether this is a comment.
+                    return start_token(p, end, Lex::Dash);
+                }
+                else if (p[1] == '-') {
+                    lex = Lex::Comment;
+                    return p + 2;
+                }
+                [[fallthrough]];
+            }
+            case CHAR_TERM_WORD: case CHAR_TERM_DIGIT:
+            case CHAR_TERM_DOT: case CHAR_TERM_PLUS: {
+                return start_token(p, end, Lex::Word);
+            }
+            case CHAR_TERM_STRING: {
+                return start_token(p, end, Lex::String);
+            }
+            case CHAR_TERM_ARRAY: got_open(FrameKind::Array, pos_at(p)); break;
+            case CHAR_TERM_OBJECT: got_open(FrameKind::Object, pos_at(p)); break;
+            case CHAR_TERM_DECL: got_name_prefix(FrameKind::DeclName, p); break;
+            case CHAR_TERM_SHORTCUT: got_name_prefix(FrameKind::RefName, p); break;
+            default: {
+                switch (*p) {
+                    case ']': got_close(FrameKind::Array, p); break;
+                    case '}': got_close(FrameKind::Object, p); break;
+                    case ',': got_comma(p); break;
+                    case ':': got_colon(p, pos_at(p)); break;
+                    default: error_bad_char(p);
+                }
+            }
+        }
+        return p + 1;
+    }
+
+     // Returns where to continue lexing from.  If that's the end of the
+     // chunk, the token will have been saved.
+    const char* start_token (const char* p, const char* end, Lex l) {
+        lex = l;
+        tok_start = p;
+        token_pos = pos_at(p);
+         // Word scanning starts at the first character, but the others have
+         // to skip it.
+        if (l == Lex::Word) return p;
+        if (p + 1 == end) save_partial_token(end);
+        return p + 1;
+    }
+
+    void end_word (const char* p) {
+        Str text = token_text(p);
+        got_scalar(text, token_pos);
+        token.clear();
+        lex = Lex::Between;
+    }
+
+     // The word in token has a : at the end which isn't part of it.
+    void end_word_colon () {
+        expect(token && token.back() == ':');
+        token.pop_back();
+        got_scalar(token, token_pos);
+        token.clear();
+        lex = Lex::Between;
+         // There's no pointer to the colon, since it was in the last chunk.
+        got_colon(null, colon_pos);
+    }
+
+///// GRAMMAR
+
+    StreamFrame& top () { return stack.back(); }
+
+     // Called before a token that can start a value.  Returns true if the
+     // token is actually an object key.
+    bool start_value (SourcePos pos) {
+        for (;;) {
+            auto& f = top();
+            switch (f.kind) {
+                case FrameKind::Top: {
+                    if (f.state == TopDone) {
+                        error(pos, "Extra stuff at end of document");
+                    }
+                    return false;
+                }
+                case FrameKind::Array: return false;
+                case FrameKind::Object: {
+                    if (f.state == ExpectColon) {
+                        error(pos, "Missing : after name in object");
+                    }
+                    return f.state != ExpectAttrValue;
+                }
+                case FrameKind::Decl: {
+                    handler.shortcut_declaration(f.name, true);
+                    f.kind = FrameKind::DeclAlso;
+                    return false;
+                }
+                case FrameKind::DeclOnly: {
+                    if (f.state == ExpectValue) return false;
+                     // The declaration is done, this is the actual value.
+                    stack.pop_back();
+                    continue;
+                }
+                default: never();
+            }
+        }
+    }
+
+    void value_done () {
+        for (;;) {
+            auto& f = top();
+            switch (f.kind) {
+                case FrameKind::Top: {
+                    f.state = list ? AfterValue : TopDone;
+                    return;
+                }
+                case FrameKind::Array: {
+                    f.state = AfterValue;
+                    return;
+                }
+                case FrameKind::Object: {
+                    expect(f.state == ExpectAttrValue);
+                    f.state = AfterAttrValue;
+                    return;
+                }
+                case FrameKind::DeclAlso: {
+                    shortcut_names.emplace_back(move(f.name));
+                    stack.pop_back();
+                    continue;
+                }
+                case FrameKind::DeclOnly: {
+                    expect(f.state == ExpectValue);
+                    shortcut_names.emplace_back(move(f.name));
+                    f.state = AfterValue;
+                    return;
+                }
+                default: never();
+            }
+        }
+    }
+
+    [[noreturn, gnu::cold]] NOINLINE
+    void error_shortcut_key (SourcePos pos) {
+        error(pos, "Can't use shortcut as key in object when stream parsing");
+    }
+
+    void got_scalar (Str text, SourcePos pos) {
+        auto& f = top();
+        if (f.kind == FrameKind::DeclName || f.kind == FrameKind::RefName) {
+            got_name(text, pos);
+            return;
+        }
+        bool is_key = start_value(pos);
+        Tree t = interpret(text, pos);
+        if (is_key) {
+            if (t.form != Form::String) {
+                error(end_pos(text, pos), "Can't use non-string as key in object");
+            }
+            handler.key(Str(t));
+            top().state = ExpectColon;
+            return;
+        }
+        switch (t.form) {
+            case Form::Null: handler.null_value(); break;
+            case Form::Bool: handler.bool_value(bool(t)); break;
+            case Form::Number: {
+                if (t.floaty) handler.floating_value(t.data.as_double, t.flags);
+                else handler.integer_value(t.data.as_i64, t.flags);
+                break;
+            }
+            case Form::String: handler.string_value(Str(t)); break;
+            default: never();
+        }
+        value_done();
+    }
+
+    void got_name (Str text, SourcePos pos) {
+        name_next = false;
+        Tree t = interpret(text, pos);
+        if (t.form != Form::String) {
+            error(pos, "Can't use non-string as shortcut name");
+        }
+        auto name = Str(t);
+        bool declared = false;
+        for (auto& n : shortcut_names) {
+            if (n == name) { declared = true; break; }
+        }
+        auto& f = top();
+        if (f.kind == FrameKind::DeclName) {
+            if (declared) {
+                error(end_pos(text, pos), cat(
+                    "Multiple declarations of shortcut &", name
+                ));
+            }
+            f.kind = FrameKind::Decl;
+            f.name = name;
+        }
+        else {
+            if (!declared) {
+                error(end_pos(text, pos), cat("Unknown shortcut *", name));
+            }
+            stack.pop_back();
+            handler.shortcut_reference(name);
+            value_done();
+        }
+    }
+
+    void got_name_prefix (FrameKind kind, const char* p) {
+        auto pos = pos_at(p);
+        if (start_value(pos)) error_shortcut_key(pos);
+        stack.emplace_back(kind, 0, pos, UniqueString());
+        name_next = true;
+    }
+
+    void got_open (FrameKind kind, SourcePos pos) {
+        if (start_value(pos)) {
+            error(pos, "Can't use non-string as key in object");
+        }
+        if (++depth > Parser::max_depth) {
+            error(pos, "Exceeded limit of 200 nested arrays/objects");
+        }
+        if (kind == FrameKind::Array) handler.begin_array();
+        else handler.begin_object();
+        stack.emplace_back(kind, 0, pos, UniqueString());
+    }
+
+    void got_close (FrameKind kind, const char* p) {
+        auto& f = top();
+        char open = f.kind == FrameKind::Array ? '[' : '{';
+        char close = kind == FrameKind::Array ? ']' : '}';
+        if (f.kind == FrameKind::Array) {
+            if (kind != f.kind) {
+                error(pos_at(p), cat(
+                    "Mismatch between ", open, " at ", f.pos.line, ':',
+                    f.pos.col, " and ", close
+                ));
+            }
+            handler.end_array();
+        }
+        else if (f.kind == FrameKind::Object) {
+            if (f.state == ExpectColon) {
+                error(pos_at(p), "Missing : after name in object");
+            }
+            else if (f.state == ExpectAttrValue) error_bad_char(p);
+            else if (kind != f.kind) {
+                error(pos_at(p), cat(
+                    "Mismatch between ", open, " at ", f.pos.line, ':',
+                    f.pos.col, " and ", close
+                ));
+            }
+            handler.end_object();
+        }
+        else if (f.kind == FrameKind::Top && f.state == TopDone) {
+            error(pos_at(p), "Extra stuff at end of document");
+        }
+        else error_bad_char(p);
+        stack.pop_back();
+        --depth;
+        value_done();
+    }
+
+    void got_comma (const char* p) {
+        auto& f = top();
+        switch (f.kind) {
+            case FrameKind::Top: {
+                if (f.state == TopDone) {
+                    error(pos_at(p), "Extra stuff at end of document");
+                }
+                [[fallthrough]];
+            }
+            case FrameKind::Array: case FrameKind::DeclOnly: {
+                if (f.state == AfterValue) {
+                    f.state = AfterComma;
+                    return;
+                }
+                break;
+            }
+            case FrameKind::Object: {
+                if (f.state == AfterAttrValue) {
+                    f.state = ExpectKey;
+                    return;
+                }
+                else if (f.state == ExpectColon) {
+                    error(pos_at(p), "Missing : after name in object");
+                }
+                break;
+            }
+            default: break;
+        }
+        error_bad_char(p);
+    }
+
+     // p is null if the colon was at the end of the previous chunk.
+    void got_colon (const char* p, SourcePos pos) {
+        auto& f = top();
+        if (f.kind == FrameKind::Object && f.state == ExpectColon) {
+            f.state = ExpectAttrValue;
+        }
+        else if (f.kind == FrameKind::Decl) {
+            handler.shortcut_declaration(f.name, false);
+            f.kind = FrameKind::DeclOnly;
+            f.state = ExpectValue;
+        }
+        else if (f.kind == FrameKind::Top && f.state == TopDone) {
+            error(pos, "Extra stuff at end of document");
+        }
+        else if (p) error_bad_char(p);
+        else error(pos, "Expected term but got :");
+    }
+
+    void finish () {
+         // feed() has already counted everything.
+        SourcePos end_pos = {line, u32(i64(chunk_offset) - last_lf)};
+        switch (lex) {
+            case Lex::Start: {
+                if (bom_matched) error({1, 1}, "Unrecognized byte <EF>");
+                break;
+            }
+            case Lex::Between: case Lex::Comment: break;
+            case Lex::Dash: case Lex::Word: {
+                got_scalar(token, token_pos);
+                token.clear();
+                break;
+            }
+            case Lex::WordColon: end_word_colon(); break;
+            case Lex::String: case Lex::StringEscape: {
+                 // Let Parser generate the error
+                interpret(token, token_pos);
+                never();
+            }
+            default: never();
+        }
+        auto& f = top();
+        switch (f.kind) {
+            case FrameKind::Top: {
+                if (!list && f.state == ExpectValue) {
+                    error(end_pos, "Expected term but ran into end of input");
+                }
+                return;
+            }
+            case FrameKind::Array: {
+                error(end_pos, "Missing ] before end of input");
+            }
+            case FrameKind::Object: {
+                error(end_pos, "Missing } before end of input");
+            }
+            default: {
+                error(end_pos, "Expected term but ran into end of input");
+            }
+        }
+    }
+};
+
+} using namespace in;
+
+StreamParser::StreamParser (
+    ParseHandler& handler, AnyString filename, bool list
+) : data(new StreamParserData(handler, move(filename), list)) { }
+
+StreamParser::~StreamParser () { delete data; }
+
+void StreamParser::feed (Str chunk) {
+    data->feed(chunk);
+}
+
+void StreamParser::finish () {
+    data->finish();
+}
+
+void parse_file_stream (
+    AnyString filename, ParseHandler& handler, bool list
+) {
+    static constexpr usize chunk_size = 64 * 1024;
+    File file (filename);
+    StreamParser parser (handler, filename, list);
+    auto buf = UniqueString(Uninitialized(chunk_size));
+    while (usize n = file.read_some(buf.data(), chunk_size, filename)) {
+        parser.feed(Str(buf.data(), n));
+    }
+    parser.finish();
+}
+
+namespace in {
+
+ // Builds Trees from events and passes top-level ones to a callback.
+struct TreeListBuilder : ParseHandler {
+    CallbackRef<void(Tree&&)> cb;
+    struct Partial {
+        FrameKind kind;
+        bool also_value = false;
+         // The next key for objects, or the shortcut name for declarations
+        AnyString name {};
+        UniqueArray<Tree> elems {};
+        UniqueArray<TreePair> attrs {};
+    };
+    UniqueArray<Partial> stack;
+    UniqueArray<TreePair> shortcuts;
+
+    TreeListBuilder (CallbackRef<void(Tree&&)> cb) : cb(cb) { }
+
+    void value (Tree&& t) {
+        while (stack) {
+            auto& p = stack.back();
+            if (p.kind == FrameKind::Array) {
+                p.elems.push_back(move(t));
+                return;
+            }
+            else if (p.kind == FrameKind::Object) {
+                p.attrs.emplace_back(move(p.name), move(t));
+                return;
+            }
+            else {
+                bool also = p.also_value;
+                shortcuts.emplace_back(move(p.name), t);
+                stack.pop_back();
+                if (!also) return;
+            }
+        }
+        cb(move(t));
+    }
+
+    void null_value () override { value(Tree(null)); }
+    void bool_value (bool v) override { value(Tree(v)); }
+    void integer_value (i64 v, TreeFlags f) override { value(Tree(v, f)); }
+    void floating_value (double v, TreeFlags f) override { value(Tree(v, f)); }
+    void string_value (Str v) override { value(Tree(v)); }
+    void begin_array () override {
+        stack.emplace_back(FrameKind::Array);
+    }
+    void end_array () override {
+        auto elems = move(stack.back().elems);
+        stack.pop_back();
+        value(Tree(move(elems)));
+    }
+    void begin_object () override {
+        stack.emplace_back(FrameKind::Object);
+    }
+    void key (Str k) override { stack.back().name = k; }
+    void end_object () override {
+        auto attrs = move(stack.back().attrs);
+        stack.pop_back();
+        value(Tree(move(attrs)));
+    }
+    void shortcut_declaration (Str name, bool is_also_value) override {
+        stack.emplace_back(FrameKind::Decl, is_also_value, name);
+    }
+    void shortcut_reference (Str name) override {
+        for (auto& sc : shortcuts) {
+            if (sc.first == name) {
+                value(Tree(sc.second));
+                return;
+            }
+        }
+        never();
+    }
+};
+
+} // in
+
+void tree_list_from_file (AnyString filename, CallbackRef<void(Tree&&)> cb) {
+    TreeListBuilder builder (cb);
+    parse_file_stream(move(filename), builder, true);
+}
+
+} using namespace ayu;
+
+#ifndef TAP_DISABLE_TESTS
+#include "../../tap/tap.h"
+#include "../resources/resource.h"
+#include "../test/test-environment.private.h"
+
+namespace {
+
+struct EventRecorder : ParseHandler {
+    UniqueString log;
+    void add (Str s) {
+        if (log) log.push_back(' ');
+        log.append(s);
+    }
+    void null_value () override { add("null"); }
+    void bool_value (bool v) override { add(v ? "true" : "false"); }
+    void integer_value (i64 v, TreeFlags f) override {
+        add(cat("int:", v, f % TreeFlags::PreferHex ? "h" : ""));
+    }
+    void floating_value (double v, TreeFlags) override {
+        add(cat("float:", v));
+    }
+    void string_value (Str v) override { add(cat("str:", v)); }
+    void begin_array () override { add("["); }
+    void end_array () override { add("]"); }
+    void begin_object () override { add("{"); }
+    void key (Str k) override { add(cat("key:", k)); }
+    void end_object () override { add("}"); }
+    void shortcut_declaration (Str name, bool also) override {
+        add(cat(also ? "&" : "&:", name));
+    }
+    void shortcut_reference (Str name) override { add(cat("*", name)); }
+};
+
+ // Feeds the document in chunks of the given size and collects the items.
+UniqueArray<Tree> stream_list (Str doc, usize chunk_size) {
+    UniqueArray<Tree> r;
+    auto cb = [&r](Tree&& t){ r.push_back(move(t)); };
+    TreeListBuilder builder (cb);
+    StreamParser parser (builder, "test", true);
+    for (usize i = 0; i < doc.size(); i += chunk_size) {
+        parser.feed(doc.slice(i, std::min(doc.size(), i + chunk_size)));
+    }
+    parser.finish();
+    return r;
+}
+
+UniqueString stream_error (Str doc, usize chunk_size, bool list) {
+    try {
+        ParseHandler handler;
+        StreamParser parser (handler, "test", list);
+        for (usize i = 0; i < doc.size(); i += chunk_size) {
+            parser.feed(doc.slice(i, std::min(doc.size(), i + chunk_size)));
+        }
+        parser.finish();
+    }
+    catch (Error& e) { return cat(e.code, ": ", e.details); }
+    return "no error";
+}
+
+UniqueString string_error (Str doc, bool list) {
+    try {
+        if (list) tree_list_from_string(doc, "test");
+        else tree_from_string(doc, "test");
+    }
+    catch (Error& e) { return cat(e.code, ": ", e.details); }
+    return "no error";
+}
+
+} // namespace
+
+static tap::TestSet tests ("dirt/ayu/data/parse-stream", []{
+    using namespace tap;
+    test::TestEnvironment env;
+
+    StaticString doc =
+        "\xef\xbb\xbf-- A comment\n"
+        "{a:1 \"b c\":[2.5 -0x10 +inf] d::e:f::g \"\\x41\\u0042\\n\" : null}\n"
+        "&s:{x:true y:false} *s, &t [\"str with \\\"escapes\\\"\" -0] --\n"
+        "*t,\n"
+        "\"\" lots-of-words-here/and?more#stuff 0.000123 -- trailing";
+    auto expected = tree_list_from_string(doc, "test");
+    bool all_same = true;
+    for (usize chunk_size = 1; chunk_size <= doc.size(); chunk_size++) {
+        auto got = stream_list(doc, chunk_size);
+        if (got != expected) {
+            all_same = false;
+            diag(cat("Different result with chunk size ", chunk_size));
+        }
+    }
+    ok(all_same, "Stream parsing with every chunk size matches tree_list_from_string");
+
+    EventRecorder rec;
+    StreamParser parser (rec, "test");
+    parser.feed("{a:[1 0x2 3.5] \"b\":&x \"y\"} ");
+    is(rec.log,
+        "{ key:a [ int:1 int:2h float:3.5 ] key:b &x str:y }",
+        "Events are emitted as soon as they're complete"
+    );
+    parser.finish();
+
+    EventRecorder rec2;
+    StreamParser parser2 (rec2, "test", true);
+    parser2.feed("&a:1 *a, &b 2 *b *");
+    is(rec2.log, "&:a int:1 *a &b int:2 *b",
+        "Shortcut declarations and references"
+    );
+    throws_code<e_ParseFailed>([&]{
+        parser2.feed("c");
+        parser2.finish();
+    }, "Unknown shortcut");
+
+    for (StaticString bad : std::initializer_list<StaticString>{
+        "", "[", "{", "[}", "{]", "{a}", "{a:}", "{a:1,,}", "{0:1}", "[,]",
+        "[1 2", "\"abc", "\"ab\\q\"", "4.", ".4", "++0", "1 2", "1,", "a\"b",
+        "&a:1", "&a:1 *b", "*a", "& a", "&a &a 1", "[1 2]]", "\x01", "(",
+        "{a\n:\n1\nb c}", "[\n\n  [\n]\n}", "\"\\x4\"", "\xef\xbb",
+        "\"a\nb\\u00\""
+    }) {
+        auto want = string_error(bad, false);
+        bool same = true;
+        for (usize chunk_size = 1; chunk_size <= bad.size() + 1; chunk_size++) {
+            auto got = stream_error(bad, chunk_size, false);
+            if (got != want) {
+                diag(cat("Chunk size ", chunk_size, ": ", got));
+                same = false;
+            }
+        }
+        ok(same, cat("Same error as tree_from_string: ", want));
+    }
+    is(stream_error("a,,b", 1, true), string_error("a,,b", true),
+        "Same error for double comma in list"
+    );
+    is(stream_error("{*a:1}", 100, false),
+        "ayu::e_ParseFailed: Can't use shortcut as key in object when stream parsing at test:1:2",
+        "Shortcuts as keys are rejected"
+    );
+
+    auto list_file = resource_filename(IRI("ayu-test:/parse-stream.ayu"));
+    UniqueString big;
+    for (u32 i = 0; i < 20000; i++) {
+        big = cat(move(big), "{id:", i, " name:\"item ", i, "\" tags:[a b c]}\n");
+    }
+    string_to_file(big, list_file);
+    u32 count = 0;
+    bool items_ok = true;
+    tree_list_from_file(list_file, [&](Tree&& t){
+        if (t["id"] != Tree(count)) items_ok = false;
+        count++;
+    });
+    is(count, 20000u, "tree_list_from_file with callback gets every item");
+    ok(items_ok, "tree_list_from_file with callback gets items in order");
+    remove_utf8(list_file.c_str());
+
+    done_testing();
+});
+#endif
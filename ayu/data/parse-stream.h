@@ -0,0 +1,76 @@
+// An incremental push parser.  Instead of taking a whole document and
+// returning a Tree, it takes input in chunks as they become available, and
+// reports what it finds to a ParseHandler as it goes.  Besides the token it's
+// in the middle of, it only keeps one frame per level of nesting and the names
+// of declared shortcuts, so its memory use doesn't grow with the document.
+//
+// This accepts the same language and produces the same errors as
+// tree_from_string, except that shortcuts can't be used as object keys.
+
+#pragma once
+
+#include "../common.h"
+#include "tree.h"
+
+namespace ayu {
+namespace in { struct StreamParserData; }
+
+ // Override the events you're interested in.  The Strs passed to these are
+ // only valid for the duration of the call.
+struct ParseHandler {
+    virtual void null_value () { }
+    virtual void bool_value (bool) { }
+     // Numbers are given the same way they'd be stored in a Tree.  The only
+     // flag that will be set is TreeFlags::PreferHex.
+    virtual void integer_value (i64, TreeFlags) { }
+    virtual void floating_value (double, TreeFlags) { }
+    virtual void string_value (Str) { }
+    virtual void begin_array () { }
+    virtual void end_array () { }
+    virtual void begin_object () { }
+     // Called before each attribute's value.
+    virtual void key (Str) { }
+    virtual void end_object () { }
+     // Followed by the events for the shortcut's value.  For &name value,
+     // is_also_value is true, and the value also goes where the declaration
+     // was.  For &name: value, it's false, and the value is only declared.
+    virtual void shortcut_declaration (
+        Str /*name*/, bool /*is_also_value*/
+    ) { }
+     // Stands for the value the shortcut was declared with.  The parser checks
+     // that the shortcut was declared, but it doesn't keep the value around, so
+     // it's up to you to remember it if you need it.
+    virtual void shortcut_reference (Str /*name*/) { }
+
+    virtual ~ParseHandler () { }
+};
+
+struct StreamParser {
+     // If list is true, accepts multiple items separated by commas or
+     // whitespace, like tree_list_from_string.  Otherwise accepts exactly one
+     // item like tree_from_string.  The filename is used for error reporting.
+    explicit StreamParser (
+        ParseHandler& handler, AnyString filename = "", bool list = false
+    );
+    StreamParser (const StreamParser&) = delete;
+    StreamParser& operator= (const StreamParser&) = delete;
+    ~StreamParser ();
+
+     // Process a chunk of input, calling the handler for everything that's
+     // complete.  Chunks can be split anywhere, even in the middle of a token
+     // or a UTF-8 sequence.  Throws e_ParseFailed, after which this parser
+     // can't be used anymore.
+    void feed (Str chunk);
+     // Call after the last chunk.  Throws e_ParseFailed if the document isn't
+     // complete.
+    void finish ();
+
+    in::StreamParserData* data;
+};
+
+ // Reads a file a chunk at a time and feeds it to a StreamParser.
+void parse_file_stream (
+    AnyString filename, ParseHandler& handler, bool list = false
+);
+
+} // namespace ayu
@@ -1,654 +1,258 @@
 #include "parse.h"
 
-#include <array>
-#include <cstring>
-#include <charconv>
-#include <limits>
-
+#include <thread>
 #include "../../uni/io.h"
-#include "../../uni/text.h"
-#include "../../uni/utf.h"
-#include "../data/tree.h"
-#include "char-cases.private.h"
+#include "../../uni/lilac.h"
+#include "parse.private.h"
 
 namespace ayu {
+using namespace in;
 
-namespace in {
-
-enum CharProps : u8 {
-    CHAR_IS_WS = 0x80,
-    CHAR_CONTINUES_WORD = 0x40,
-    CHAR_TERM_MASK = 0x0f,
-    CHAR_TERM_ERROR = 0,
-    CHAR_TERM_WORD = 1,
-    CHAR_TERM_DIGIT = 2,
-    CHAR_TERM_DOT = 3,
-    CHAR_TERM_PLUS = 4,
-    CHAR_TERM_MINUS = 5,
-    CHAR_TERM_STRING = 6,
-    CHAR_TERM_ARRAY = 7,
-    CHAR_TERM_OBJECT = 8,
-    CHAR_TERM_DECL = 9,
-    CHAR_TERM_SHORTCUT = 10,
-};
-constexpr std::array<u8, 256> char_props = []{
-    std::array<u8, 256> r = {};
-    for (char c : {' ', '\f', '\n', '\r', '\t', '\v'}) {
-        r[c] = CHAR_IS_WS;
-    }
-    for (char c = '0'; c <= '9'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_DIGIT;
-    for (char c = 'a'; c <= 'z'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_WORD;
-    for (char c = 'A'; c <= 'Z'; c++) r[c] = CHAR_CONTINUES_WORD | CHAR_TERM_WORD;
-    for (char c : {
-        '!', '$', '%', '+', '-', '.', '/', '<', '>',
-        '?', '@', '^', '_', '~', '#', '&', '*', '='
-    }) r[c] = CHAR_CONTINUES_WORD;
-    for (char c : {'_', '/', '?', '#'}) r[c] |= CHAR_TERM_WORD;
-    r['.'] |= CHAR_TERM_DOT;
-    r['+'] |= CHAR_TERM_PLUS;
-    r['-'] |= CHAR_TERM_MINUS;
-    r['"'] |= CHAR_TERM_STRING;
-    r['['] |= CHAR_TERM_ARRAY;
-    r['{'] |= CHAR_TERM_OBJECT;
-    r['&'] |= CHAR_TERM_DECL;
-    r['*'] |= CHAR_TERM_SHORTCUT;
-    return r;
-}();
-
-struct SourcePos {
-    u32 line;
-    u32 col;
-};
-
- // Parsing is simple enough that we don't need a separate lexer step.
-struct Parser {
-
-     // Limit how many nested arrays and objects we have.  If you have that much
-     // data in a structured text format, you're going to have performance
-     // problems anyway, and you should offload some of it to binary or flat
-     // text formats.
-    static constexpr u32 max_depth = 200;
-
-///// TOP
-
-    const char* end;
-    const char* begin;
-    Str filename;
-    u32 shallowth;
-
-    Parser (Str s, Str filename) :
-        end(s.end()),
-        begin(s.begin()),
-        filename(filename)
-    { }
-
-    Tree parse () {
-        shallowth = max_depth + 1;
-        const char* in = begin;
-         // Skip BOM
-        if (in + 2 < end && Str(in, 3) == "\xef\xbb\xbf") {
-            in += 3;
-        }
-        in = skip_ws(in);
-        Tree r;
-        in = parse_term(in, r);
-        in = skip_ws(in);
-        if (in != end) error(in, "Extra stuff at end of document");
-        expect(shallowth == max_depth + 1);
-        return r;
-    }
-
-    UniqueArray<Tree> parse_list () {
-        shallowth = max_depth;
-        const char* in = begin;
-        if (in + 2 < end && Str(in, 3) == "\xef\xbb\xbf") {
-            in += 3;
-        }
-        UniqueArray<Tree> r;
-        in = skip_ws(in);
-        while (in != end) {
-            Tree e;
-            in = parse_term(in, e);
-            r.push_back(move(e));
-            in = skip_comma(in);
-        }
-        expect(shallowth == max_depth);
-        return r;
-    }
+ // Finally:
+Tree tree_from_string (Str s, Str filename) {
+    require(s.size() <= AnyString::max_size_);
+    return Parser(s, filename).parse();
+}
 
-///// TERM
-
-    NOINLINE const char* parse_term (const char* in, Tree& r) {
-         // Table has to be inside member function to see functions declared
-         // below it.
-        static constexpr decltype(&got_word) table [] = {
-            &got_error,
-            &got_word,
-            &got_digit,
-            &got_dot,
-            &got_plus,
-            &got_minus,
-            &got_string,
-            &got_array,
-            &got_object,
-            &got_decl,
-            &got_shortcut
-        };
-        if (in >= end) error(in, "Expected term but ran into end of input");
-        auto index = char_props[*in] & CHAR_TERM_MASK;
-        expect(u32(index) <= sizeof(table) / sizeof(table[0]));
-        return table[u32(index)](*this, in, r);
-    }
+UniqueArray<Tree> tree_list_from_string (Str s, Str filename) {
+    require(s.size() <= AnyString::max_size_);
+    return Parser(s, filename).parse_list();
+}
 
-///// WORDS (unquoted)
+namespace in {
 
-    NOINLINE Str parse_word (const char* in) {
-        const char* start = in;
-        in++; // First character already known to be part of word
-        while (in < end) {
-            if (char_props[*in] & CHAR_CONTINUES_WORD) [[likely]] {
-                in++;
+ // Below this, starting threads probably costs more than it saves.
+static constexpr usize min_parallel_size = 64*1024;
+
+static bool find_splits (
+    Parser& p, const char* in, usize chunk_size,
+    UniqueArray<const char*>& splits
+) {
+     // This only tracks strings, comments, and brackets, so it's much faster
+     // than skipping items properly, but it can be wrong about malformed input.
+     // That's okay, because parse_list_parallel checks that each chunk ends
+     // exactly where the next one starts.
+    const char* next = in + chunk_size;
+    u32 depth = 0;
+    for (;;) {
+        const char* at = scan_structural(in, p.end);
+        if (at >= p.end) return true;
+         // Comments and shortcuts can only be at the start of a word
+        bool word_start = at == in ||
+            !(char_props[u8(at[-1])] & CHAR_CONTINUES_WORD);
+        in = at + 1;
+        switch (*at) {
+            case '"': {
+                in = p.skip_string(at);
+                if (!in) return true;
+                break;
             }
-            else if (*in == ':') {
-                 // Allow :: for c++ types
-                if (in + 1 < end && in[1] == ':') {
-                    in += 2;
+            case '-': {
+                if (word_start && in < p.end && *in == '-') {
+                    in = p.skip_comment(at);
                 }
-                else return Str(start, in);
+                break;
             }
-            else if (*in == '"') {
-                error(in, "\" cannot occur inside a word (are you missing the first \"?)");
+            case '&': case '*': {
+                if (word_start) return false;
+                break;
             }
-            else [[likely]] return Str(start, in);
-        }
-        return Str(start, in);
-    }
-
-    NOINLINE static
-    const char* got_word (Parser& self, const char* in, Tree& r) {
-        auto word = self.parse_word(in);
-        if (word == "null") new (&r) Tree(null);
-        else if (word == "true") new (&r) Tree(true);
-        else if (word == "false") new (&r) Tree(false);
-        else new (&r) Tree(word);
-        return word.end();
-    }
-
-///// NUMBERS
-
-    [[noreturn, gnu::cold]] NOINLINE
-    void error_invalid_number (Str word) {
-        if (word.end() < end) {
-            check_error_chars(word.end());
-        }
-        error(word.begin(), "Couldn't parse number");
-    }
-
-    template <bool hex>
-    const char* parse_floating (Str word, Tree& r, bool minus) {
-        double floating;
-        const char* word_end = word.end();
-        auto [num_end, ec] = std::from_chars(
-            word.begin(), word_end, floating,
-            hex ? std::chars_format::hex
-                : std::chars_format::general
-        );
-        if (num_end == word_end) {
-            TreeFlags f = hex ? TreeFlags::PreferHex : TreeFlags();
-            new (&r) Tree(minus ? -floating : floating, f);
-            return num_end;
-        }
-        else error_invalid_number(word);
-    }
-
-    template <bool hex>
-    const char* parse_number (Str word, Tree& r, bool minus) {
-         // Using an unsigned integer parser will reject words that start with a
-         // + or -.
-        u64 integer;
-        auto [num_end, ec] = std::from_chars(
-            word.begin(), word.end(), integer, hex ? 16 : 10
-        );
-        if (ec != std::errc()) error_invalid_number(word);
-        if (num_end == word.end()) {
-            TreeFlags f = hex ? TreeFlags::PreferHex : TreeFlags();
-            if (minus) {
-                if (integer == 0) new (&r) Tree(-0.0, f);
-                else new (&r) Tree(-integer, f);
-            }
-            else new (&r) Tree(integer, f);
-            return num_end;
-        }
-         // Forbid ending with a .
-        if (num_end[0] == '.') {
-            if (num_end + 1 >= word.end() ||
-                (num_end[1] & ~('a' & ~'A')) == (hex ? 'P' : 'E')
-            ) error(num_end, "Number cannot end with a dot.");
-        }
-        return parse_floating<hex>(word, r, minus);
-    }
-
-    NOINLINE const char* parse_number_based (Str word, Tree& r, bool minus) {
-         // Detect hex prefix
-        if (word.size() >= 2 && (word.chop(2) == "0x" || word.chop(2) == "0X")) {
-            return parse_number<true>(word.slice(2), r, minus);
-        }
-        else return parse_number<false>(word, r, minus);
-    }
-
-    NOINLINE static
-    const char* got_digit (Parser& self, const char* in, Tree& r) {
-        return self.parse_number_based(self.parse_word(in), r, false);
-    }
-
-    NOINLINE static
-    const char* got_dot (Parser& self, const char* in, Tree& r) {
-        auto word = self.parse_word(in);
-        if (word.size() > 1) switch (word[1]) {
-            case ANY_DECIMAL_DIGIT: case '+': case '-': {
-                self.error(in, "Number cannot start with a dot.");
-            }
-        }
-        new (&r) Tree(word);
-        return word.end();
-    }
-
-    NOINLINE static
-    const char* got_plus (Parser& self, const char* in, Tree& r) {
-        auto word = self.parse_word(in);
-        if (word == "+nan") {
-            new (&r) Tree(std::numeric_limits<double>::quiet_NaN());
-            return word.end();
-        }
-        else if (word == "+inf") {
-            new (&r) Tree(std::numeric_limits<double>::infinity());
-            return word.end();
-        }
-        return self.parse_number_based(word.slice(1), r, false);
-    }
-
-    NOINLINE static
-    const char* got_minus (Parser& self, const char* in, Tree& r) {
-         // Comments should already have been recognized by this point.
-        auto word = self.parse_word(in);
-        if (word == "-inf") {
-            new (&r) Tree(-std::numeric_limits<double>::infinity());
-            return word.end();
-        }
-        return self.parse_number_based(word.slice(1), r, true);
-    }
-
-///// STRINGS (quoted)
-
-    NOINLINE static
-    const char* got_string (Parser& self, const char* in, Tree& r) {
-        in++;  // for the "
-         // Find the end of the string and determine upper bound of required
-         // capacity.
-        u32 n_escapes = 0;
-        const char* p = in;
-        while (p < self.end) {
-            switch (*p) {
-                case '"': goto start;
-                case '\\':
-                    n_escapes++;
-                     // No buffer overrun, goes directly to p < end check.
-                    p += 2;
-                    break;
-                default: p++; break;
-            }
-        }
-        self.error(in, "Missing \" before end of input");
-        start:
-         // If there aren't any escapes we can just memcpy the whole string
-        if (!n_escapes) {
-            new (&r) Tree(UniqueString(in, p));
-            return p+1; // For the "
-        }
-         // Otherwise preallocate
-        auto out = UniqueString(Capacity(p - in - n_escapes));
-         // Now read the string
-        while (in < self.end) {
-            char c = *in++;
-            switch (c) {
-                case '"':
-                    new (&r) Tree(move(out));
-                    return in;
-                case '\\': {
-                    expect(in < self.end);
-                    switch (*in++) {
-                        case '"': c = '"'; break;
-                        case '\\': c = '\\'; break;
-                         // Dunno why this is in json
-                        case '/': c = '/'; break;
-                        case 'b': c = '\b'; break;
-                        case 'f': c = '\f'; break;
-                        case 'n': c = '\n'; break;
-                        case 'r': c = '\r'; break;
-                        case 't': c = '\t'; break;
-                        case 'x': in = self.got_x_escape(in, c); break;
-                        case 'u':
-                            in = self.got_u_escape(in, out);
-                            continue; // Skip the push_back
-                        default: in--; self.error(in, "Unknown escape sequence");
+            case '[': case '{': depth++; break;
+            case ']': case '}': {
+                if (depth && !--depth && in >= next) {
+                    in = p.skip_comma(in);
+                    if (in < p.end) {
+                        splits.push_back(in);
+                        next = in + chunk_size;
                     }
-                    break;
                 }
-                default: [[likely]] break;
+                break;
             }
-            out.push_back_expect_capacity(c);
-        }
-        never();
-    }
-
-    const char* got_x_escape (const char* in, char& r) {
-        {
-            if (in + 2 >= end) goto invalid_x;
-            int n0 = from_hex_digit(in[0]);
-            if (n0 < 0) goto invalid_x;
-            int n1 = from_hex_digit(in[1]);
-            if (n1 < 0) goto invalid_x;
-            in += 2;
-            r = n0 << 4 | n1;
-            return in;
+            default: break;
         }
-        invalid_x: error(in, "Invalid \\x escape sequence");
     }
+}
 
-     // NOINLINE this because it's complicated and we only have it for JSON
-     // compatibility.
-    NOINLINE
-    const char* got_u_escape (const char* in, UniqueString& out) {
-        UniqueString16 units (Capacity(1));
-         // Process multiple \uXXXX sequences at once so
-         // that we can fuse UTF-16 surrogates.
-        for (;;) {
-            if (in + 4 >= end) goto invalid_u;
-            int n0 = from_hex_digit(in[0]);
-            if (n0 < 0) goto invalid_u;
-            int n1 = from_hex_digit(in[1]);
-            if (n1 < 0) goto invalid_u;
-            int n2 = from_hex_digit(in[2]);
-            if (n0 < 0) goto invalid_u;
-            int n3 = from_hex_digit(in[3]);
-            if (n1 < 0) goto invalid_u;
-            units.push_back(n0 << 12 | n1 << 8 | n2 << 4 | n3);
-            in += 4;
-            if (in + 2 < end && in[0] == '\\' && in[1] == 'u') {
-                in += 2;
-            }
-            else break;
-        }
-        out.append_expect_capacity(from_utf16(units));
-        return in;
-        invalid_u: error(in, "Invalid \\u escape sequence");
+static UniqueArray<Tree> parse_list_parallel (
+    Str s, Str filename, u32 n_threads
+) {
+     // Shortcuts can refer to other items, so if there are any, the items
+     // can't be parsed independently.  If anything else goes wrong, parse
+     // sequentially too, so that errors are reported exactly the same way.
+    auto scanner = Parser(s, filename);
+    const char* in = scanner.begin;
+    if (in + 2 < scanner.end && Str(in, 3) == "\xef\xbb\xbf") {
+        in += 3;
     }
-
-///// COMPOUND
-
-    NOINLINE static
-    const char* got_array (Parser& self, const char* in, Tree& r) {
-        if (!--self.shallowth) self.error(in, "Exceeded limit of 200 nested arrays/objects");
-        const char* start = in;
-        in++;  // for the [
-        in = self.skip_ws(in);
-        UniqueArray<Tree> a;
-        while (in < self.end) {
-            if (*in == '}') [[unlikely]] {
-                auto sp = self.get_source_pos(start);
-                self.error(in, cat(
-                    "Mismatch between [ at ", sp.line, ':', sp.col, " and }"
-                ));
-            }
-            if (*in == ']') {
-                new (&r) Tree(move(a));
-                ++self.shallowth;
-                return in + 1;
-            }
-            in = self.parse_term(in, a.emplace_back());
-            in = self.skip_comma(in);
-        }
-        self.error(in, "Missing ] before end of input");
+    in = scanner.skip_ws(in);
+    UniqueArray<const char*> splits;
+    splits.push_back(in);
+    usize chunk_size = (scanner.end - in) / n_threads + 1;
+    if (!find_splits(scanner, in, chunk_size, splits) || splits.size() < 2) {
+        return tree_list_from_string(s, filename);
     }
-
-    NOINLINE static
-    const char* got_object (Parser& self, const char* in, Tree& r) {
-        if (!--self.shallowth) self.error(in, "Exceeded limit of 200 nested arrays/objects");
-        const char* start = in;
-        in++;  // for the {
-        in = self.skip_ws(in);
-        UniqueArray<TreePair> o;
-        while (in < self.end) {
-            if (*in == ']') [[unlikely]] {
-                auto sp = self.get_source_pos(start);
-                self.error(in, cat(
-                    "Mismatch between { at ", sp.line, ':', sp.col, " and ]"
-                ));
-            }
-            if (*in == '}') {
-                new (&r) Tree(move(o));
-                ++self.shallowth;
-                return in + 1;
-            }
-            Tree key;
-            in = self.parse_term(in, key);
-            if (key.form != Form::String) {
-                self.error(in, "Can't use non-string as key in object");
-            }
-            in = self.skip_ws(in);
-            if (in >= self.end) goto not_terminated;
-            if (*in == ':') in++;
-            else [[unlikely]] {
-                self.check_error_chars(in);
-                self.error(in, "Missing : after name in object");
+    u32 n_chunks = splits.size();
+    splits.push_back(scanner.end);
+
+    auto chunks = UniqueArray<UniqueArray<Tree>>(n_chunks);
+    auto chunks_ok = UniqueArray<bool>(n_chunks);
+    auto parse_chunk = [&](u32 c){
+        try {
+             // Use the whole document so errors have the right position.
+            auto parser = Parser(s, filename);
+            parser.shallowth = Parser::max_depth;
+            const char* in = splits[c];
+            const char* chunk_end = splits[c+1];
+            UniqueArray<Tree> items;
+            while (in < chunk_end) {
+                in = parser.parse_term(in, items.emplace_back());
+                in = parser.skip_comma(in);
             }
-            in = self.skip_ws(in);
-            if (in >= self.end) goto not_terminated;
-            Tree& value = o.emplace_back(AnyString(move(key)), Tree()).second;
-            in = self.parse_term(in, value);
-            in = self.skip_comma(in);
+            chunks[c] = move(items);
+            chunks_ok[c] = in == chunk_end && parser.shortcuts.empty();
         }
-        not_terminated: self.error(in, "Missing } before end of input");
-    }
-
-///// SHORTCUTS
-
-     // std::unordered_map is supposedly slow, so we'll use an array instead.
-     // We'll rethink if we ever need to parse a document with a large amount
-     // of shortcuts (I can't imagine for my use cases having more than 20
-     // or so).
-    UniqueArray<TreePair> shortcuts;
-
-    const char* parse_shortcut_name (const char* in, AnyString& r) {
-        Tree name;
-        auto end = parse_term(in, name);
-        if (name.form != Form::String) [[unlikely]] {
-            error(in, "Can't use non-string as shortcut name");
+        catch (...) { }
+    };
+     // lilac is single-threaded, so the other threads allocate with malloc.
+     // Freeing those allocations (on any thread) only reads the bounds of
+     // lilac's pool, which were set when splits was allocated.  Each
+     // std::thread's state is freed by its own thread, so it has to come from
+     // malloc too.
+    auto threads = UniqueArray<std::thread>(Capacity(n_chunks - 1));
+    {
+        lilac::MallocScope malloc_scope;
+        for (u32 c = 1; c < n_chunks; c++) {
+            threads.emplace_back_expect_capacity([&, c]{
+                lilac::MallocScope malloc_scope;
+                parse_chunk(c);
+            });
         }
-        new (&r) AnyString(move(name));
-        return end;
     }
-
-    NOINLINE static
-    const char* got_decl (Parser& self, const char* in, Tree& r) {
-        in++;  // for the &
-        {
-            AnyString name;
-            in = self.parse_shortcut_name(in, name);
-            for (auto& sc : self.shortcuts) {
-                if (sc.first == name) {
-                    self.error(in, cat("Multiple declarations of shortcut &", name));
-                }
-            }
-            in = self.skip_ws(in);
-            if (in < self.end && *in == ':') {
-                in++;
-                in = self.skip_ws(in);
-                Tree value;
-                in = self.parse_term(in, value);
-                self.shortcuts.emplace_back(move(name), move(value));
-                in = self.skip_comma(in);
-                 // Fall through
-            }
-            else {
-                in = self.parse_term(in, r);
-                self.shortcuts.emplace_back(move(name), r);
-                return in;
-            }
-        } // Destroy name and value so we can tail call parse_term.
-        return self.parse_term(in, r);
+    parse_chunk(0);
+    for (auto& t : threads) t.join();
+    usize total = 0;
+    for (u32 c = 0; c < n_chunks; c++) {
+        if (!chunks_ok[c]) return tree_list_from_string(s, filename);
+        total += chunks[c].size();
     }
-
-    NOINLINE static
-    const char* got_shortcut (Parser& self, const char* in, Tree& r) {
-        in++;  // for the *
-        AnyString name;
-        in = self.parse_shortcut_name(in, name);
-        for (auto& sc : self.shortcuts) {
-            if (sc.first == name) {
-                new (&r) Tree(sc.second);
-                return in;
-            }
-        }
-        self.error(in, cat("Unknown shortcut *", name));
+    auto r = UniqueArray<Tree>(Capacity(total));
+    for (auto& chunk : chunks) {
+        for (auto& item : chunk) r.emplace_back_expect_capacity(move(item));
     }
+    return r;
+}
 
-///// NON-SEMANTIC CONTENT
+} // in
 
-    const char* skip_comment (const char* in) {
-        in += 2;  // for two -s
-        while (in < end) {
-            if (*in++ == '\n') break;
-        }
-        return in;
+UniqueArray<Tree> tree_list_from_string_parallel (
+    Str s, Str filename, u32 threads
+) {
+    require(s.size() <= AnyString::max_size_);
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (threads <= 1 || s.size() < min_parallel_size) {
+        return tree_list_from_string(s, filename);
     }
+    return parse_list_parallel(s, filename, threads);
+}
 
-    NOINLINE const char* skip_ws (const char* in) {
-        while (in < end) {
-            if (char_props[*in] & CHAR_IS_WS) {
-                in++;
-            }
-            else if (*in == '-') [[unlikely]] {
-                if (in + 1 < end && in[1] == '-') {
-                    in = skip_comment(in);
-                }
-                else return in;
-            }
-            else return in;
-        }
-        return in;
-    }
+Tree tree_from_file (AnyString filename) {
+    UniqueString s = string_from_file(filename);
+    return tree_from_string(s, filename);
+}
 
-    NOINLINE const char* skip_comma (const char* in) {
-        while (in < end) {
-            if (char_props[*in] & CHAR_IS_WS) {
-                in++;
-            }
-            else if (*in == '-') [[unlikely]] {
-                if (in + 1 < end && in[1] == '-') {
-                    in = skip_comment(in);
-                }
-                else return in;
-            }
-            else if (*in == ',') { in++; goto next; }
-            else return in;
-        }
-        return in;
-        next:
-        while (in < end) {
-            if (char_props[*in] & CHAR_IS_WS) {
-                in++;
-            }
-            else if (*in == '-') [[unlikely]] {
-                if (in + 1 < end && in[1] == '-') {
-                    in = skip_comment(in);
-                }
-                else return in;
-            }
-            else return in;
-        }
-        return in;
-    }
+UniqueArray<Tree> tree_list_from_file (AnyString filename) {
+    UniqueString s = string_from_file(filename);
+    return tree_list_from_string(s, filename);
+}
 
-///// ERRORS
-
-    [[gnu::cold]] NOINLINE
-    SourcePos get_source_pos (const char* p) {
-         // Diagnose line and column number
-         // I'm not sure the col is exactly right
-        u32 line = 1;
-        const char* last_lf = begin - 1;
-        for (const char* p2 = begin; p2 != p; p2++) {
-            if (*p2 == '\n') {
-                line++;
-                last_lf = p2;
-            }
-        }
-        u32 col = p - last_lf;
-        return {line, col};
-    };
+UniqueArray<Tree> tree_list_from_file_parallel (
+    AnyString filename, u32 threads
+) {
+    UniqueString s = string_from_file(filename);
+    return tree_list_from_string_parallel(s, filename, threads);
+}
 
-    [[gnu::cold]] NOINLINE static
-    const char* got_error (Parser& self, const char* in, Tree&) {
-        self.check_error_chars(in);
-        self.error(in, cat("Expected term but got ", *in));
-    }
+Tree tree_from_string_lazy (AnyString s, AnyString filename) {
+    require(s.size() <= AnyString::max_size_);
+    LazyDocument doc {
+        .source = move(s), .mapping = {}, .filename = move(filename)
+    };
+    auto parser = Parser(doc.source, doc.filename);
+    parser.lazy = &doc;
+    return parser.parse();
+}
 
-    [[gnu::cold]] NOINLINE
-    void check_error_chars (const char* in) {
-        if (*in <= ' ' || *in >= 127) {
-            error(in, cat(
-                "Unrecognized byte <", to_hex_digit(u8(*in) >> 4),
-                to_hex_digit(*in & 0xf), '>'
-            ));
-        }
-        switch (*in) {
-            case ANY_RESERVED_SYMBOL:
-                error(in, cat("Reserved symbol ", *in));
-            default: return;
-        }
-    }
+Tree tree_from_string_borrowed (Str s, Str filename) {
+    require(s.size() <= AnyString::max_size_);
+    return Parser(s, filename, true).parse();
+}
 
-    [[noreturn, gnu::cold]] NOINLINE
-    void error (const char* in, Str mess) {
-        auto pos = get_source_pos(in);
-        raise(e_ParseFailed, cat(
-            mess, " at ", filename, ':', pos.line, ':', pos.col
-        ));
+MappedTree tree_from_file_mapped (AnyString filename, bool lazy) {
+    MappedTree r;
+    r.mapping = mapping_from_file(filename);
+    Str s = r.mapping.contents();
+    require(s.size() <= AnyString::max_size_);
+    auto parser = Parser(s, filename, true);
+    LazyDocument doc;
+    if (lazy) {
+        doc.mapping = r.mapping;
+        doc.filename = move(filename);
+        parser.lazy = &doc;
     }
-};
+    r.tree = parser.parse();
+    return r;
+}
 
-} using namespace in;
+namespace in {
 
- // Finally:
-Tree tree_from_string (Str s, Str filename) {
-    require(s.size() <= AnyString::max_size_);
-    return Parser(s, filename).parse();
+Tree make_LazyTree (
+    const LazyDocument& doc, const char* at, u32 shallowth, u32 size
+) {
+    auto data = UniqueArray<LazyTree>(1, LazyTree{doc, at, shallowth, Tree()});
+    Tree r;
+    r.form = *at == '[' ? Form::Array : Form::Object;
+    r.flags = TreeFlags::Lazy;
+    r.owned = true;
+    r.size = size;
+    r.data.as_lazy_ptr = data.impl.data;
+    data.impl = {};
+    return r;
 }
 
-UniqueArray<Tree> tree_list_from_string (Str s, Str filename) {
-    require(s.size() <= AnyString::max_size_);
-    return Parser(s, filename).parse_list();
+void force_LazyTree (const Tree& t) {
+    auto lt = const_cast<LazyTree*>(t.data.as_lazy_ptr);
+    if (!lt->parsed.has_value()) {
+         // Don't borrow, because this tree may outlive the LazyTree (and its
+         // reference to the mapping).
+        auto parser = Parser(lt->doc.contents(), lt->doc.filename);
+        parser.lazy = &lt->doc;
+        lt->parsed = parser.parse_lazy(lt->at, lt->shallowth);
+        expect(lt->parsed.form == t.form && lt->parsed.size == t.size);
+    }
+     // Copy before assigning, because assigning may delete lt.
+    Tree parsed = lt->parsed;
+    const_cast<Tree&>(t) = move(parsed);
 }
 
-Tree tree_from_file (AnyString filename) {
-    UniqueString s = string_from_file(filename);
-    return tree_from_string(s, filename);
+void delete_LazyTree (Tree& t) noexcept {
+    t.data.as_lazy_ptr->~LazyTree();
+    SharableBuffer<const LazyTree>::deallocate(t.data.as_lazy_ptr);
 }
 
-UniqueArray<Tree> tree_list_from_file (AnyString filename) {
-    UniqueString s = string_from_file(filename);
-    return tree_list_from_string(s, filename);
-}
+} // in
 
 } using namespace ayu;
 
 #ifndef TAP_DISABLE_TESTS
 #include "../../tap/tap.h"
+#include "../../uni/time.h"
+#include "../resources/resource.h"
+#include "../test/test-environment.private.h"
 #include "print.h"
 
 static tap::TestSet tests ("dirt/ayu/data/parse", []{
     using namespace tap;
+    test::TestEnvironment env;
     auto y = [](StaticString s, const Tree& t){
         try_is([&]{return tree_from_string(s);}, t, cat("yes: ", s));
     };
@@ -758,6 +362,200 @@ static tap::TestSet tests ("dirt/ayu/data/parse", []{
         redwood = Tree::array(redwood);
     }
     y(StaticString(big.slice(1, 401)), redwood);
+
+     // Make sure every scan implementation agrees with char_props for every
+     // byte at every offset within a vector.
+    auto max_level = max_scan_level();
+    for (u8 level = 0; level <= u8(max_level); level++) {
+        scan_level = ScanLevel(level);
+        bool ws_good = true, word_good = true, quoted_good = true;
+        bool structural_good = true;
+        char buf [80];
+        for (u32 b = 0; b < 256; b++)
+        for (u32 i = 0; i < 64; i++) {
+            std::memset(buf, ' ', sizeof(buf));
+            buf[i] = char(b);
+            bool is_ws = char_props[b] & CHAR_IS_WS;
+            if (scan_ws(buf, buf + sizeof(buf)) != buf + (is_ws ? 80 : i)) {
+                ws_good = false;
+            }
+            std::memset(buf, 'a', sizeof(buf));
+            buf[i] = char(b);
+            bool is_word = char_props[b] & CHAR_CONTINUES_WORD;
+            if (scan_word(buf, buf + sizeof(buf)) != buf + (is_word ? 80 : i)) {
+                word_good = false;
+            }
+            bool is_special = b == '"' || b == '\\';
+            if (scan_quoted(buf, buf + sizeof(buf)) != buf + (is_special ? i : 80)) {
+                quoted_good = false;
+            }
+            bool is_struct = is_structural(char(b));
+            if (scan_structural(buf, buf + sizeof(buf)) != buf + (is_struct ? i : 80)) {
+                structural_good = false;
+            }
+        }
+        ok(ws_good, cat("scan_ws agrees with char_props at level ", level));
+        ok(word_good, cat("scan_word agrees with char_props at level ", level));
+        ok(quoted_good, cat("scan_quoted finds \" and \\ at level ", level));
+        ok(structural_good, cat(
+            "scan_structural agrees with is_structural at level ", level
+        ));
+    }
+
+     // Throughput benchmark.  Also checks that all scan levels produce the
+     // same tree.
+    UniqueString doc = "[\n";
+    for (u32 i = 0; i < 4000; i++) {
+        doc = cat(move(doc),
+            "    {  -- item ", i, "\n"
+            "        name: \"Item number ", i, " with a longish name\"\n"
+            "        type: some::namespaced::Type<with_params>\n"
+            "        desc: \"A string with \\\"escapes\\\" \\n and \\t stuff ",
+            "that goes on for a while\"\n"
+            "        pos: [", i, ".5 -", i * 3, " 0x", i, "]\n"
+            "        tags: [alpha beta gamma delta epsilon]\n"
+            "    }\n"
+        );
+    }
+    doc = cat(move(doc), "]\n");
+    Tree expected;
+    for (u8 level = 0; level <= u8(max_level); level++) {
+        scan_level = ScanLevel(level);
+        double start = uni::steady_clock();
+        Tree got = tree_from_string(doc);
+        double time = uni::steady_clock() - start;
+        diag(cat(
+            "Parsed ", doc.size() / 1024, "K at scan level ", level, " in ",
+            time * 1000, "ms (", doc.size() / time / (1024*1024), " MB/s)"
+        ));
+        if (level == 0) expected = move(got);
+        else is(got, expected, cat("Scan level ", level, " produces same tree"));
+    }
+    scan_level = max_level;
+
+    auto mapped_file = resource_filename(IRI("ayu-test:/parse-mapped.ayu"));
+    string_to_file(doc, mapped_file);
+    Tree unborrowed;
+    {
+        auto mapped = tree_from_file_mapped(mapped_file);
+        is(mapped.tree, expected, "tree_from_file_mapped produces same tree");
+        Str contents = mapped.mapping.contents();
+        const Tree& item = mapped.tree[0u];
+        const Tree& type = item["type"];
+        ok(type.flags % TreeFlags::Borrowed, "Unquoted string is borrowed");
+        ok(item["name"].flags % TreeFlags::Borrowed, "Quoted string is borrowed");
+        ok(!(item["desc"].flags % TreeFlags::Borrowed),
+            "String with escapes is not borrowed"
+        );
+        ok(Str(type).begin() >= contents.begin() &&
+           Str(type).end() <= contents.end(),
+            "Borrowed string points into the mapping"
+        );
+        ok(AnyString(type).owned(), "Converting borrowed string copies it");
+        ok(Slice<TreePair>(item)[0].first.owned(), "Object keys are not borrowed");
+        unborrowed = tree_unborrow(mapped.tree);
+    }
+    is(unborrowed, expected, "tree_unborrow result survives unmapping");
+
+    {
+        double start = uni::steady_clock();
+        Tree lazy = tree_from_string_lazy(doc);
+        double time = uni::steady_clock() - start;
+        diag(cat("Lazily parsed ", doc.size() / 1024, "K in ", time * 1000, "ms"));
+        ok(!(lazy.flags % TreeFlags::Lazy), "Top-level tree is not lazy");
+        const Tree& item = lazy[1u];
+        ok(item.flags % TreeFlags::Lazy, "Large object is lazy");
+        is(item.size, expected[1u].size, "Lazy tree has the correct size");
+        is(item["name"], expected[1u]["name"], "Lazy tree is parsed on access");
+        ok(!(item.flags % TreeFlags::Lazy), "Lazy tree is replaced when parsed");
+        is(lazy, expected, "tree_from_string_lazy produces same tree");
+    }
+    {
+        Tree kept;
+        {
+            auto mapped = tree_from_file_mapped(mapped_file, true);
+            kept = mapped.tree[2u];
+        }
+        ok(kept.flags % TreeFlags::Lazy, "tree_from_file_mapped can be lazy");
+        Tree unlazy = tree_unborrow(kept);
+        ok(kept.flags % TreeFlags::Lazy, "tree_unborrow leaves lazy tree alone");
+        auto any_lazy = [](auto& self, const Tree& t) -> bool {
+            if (t.flags % TreeFlags::Lazy) return true;
+            if (t.form == Form::Array) {
+                for (auto& e : Slice<Tree>(t)) if (self(self, e)) return true;
+            }
+            else if (t.form == Form::Object) {
+                for (auto& [k, v] : Slice<TreePair>(t)) {
+                    if (self(self, v)) return true;
+                }
+            }
+            return false;
+        };
+        ok(!any_lazy(any_lazy, unlazy), "tree_unborrow parses lazy trees");
+        is(unlazy, expected[2u], "tree_unborrow of lazy tree is correct");
+        is(kept, expected[2u], "Lazy tree keeps mapping alive");
+    }
+    remove_utf8(mapped_file.c_str());
+
+    {
+        Str list = doc.slice(1, doc.size() - 2);
+        double start = uni::steady_clock();
+        auto sequential = tree_list_from_string(list);
+        double seq_time = uni::steady_clock() - start;
+        start = uni::steady_clock();
+        auto parallel = tree_list_from_string_parallel(list, "", 4);
+        double par_time = uni::steady_clock() - start;
+        diag(cat(
+            "Parsed list sequentially in ", seq_time * 1000,
+            "ms and on 4 threads in ", par_time * 1000, "ms"
+        ));
+        ok(parallel == sequential, "Parallel list parse produces same trees");
+        ok(Slice<Tree>(parallel) == Slice<Tree>(expected),
+            "Parallel list parse has the same items"
+        );
+        UniqueString bad = cat(list, " [1 2 3.] ", list, " [4.]");
+        UniqueString sequential_error, parallel_error;
+        try { tree_list_from_string(bad, "bad.ayu"); }
+        catch (Error& e) { sequential_error = e.details; }
+        try { tree_list_from_string_parallel(bad, "bad.ayu", 4); }
+        catch (Error& e) { parallel_error = e.details; }
+        ok(sequential_error.size() > 0, "Bad list fails to parse");
+        is(parallel_error, sequential_error,
+            "Parallel list parse reports the first error"
+        );
+        UniqueString with_shortcuts = cat("&x:1 ", list, " *x");
+        auto sc = tree_list_from_string_parallel(with_shortcuts, "", 4);
+        is(sc.size(), sequential.size() + 1, "Parallel parse falls back for shortcuts");
+        is(sc.back(), Tree(1), "Shortcut resolved in parallel parse fallback");
+    }
+
+     // Errors in lazy trees should be reported the same way as usual.
+    UniqueString padding = cat("\n    -- ", UniqueString(300, '-'), "\n");
+    UniqueString bad = cat(
+        "[{a:1} {\n    a: [1 2 3]", padding, "    b: [4 5 6.]\n}]"
+    );
+    UniqueString eager_error, lazy_error;
+    try { tree_from_string(bad, "bad.ayu"); }
+    catch (Error& e) { eager_error = e.details; }
+    Tree lazy_bad;
+    doesnt_throw([&]{ lazy_bad = tree_from_string_lazy(bad, "bad.ayu"); },
+        "Error in lazy tree isn't thrown until it's accessed"
+    );
+    try { lazy_bad[1u]["a"]; }
+    catch (Error& e) { lazy_error = e.details; }
+    ok(eager_error.size() > 0, "Bad document fails to parse");
+    is(lazy_error, eager_error, "Error in lazy tree has the same location");
+    isnt(lazy_bad, tree_from_string("[{a:1} {a:[1 2 3] b:[4 5 6]}]"),
+        "Lazy tree with error compares unequal"
+    );
+    Tree shortcuts = tree_from_string_lazy(cat(
+        "[&x:1 {", padding, "a:*x}]"
+    ));
+    ok(!(shortcuts[0u].flags % TreeFlags::Lazy),
+        "Object with shortcut is not lazy"
+    );
+    is(shortcuts[0u]["a"], Tree(1), "Shortcut resolved with lazy parsing");
+
     done_testing();
 });
 #endif
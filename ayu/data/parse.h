@@ -2,7 +2,9 @@
 
 #pragma once
 
+#include "../../uni/io.h"
 #include "../common.h"
+#include "tree.h"
 
 namespace ayu {
 
@@ -15,6 +17,53 @@ Tree tree_from_file (AnyString filename);
  // parsing an array, but without the surrounding [ and ].
 UniqueArray<Tree> tree_list_from_string (Str, Str filename = "");
 UniqueArray<Tree> tree_list_from_file (AnyString filename);
+ // Like the above, but reads the file a chunk at a time and passes each item
+ // to the callback as soon as it's complete, so the whole file never has to be
+ // in memory at once.  Implemented in parse-stream.cpp.
+void tree_list_from_file (AnyString filename, CallbackRef<void(Tree&&)> cb);
+ // Parses the items on multiple threads (threads = 0 means one per core).  The
+ // result and any errors are exactly the same as tree_list_from_string,
+ // because this falls back to it for small inputs, inputs with shortcuts
+ // (which can refer to other items), and inputs with syntax errors.
+UniqueArray<Tree> tree_list_from_string_parallel (
+    Str, Str filename = "", u32 threads = 0
+);
+UniqueArray<Tree> tree_list_from_file_parallel (
+    AnyString filename, u32 threads = 0
+);
+
+ // Parses a file by mapping it into memory instead of reading it into a
+ // buffer.  String values without escape sequences borrow from the mapping
+ // instead of being copied (see TreeFlags::Borrowed), so the tree must not be
+ // used after the mapping is destroyed.  Converting strings out of the tree
+ // copies them, so things deserialized with item_from_tree are safe.
+struct MappedTree {
+     // Declared first so it's destroyed last.
+    SharedMapping mapping;
+    Tree tree;
+};
+MappedTree tree_from_file_mapped (AnyString filename, bool lazy = false);
+ // Like tree_from_file_mapped, but for a string that's already in memory.
+ // String values without escape sequences borrow from the string, so it must
+ // outlive the tree.
+Tree tree_from_string_borrowed (Str, Str filename = "");
+
+ // Parses only the top-level item, leaving large arrays and objects inside it
+ // unparsed (see TreeFlags::Lazy).  Each of those is parsed the first time its
+ // contents are accessed, again leaving its own large children unparsed.  This
+ // saves time when only part of the document is used, such as when
+ // item_from_tree skips ignored attributes.
+ //
+ // Syntax errors in an unparsed tree are thrown when it's accessed instead of
+ // from this function, but they still have the correct line and column.
+ // Unparsed trees keep a reference to the source, so it stays alive as long as
+ // they do.  Arrays and objects that contain shortcuts are always parsed
+ // immediately.
+ //
+ // Passing lazy = true to tree_from_file_mapped does the same thing.  The
+ // top-level item will borrow strings from the mapping as usual, but trees
+ // parsed later won't.
+Tree tree_from_string_lazy (AnyString, AnyString filename = "");
 
 constexpr ErrorCode e_ParseFailed = "ayu::e_ParseFailed";
 
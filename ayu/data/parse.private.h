@@ -0,0 +1,712 @@
+// The recursive-descent parser behind tree_from_string and friends.  This is
+// in a header so the stream parser can reuse it for individual tokens.
+
+#pragma once
+
+#include <cstring>
+#include <charconv>
+#include <limits>
+
+#include "../../uni/text.h"
+#include "../../uni/utf.h"
+#include "char-cases.private.h"
+#include "char-scan.private.h"
+#include "parse.h"
+#include "tree.h"
+
+namespace ayu::in {
+
+struct SourcePos {
+    u32 line;
+    u32 col;
+};
+
+ // Keeps the source of a lazily-parsed document alive.  Only one of source and
+ // mapping is set.
+struct LazyDocument {
+    AnyString source;
+    SharedMapping mapping;
+    AnyString filename;
+
+    Str contents () const {
+        return mapping ? mapping.contents() : Str(source);
+    }
+};
+
+ // The data of a Tree with TreeFlags::Lazy.
+struct LazyTree {
+    LazyDocument doc;
+     // Points at the [ or { in doc.
+    const char* at;
+     // Parser::shallowth at that point, so nesting limits are still enforced.
+    u32 shallowth;
+     // Set the first time this is parsed, in case there are other copies of
+     // the unparsed tree around.
+    Tree parsed;
+};
+
+ // Defined in parse.cpp
+Tree make_LazyTree (const LazyDocument&, const char* at, u32 shallowth, u32 size);
+
+ // Parsing is simple enough that we don't need a separate lexer step.
+struct Parser {
+
+     // Limit how many nested arrays and objects we have.  If you have that much
+     // data in a structured text format, you're going to have performance
+     // problems anyway, and you should offload some of it to binary or flat
+     // text formats.
+    static constexpr u32 max_depth = 200;
+
+///// TOP
+
+    const char* end;
+    const char* begin;
+    Str filename;
+    u32 shallowth;
+     // Point strings into the source instead of copying them.  Only do this if
+     // the source will outlive the tree (see tree_from_file_mapped).
+    bool borrow;
+     // Where begin is in the document, for parsing part of a document (the
+     // stream parser does this).  Only used for error messages.
+    SourcePos base = {1, 1};
+     // If set, arrays and objects below the top level that are at least
+     // min_lazy_size bytes long are skipped and left for later (see
+     // TreeFlags::Lazy).  begin and end must be the whole document.
+    const LazyDocument* lazy = null;
+     // Smaller than this it's cheaper to just parse it than to allocate a
+     // LazyTree.
+    static constexpr usize min_lazy_size = 256;
+
+    Parser (Str s, Str filename, bool borrow = false) :
+        end(s.end()),
+        begin(s.begin()),
+        filename(filename),
+        borrow(borrow)
+    { }
+
+     // For strings that don't need any unescaping.
+    Tree string_tree (Str s) {
+        if (borrow) {
+            return Tree(AnyString(StaticString(s)), TreeFlags::Borrowed);
+        }
+        else return Tree(s);
+    }
+
+    Tree parse () {
+        shallowth = max_depth + 1;
+        const char* in = begin;
+         // Skip BOM
+        if (in + 2 < end && Str(in, 3) == "\xef\xbb\xbf") {
+            in += 3;
+        }
+        in = skip_ws(in);
+        Tree r;
+        in = parse_term(in, r);
+        in = skip_ws(in);
+        if (in != end) error(in, "Extra stuff at end of document");
+        expect(shallowth == max_depth + 1);
+        return r;
+    }
+
+    UniqueArray<Tree> parse_list () {
+        shallowth = max_depth;
+        const char* in = begin;
+        if (in + 2 < end && Str(in, 3) == "\xef\xbb\xbf") {
+            in += 3;
+        }
+        UniqueArray<Tree> r;
+        in = skip_ws(in);
+        while (in != end) {
+            Tree e;
+            in = parse_term(in, e);
+            r.push_back(move(e));
+            in = skip_comma(in);
+        }
+        expect(shallowth == max_depth);
+        return r;
+    }
+
+     // Parse the array or object at a LazyTree's position.
+    Tree parse_lazy (const char* at, u32 shallowth_) {
+        shallowth = shallowth_;
+        Tree r;
+        parse_term(at, r);
+        expect(shallowth == shallowth_);
+        return r;
+    }
+
+///// TERM
+
+    NOINLINE const char* parse_term (const char* in, Tree& r) {
+         // Table has to be inside member function to see functions declared
+         // below it.
+        static constexpr decltype(&got_word) table [] = {
+            &got_error,
+            &got_word,
+            &got_digit,
+            &got_dot,
+            &got_plus,
+            &got_minus,
+            &got_string,
+            &got_array,
+            &got_object,
+            &got_decl,
+            &got_shortcut
+        };
+        if (in >= end) error(in, "Expected term but ran into end of input");
+        auto index = char_props[u8(*in)] & CHAR_TERM_MASK;
+        expect(u32(index) <= sizeof(table) / sizeof(table[0]));
+        return table[u32(index)](*this, in, r);
+    }
+
+///// WORDS (unquoted)
+
+    NOINLINE Str parse_word (const char* in) {
+        const char* start = in;
+        in++; // First character already known to be part of word
+        for (;;) {
+            in = scan_word(in, end);
+            if (in >= end) return Str(start, in);
+            else if (*in == ':') {
+                 // Allow :: for c++ types
+                if (in + 1 < end && in[1] == ':') {
+                    in += 2;
+                }
+                else return Str(start, in);
+            }
+            else if (*in == '"') {
+                error(in, "\" cannot occur inside a word (are you missing the first \"?)");
+            }
+            else [[likely]] return Str(start, in);
+        }
+    }
+
+    NOINLINE static
+    const char* got_word (Parser& self, const char* in, Tree& r) {
+        auto word = self.parse_word(in);
+        if (word == "null") new (&r) Tree(null);
+        else if (word == "true") new (&r) Tree(true);
+        else if (word == "false") new (&r) Tree(false);
+        else new (&r) Tree(self.string_tree(word));
+        return word.end();
+    }
+
+///// NUMBERS
+
+    [[noreturn, gnu::cold]] NOINLINE
+    void error_invalid_number (Str word) {
+        if (word.end() < end) {
+            check_error_chars(word.end());
+        }
+        error(word.begin(), "Couldn't parse number");
+    }
+
+    template <bool hex>
+    const char* parse_floating (Str word, Tree& r, bool minus) {
+        double floating;
+        const char* word_end = word.end();
+        auto [num_end, ec] = std::from_chars(
+            word.begin(), word_end, floating,
+            hex ? std::chars_format::hex
+                : std::chars_format::general
+        );
+        if (num_end == word_end) {
+            TreeFlags f = hex ? TreeFlags::PreferHex : TreeFlags();
+            new (&r) Tree(minus ? -floating : floating, f);
+            return num_end;
+        }
+        else error_invalid_number(word);
+    }
+
+    template <bool hex>
+    const char* parse_number (Str word, Tree& r, bool minus) {
+         // Using an unsigned integer parser will reject words that start with a
+         // + or -.
+        u64 integer;
+        auto [num_end, ec] = std::from_chars(
+            word.begin(), word.end(), integer, hex ? 16 : 10
+        );
+        if (ec != std::errc()) error_invalid_number(word);
+        if (num_end == word.end()) {
+            TreeFlags f = hex ? TreeFlags::PreferHex : TreeFlags();
+            if (minus) {
+                if (integer == 0) new (&r) Tree(-0.0, f);
+                else new (&r) Tree(-integer, f);
+            }
+            else new (&r) Tree(integer, f);
+            return num_end;
+        }
+         // Forbid ending with a .
+        if (num_end[0] == '.') {
+            if (num_end + 1 >= word.end() ||
+                (num_end[1] & ~('a' & ~'A')) == (hex ? 'P' : 'E')
+            ) error(num_end, "Number cannot end with a dot.");
+        }
+        return parse_floating<hex>(word, r, minus);
+    }
+
+    NOINLINE const char* parse_number_based (Str word, Tree& r, bool minus) {
+         // Detect hex prefix
+        if (word.size() >= 2 && (word.chop(2) == "0x" || word.chop(2) == "0X")) {
+            return parse_number<true>(word.slice(2), r, minus);
+        }
+        else return parse_number<false>(word, r, minus);
+    }
+
+    NOINLINE static
+    const char* got_digit (Parser& self, const char* in, Tree& r) {
+        return self.parse_number_based(self.parse_word(in), r, false);
+    }
+
+    NOINLINE static
+    const char* got_dot (Parser& self, const char* in, Tree& r) {
+        auto word = self.parse_word(in);
+        if (word.size() > 1) switch (word[1]) {
+            case ANY_DECIMAL_DIGIT: case '+': case '-': {
+                self.error(in, "Number cannot start with a dot.");
+            }
+        }
+        new (&r) Tree(self.string_tree(word));
+        return word.end();
+    }
+
+    NOINLINE static
+    const char* got_plus (Parser& self, const char* in, Tree& r) {
+        auto word = self.parse_word(in);
+        if (word == "+nan") {
+            new (&r) Tree(std::numeric_limits<double>::quiet_NaN());
+            return word.end();
+        }
+        else if (word == "+inf") {
+            new (&r) Tree(std::numeric_limits<double>::infinity());
+            return word.end();
+        }
+        return self.parse_number_based(word.slice(1), r, false);
+    }
+
+    NOINLINE static
+    const char* got_minus (Parser& self, const char* in, Tree& r) {
+         // Comments should already have been recognized by this point.
+        auto word = self.parse_word(in);
+        if (word == "-inf") {
+            new (&r) Tree(-std::numeric_limits<double>::infinity());
+            return word.end();
+        }
+        return self.parse_number_based(word.slice(1), r, true);
+    }
+
+///// STRINGS (quoted)
+
+    NOINLINE static
+    const char* got_string (Parser& self, const char* in, Tree& r) {
+        in++;  // for the "
+         // Find the end of the string and determine upper bound of required
+         // capacity.
+        u32 n_escapes = 0;
+        const char* p = in;
+        for (;;) {
+            p = scan_quoted(p, self.end);
+            if (p >= self.end) [[unlikely]] {
+                self.error(in, "Missing \" before end of input");
+            }
+            if (*p == '"') break;
+            n_escapes++;
+             // No buffer overrun, scan_quoted checks p < end before reading.
+            p += 2;
+        }
+         // If there aren't any escapes we can just memcpy (or borrow) the
+         // whole string
+        if (!n_escapes) {
+            new (&r) Tree(self.string_tree(Str(in, p)));
+            return p+1; // For the "
+        }
+         // Otherwise preallocate
+        auto out = UniqueString(Capacity(p - in - n_escapes));
+         // Now read the string, copying runs without escapes all at once.
+        while (in < self.end) {
+            const char* run_end = scan_quoted(in, p);
+            out.append_expect_capacity(Str(in, run_end));
+            in = run_end;
+            char c = *in++;
+            switch (c) {
+                case '"':
+                    new (&r) Tree(move(out));
+                    return in;
+                case '\\': {
+                    expect(in < self.end);
+                    switch (*in++) {
+                        case '"': c = '"'; break;
+                        case '\\': c = '\\'; break;
+                         // Dunno why this is in json
+                        case '/': c = '/'; break;
+                        case 'b': c = '\b'; break;
+                        case 'f': c = '\f'; break;
+                        case 'n': c = '\n'; break;
+                        case 'r': c = '\r'; break;
+                        case 't': c = '\t'; break;
+                        case 'x': in = self.got_x_escape(in, c); break;
+                        case 'u':
+                            in = self.got_u_escape(in, out);
+                            continue; // Skip the push_back
+                        default: in--; self.error(in, "Unknown escape sequence");
+                    }
+                    break;
+                }
+                 // scan_quoted only stops at " or \ before p.
+                default: never();
+            }
+            out.push_back_expect_capacity(c);
+        }
+        never();
+    }
+
+    const char* got_x_escape (const char* in, char& r) {
+        {
+            if (in + 2 >= end) goto invalid_x;
+            int n0 = from_hex_digit(in[0]);
+            if (n0 < 0) goto invalid_x;
+            int n1 = from_hex_digit(in[1]);
+            if (n1 < 0) goto invalid_x;
+            in += 2;
+            r = n0 << 4 | n1;
+            return in;
+        }
+        invalid_x: error(in, "Invalid \\x escape sequence");
+    }
+
+     // NOINLINE this because it's complicated and we only have it for JSON
+     // compatibility.
+    NOINLINE
+    const char* got_u_escape (const char* in, UniqueString& out) {
+        UniqueString16 units (Capacity(1));
+         // Process multiple \uXXXX sequences at once so
+         // that we can fuse UTF-16 surrogates.
+        for (;;) {
+            if (in + 4 >= end) goto invalid_u;
+            int n0 = from_hex_digit(in[0]);
+            if (n0 < 0) goto invalid_u;
+            int n1 = from_hex_digit(in[1]);
+            if (n1 < 0) goto invalid_u;
+            int n2 = from_hex_digit(in[2]);
+            if (n0 < 0) goto invalid_u;
+            int n3 = from_hex_digit(in[3]);
+            if (n1 < 0) goto invalid_u;
+            units.push_back(n0 << 12 | n1 << 8 | n2 << 4 | n3);
+            in += 4;
+            if (in + 2 < end && in[0] == '\\' && in[1] == 'u') {
+                in += 2;
+            }
+            else break;
+        }
+        out.append_expect_capacity(from_utf16(units));
+        return in;
+        invalid_u: error(in, "Invalid \\u escape sequence");
+    }
+
+///// COMPOUND
+
+    NOINLINE static
+    const char* got_array (Parser& self, const char* in, Tree& r) {
+        if (!--self.shallowth) self.error(in, "Exceeded limit of 200 nested arrays/objects");
+        const char* start = in;
+        in++;  // for the [
+        in = self.skip_ws(in);
+        UniqueArray<Tree> a;
+        while (in < self.end) {
+            if (*in == '}') [[unlikely]] {
+                auto sp = self.get_source_pos(start);
+                self.error(in, cat(
+                    "Mismatch between [ at ", sp.line, ':', sp.col, " and }"
+                ));
+            }
+            if (*in == ']') {
+                new (&r) Tree(move(a));
+                ++self.shallowth;
+                return in + 1;
+            }
+            in = self.parse_child(in, a.emplace_back());
+            in = self.skip_comma(in);
+        }
+        self.error(in, "Missing ] before end of input");
+    }
+
+    NOINLINE static
+    const char* got_object (Parser& self, const char* in, Tree& r) {
+        if (!--self.shallowth) self.error(in, "Exceeded limit of 200 nested arrays/objects");
+        const char* start = in;
+        in++;  // for the {
+        in = self.skip_ws(in);
+        UniqueArray<TreePair> o;
+        while (in < self.end) {
+            if (*in == ']') [[unlikely]] {
+                auto sp = self.get_source_pos(start);
+                self.error(in, cat(
+                    "Mismatch between { at ", sp.line, ':', sp.col, " and ]"
+                ));
+            }
+            if (*in == '}') {
+                new (&r) Tree(move(o));
+                ++self.shallowth;
+                return in + 1;
+            }
+            Tree key;
+            in = self.parse_term(in, key);
+            if (key.form != Form::String) {
+                self.error(in, "Can't use non-string as key in object");
+            }
+            in = self.skip_ws(in);
+            if (in >= self.end) goto not_terminated;
+            if (*in == ':') in++;
+            else [[unlikely]] {
+                self.check_error_chars(in);
+                self.error(in, "Missing : after name in object");
+            }
+            in = self.skip_ws(in);
+            if (in >= self.end) goto not_terminated;
+             // This copies the key if it was borrowed.  Keys are handed out
+             // directly as AnyStrings, so they can't be allowed to dangle.
+            Tree& value = o.emplace_back(AnyString(move(key)), Tree()).second;
+            in = self.parse_child(in, value);
+            in = self.skip_comma(in);
+        }
+        not_terminated: self.error(in, "Missing } before end of input");
+    }
+
+///// LAZY
+
+     // Elements of arrays and values of objects come through here.
+    const char* parse_child (const char* in, Tree& r) {
+        if (lazy && (*in == '[' || *in == '{')) {
+            u32 size;
+            const char* skipped = skip_compound(in, shallowth, size);
+            if (skipped && usize(skipped - in) >= min_lazy_size) {
+                new (&r) Tree(make_LazyTree(*lazy, in, shallowth, size));
+                return skipped;
+            }
+        }
+        return parse_term(in, r);
+    }
+
+     // Finds the end of the array or object at in and counts its elements or
+     // attributes, without validating numbers or escape sequences.  Returns
+     // null if there's anything this can't skip, including shortcuts (which
+     // have to be resolved in document order) and syntax errors.  The caller
+     // then parses it normally, which will report any errors.
+    NOINLINE
+    const char* skip_compound (const char* in, u32 shallowth_, u32& size) {
+        if (!--shallowth_) return null;
+        bool object = *in == '{';
+        char close = object ? '}' : ']';
+        in = skip_ws(in + 1);
+        size = 0;
+        for (;;) {
+            if (in >= end) return null;
+            if (*in == close) return in + 1;
+            if (object) {
+                switch (char_props[u8(*in)] & CHAR_TERM_MASK) {
+                    case CHAR_TERM_STRING: in = skip_string(in); break;
+                    case CHAR_TERM_WORD: {
+                        const char* word_end = skip_word(in);
+                        if (!word_end) return null;
+                        Str word (in, word_end);
+                        if (word == "null" || word == "true" || word == "false") {
+                            return null;
+                        }
+                        in = word_end;
+                        break;
+                    }
+                    default: return null;
+                }
+                if (!in) return null;
+                in = skip_ws(in);
+                if (in >= end || *in != ':') return null;
+                in = skip_ws(in + 1);
+                if (in >= end) return null;
+            }
+            in = skip_term(in, shallowth_);
+            if (!in) return null;
+            size++;
+            in = skip_comma(in);
+        }
+    }
+
+    const char* skip_term (const char* in, u32 shallowth_) {
+        switch (char_props[u8(*in)] & CHAR_TERM_MASK) {
+            case CHAR_TERM_WORD: case CHAR_TERM_DIGIT: case CHAR_TERM_DOT:
+            case CHAR_TERM_PLUS: case CHAR_TERM_MINUS: return skip_word(in);
+            case CHAR_TERM_STRING: return skip_string(in);
+            case CHAR_TERM_ARRAY: case CHAR_TERM_OBJECT: {
+                u32 size;
+                return skip_compound(in, shallowth_, size);
+            }
+            default: return null;
+        }
+    }
+
+     // Mirrors parse_word
+    const char* skip_word (const char* in) {
+        in++;
+        for (;;) {
+            in = scan_word(in, end);
+            if (in >= end) return in;
+            else if (*in == ':') {
+                if (in + 1 < end && in[1] == ':') in += 2;
+                else return in;
+            }
+            else if (*in == '"') return null;
+            else return in;
+        }
+    }
+
+     // Mirrors got_string
+    const char* skip_string (const char* in) {
+        in++;
+        for (;;) {
+            in = scan_quoted(in, end);
+            if (in >= end) return null;
+            if (*in == '"') return in + 1;
+            in += 2;
+        }
+    }
+
+///// SHORTCUTS
+
+     // std::unordered_map is supposedly slow, so we'll use an array instead.
+     // We'll rethink if we ever need to parse a document with a large amount
+     // of shortcuts (I can't imagine for my use cases having more than 20
+     // or so).
+    UniqueArray<TreePair> shortcuts;
+
+    const char* parse_shortcut_name (const char* in, AnyString& r) {
+        Tree name;
+        auto end = parse_term(in, name);
+        if (name.form != Form::String) [[unlikely]] {
+            error(in, "Can't use non-string as shortcut name");
+        }
+        new (&r) AnyString(move(name));
+        return end;
+    }
+
+    NOINLINE static
+    const char* got_decl (Parser& self, const char* in, Tree& r) {
+        in++;  // for the &
+        {
+            AnyString name;
+            in = self.parse_shortcut_name(in, name);
+            for (auto& sc : self.shortcuts) {
+                if (sc.first == name) {
+                    self.error(in, cat("Multiple declarations of shortcut &", name));
+                }
+            }
+            in = self.skip_ws(in);
+            if (in < self.end && *in == ':') {
+                in++;
+                in = self.skip_ws(in);
+                Tree value;
+                in = self.parse_term(in, value);
+                self.shortcuts.emplace_back(move(name), move(value));
+                in = self.skip_comma(in);
+                 // Fall through
+            }
+            else {
+                in = self.parse_term(in, r);
+                self.shortcuts.emplace_back(move(name), r);
+                return in;
+            }
+        } // Destroy name and value so we can tail call parse_term.
+        return self.parse_term(in, r);
+    }
+
+    NOINLINE static
+    const char* got_shortcut (Parser& self, const char* in, Tree& r) {
+        in++;  // for the *
+        AnyString name;
+        in = self.parse_shortcut_name(in, name);
+        for (auto& sc : self.shortcuts) {
+            if (sc.first == name) {
+                new (&r) Tree(sc.second);
+                return in;
+            }
+        }
+        self.error(in, cat("Unknown shortcut *", name));
+    }
+
+///// NON-SEMANTIC CONTENT
+
+    const char* skip_comment (const char* in) {
+        in += 2;  // for two -s
+        auto lf = (const char*)std::memchr(in, '\n', end - in);
+        return lf ? lf + 1 : end;
+    }
+
+    NOINLINE const char* skip_ws (const char* in) {
+        for (;;) {
+            in = scan_ws(in, end);
+            if (in < end && *in == '-') [[unlikely]] {
+                if (in + 1 < end && in[1] == '-') {
+                    in = skip_comment(in);
+                }
+                else return in;
+            }
+            else return in;
+        }
+    }
+
+    NOINLINE const char* skip_comma (const char* in) {
+        in = skip_ws(in);
+        if (in < end && *in == ',') {
+            in = skip_ws(in + 1);
+        }
+        return in;
+    }
+
+///// ERRORS
+
+    [[gnu::cold]] NOINLINE
+    SourcePos get_source_pos (const char* p) {
+         // Diagnose line and column number
+         // I'm not sure the col is exactly right
+        u32 line = 1;
+        const char* last_lf = begin - 1;
+        for (const char* p2 = begin; p2 != p; p2++) {
+            if (*p2 == '\n') {
+                line++;
+                last_lf = p2;
+            }
+        }
+        u32 col = p - last_lf;
+        if (line == 1) col += base.col - 1;
+        return {line + base.line - 1, col};
+    };
+
+    [[gnu::cold]] NOINLINE static
+    const char* got_error (Parser& self, const char* in, Tree&) {
+        self.check_error_chars(in);
+        self.error(in, cat("Expected term but got ", *in));
+    }
+
+    [[gnu::cold]] NOINLINE
+    void check_error_chars (const char* in) {
+        if (*in <= ' ' || *in >= 127) {
+            error(in, cat(
+                "Unrecognized byte <", to_hex_digit(u8(*in) >> 4),
+                to_hex_digit(*in & 0xf), '>'
+            ));
+        }
+        switch (*in) {
+            case ANY_RESERVED_SYMBOL:
+                error(in, cat("Reserved symbol ", *in));
+            default: return;
+        }
+    }
+
+    [[noreturn, gnu::cold]] NOINLINE
+    void error (const char* in, Str mess) {
+        auto pos = get_source_pos(in);
+        raise(e_ParseFailed, cat(
+            mess, " at ", filename, ':', pos.line, ':', pos.col
+        ));
+    }
+};
+
+} // ayu::in
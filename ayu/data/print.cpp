@@ -16,6 +16,9 @@ struct Printer {
     char* end;
     PrintOptions opts;
     char* begin;
+     // If set, the buffer is flushed to this whenever it fills up instead of
+     // being grown.
+    const CallbackRef<void(Str)>* sink = null;
 
     Printer (PrintOptions f) : end(null), opts(f), begin(null) { }
 
@@ -28,6 +31,11 @@ struct Printer {
      // estimation gets complicated enough, it ends up slower than reallocating.
     NOINLINE
     char* extend (char* p, u32 more) {
+        if (sink && p != begin) {
+            (*sink)(Str(begin, p - begin));
+            p = begin;
+            if (p + more < end) return p;
+        }
         char* old_begin = begin;
         char* new_begin = SharableBuffer<char>::allocate_plenty(
             p - old_begin + more
@@ -151,7 +159,10 @@ struct Printer {
         }
 
         bool hex = !(opts % O::Json) && t.flags % TreeFlags::PreferHex;
-        if (hex) {
+        if (!hex) {
+            if (char* r = write_short_decimal(p, v)) return r;
+        }
+        else {
             if (v < 0) {
                 *p++ = '-';
                 v = -v;
@@ -452,6 +463,16 @@ struct Printer {
         begin = null;
         return r;
     }
+
+     // Only strings longer than the buffer will grow it.
+    void print_to_sink (const Tree& t, CallbackRef<void(Str)> cb, u32 cap) {
+        sink = &cb;
+        begin = SharableBuffer<char>::allocate(cap);
+        end = begin + SharableBuffer<char>::header(begin)->capacity;
+        char* p = print_tree(begin, t, 0);
+        if (opts % O::Pretty) p = pchar(p, '\n');
+        if (p != begin) cb(Str(begin, p - begin));
+    }
 };
 
 static void validate_print_options (PrintOptions opts) {
@@ -481,8 +502,26 @@ UniqueString tree_to_string_for_file (const Tree& t, PrintOptions opts) {
     return printer.print(t, 4064);
 }
 
+void tree_to_chunks (
+    const Tree& t, CallbackRef<void(Str)> cb, PrintOptions opts
+) {
+    validate_print_options(opts);
+    if (!(opts % O::Compact)) opts |= O::Pretty;
+    Printer printer (opts);
+    printer.print_to_sink(t, cb, 65536 - sizeof(SharableBufferHeader));
+}
+
+void tree_to_file (const Tree& t, File& file, PrintOptions opts) {
+    tree_to_chunks(t, [&file](Str chunk){ file.write(chunk); }, opts);
+}
+
 void tree_to_file (const Tree& t, AnyString filename, PrintOptions opts) {
-    return string_to_file(tree_to_string_for_file(t, opts), move(filename));
+     // Check the options before touching anything, and print to a temporary
+     // file, so that if printing fails the old file is still there.
+    validate_print_options(opts);
+    auto file = AtomicFile(move(filename));
+    tree_to_chunks(t, [&file](Str chunk){ file.write(chunk); }, opts);
+    file.commit();
 }
 
 } using namespace ayu;
@@ -533,6 +572,55 @@ static tap::TestSet tests ("dirt/ayu/data/print", []{
     test(tree_to_string(Tree(1.0)), "1", "Autointification small");
     test(tree_to_string(Tree(145.0)), "145", "Autointification large");
 
+    auto chunked = [&](PrintOptions opts){
+        UniqueString r;
+        usize max_chunk = 0;
+        tree_to_chunks(t, [&](Str chunk){
+            r.append(chunk);
+            if (chunk.size() > max_chunk) max_chunk = chunk.size();
+        }, opts);
+        ok(max_chunk <= 65536, "Chunks are no larger than the buffer");
+        return r;
+    };
+    test(chunked(O::Pretty), pretty, "Chunked Pretty");
+    test(chunked(O::Compact), compact, "Chunked Compact");
+    test(chunked(O::Pretty|O::Json), pretty_json, "Chunked Pretty Json");
+    test(chunked(O::Compact|O::Json), compact_json, "Chunked Compact Json");
+
+    UniqueArray<Tree> big_array;
+    for (u32 i = 0; i < 20000; i++) {
+        big_array.emplace_back(Tree::array(
+            Tree(i), Tree(cat("string number ", i)), Tree(i * 0.5)
+        ));
+    }
+    Tree big (move(big_array));
+    u32 chunks = 0;
+    UniqueString big_chunked;
+    tree_to_chunks(big, [&](Str chunk){
+        big_chunked.append(chunk);
+        chunks++;
+    });
+    ok(chunks > 1, "Large tree was printed in multiple chunks");
+    test(big_chunked, tree_to_string_for_file(big), "Chunked large tree");
+
+    auto huge_string = Tree(UniqueString(100000, 'x'));
+    UniqueString huge_chunked;
+    tree_to_chunks(huge_string, [&](Str chunk){ huge_chunked.append(chunk); });
+    test(huge_chunked, tree_to_string_for_file(huge_string),
+        "Chunked string larger than the buffer"
+    );
+
+    auto filename = resource_filename(IRI("ayu-test:/print-output.ayu"));
+    tree_to_file(big, filename);
+    is(string_from_file(filename), big_chunked, "tree_to_file");
+    throws_code<e_PrintOptionsInvalid>([&]{
+        tree_to_file(Tree(1), filename, PrintOptions(1 << 7));
+    }, "tree_to_file with invalid options throws");
+    is(string_from_file(filename), big_chunked,
+        "tree_to_file with invalid options leaves file alone"
+    );
+    remove_utf8(filename.c_str());
+
     done_testing();
 });
 #endif
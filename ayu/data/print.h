@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "../../uni/io.h"
 #include "../common.h"
 #include "tree.h"
 
@@ -26,7 +27,19 @@ DECLARE_ENUM_BITWISE_OPERATORS(PrintOptions)
 UniqueString tree_to_string (const Tree&, PrintOptions opts = {});
  // Like tree_to_string but uses defaults optimized for tree_to_file.
 UniqueString tree_to_string_for_file (const Tree&, PrintOptions opts = {});
- // calls tree_to_string_for_file and then string_to_file.
+ // Prints with the same defaults as tree_to_string_for_file, but instead of
+ // building the whole string, passes it to the callback a chunk at a time.
+ // Chunks are at most 64k unless a single string in the tree is longer than
+ // that, and are only valid until the callback returns.
+void tree_to_chunks (
+    const Tree&, CallbackRef<void(Str)>, PrintOptions opts = {}
+);
+ // Prints to a file a chunk at a time with tree_to_chunks, so the whole
+ // document never has to be in memory.
+void tree_to_file (const Tree&, File&, PrintOptions opts = {});
+ // The file is written under a temporary name and then renamed over the old
+ // one (see AtomicFile in uni/io.h), so if printing fails, the old file is left
+ // alone.
 void tree_to_file (const Tree&, AnyString filename, PrintOptions opts = {});
 
 constexpr ErrorCode e_PrintOptionsInvalid = "ayu::e_PrintOptionsInvalid";
@@ -1,6 +1,8 @@
 #include "tree.h"
 
 #include <cmath>
+#include <cstring>
+#include "../../uni/hash.h"
 #include "../reflection/describe.h"
 #include "../traversal/to-tree.h"
 
@@ -21,13 +23,67 @@ void check_uniqueness (u32 s, const TreePair* p) {
     } while (++a < e);
 }
 
+static u32* object_index (const TreePair* pairs, u32 size) {
+    return (u32*)const_cast<TreePair*>(pairs + size);
+}
+
+void index_object (AnyArray<TreePair>& v) {
+    u32 size = v.size();
+    expect(size >= min_indexed_object_size);
+    usize cap = size + object_index_pairs(size);
+     // If the buffer is shared but big enough, it's still safe to write to the
+     // spare capacity.  Any other tree sharing it will have already written
+     // the exact same index there, and arrays never write past their size into
+     // a buffer that isn't unique.
+    if (!v.owned()) {
+         // Static arrays have no header for reserve() to update, so copy into
+         // a new buffer instead.
+        auto copy = UniqueArray<TreePair>(Capacity(cap));
+        for (auto& p : v) copy.emplace_back_expect_capacity(p);
+        v = move(copy);
+    }
+    else if (v.capacity() < cap) v.reserve(cap);
+    auto pairs = v.data();
+    usize mask = object_index_slots(size) - 1;
+    u32* slots = object_index(pairs, size);
+    std::memset(slots, 0, (mask + 1) * sizeof(u32));
+    for (u32 i = 0; i < size; i++) {
+        Str key = pairs[i].first;
+        for (usize h = uni::hash(key) & mask;; h = (h + 1) & mask) {
+            if (!slots[h]) {
+                slots[h] = i + 1;
+                break;
+            }
+            if (pairs[slots[h] - 1].first == key) {
+                raise(e_TreeObjectKeyDuplicate, key);
+            }
+        }
+    }
+}
+
+const Tree* indexed_attr (const Tree& t, Str key) noexcept {
+    expect(t.size >= min_indexed_object_size);
+    auto pairs = t.data.as_object_ptr;
+    usize mask = object_index_slots(t.size) - 1;
+    u32* slots = object_index(pairs, t.size);
+     // The table is at most half full so this always terminates.
+    for (usize h = uni::hash(key) & mask;; h = (h + 1) & mask) {
+        u32 s = slots[h];
+        if (!s) return null;
+        if (pairs[s - 1].first == key) return &pairs[s - 1].second;
+    }
+}
+
 NOINLINE
 void delete_Tree_data (Tree& t) noexcept {
      // Manually delete all the elements.  We can't call UniqueArray's
      // destructor because we've already run the reference count down to 0, and
      // it debug-asserts that the reference count is 1.
     expect(t.owned);
-    if (t.form == Form::String) {
+    if (t.flags % TreeFlags::Lazy) [[unlikely]] {
+        delete_LazyTree(t);
+    }
+    else if (t.form == Form::String) {
         SharableBuffer<const char>::deallocate(t.data.as_char_ptr);
     }
     else if (t.form == Form::Array) {
@@ -98,22 +154,30 @@ static bool tree_eq_object (const Tree& a, const Tree& b) noexcept {
     if (a.size != b.size) return false;
      // This lets the compiler assume both loops run at least once.
     if (a.size == 0) return true;
-     // The same attributes can be in different orders, so just compare each
-     // attribute to each attribute for O(a.size * b.size).  In theory there are
-     // faster algorithms, but they either require storing extra data in the
-     // objects (which would break compatibility with AnyArray<TreePair>) or
-     // would only be worth it for very large objects.
+     // The same attributes can be in different orders.  Large objects have a
+     // hash index, so look each attribute up in that.
     auto ab = a.data.as_object_ptr;
     auto ae = ab + a.size;
+    if (b.size >= min_indexed_object_size) {
+        for (auto ap = ab; ap != ae; ap++) {
+            auto bv = indexed_attr(b, ap->first);
+            if (!bv || !(ap->second == *bv)) return false;
+        }
+        return true;
+    }
+     // For small objects just compare each attribute to each attribute for
+     // O(a.size * b.size).
     auto bb = b.data.as_object_ptr;
     auto be = bb + b.size;
     for (auto ap = ab; ap != ae; ap++) {
-        for (auto bp = bb; bp != be; bp++) {
+        auto bp = bb;
+        for (; bp != be; bp++) {
             if (ap->first == bp->first) {
                 if (ap->second == bp->second) break;
                 else return false;
             }
         }
+        if (bp == be) return false;
     }
     return true;
 }
@@ -129,14 +193,72 @@ static constexpr decltype(&tree_eq_false) tree_eqs [8] = {
     tree_eq_false
 };
 
+static bool tree_borrows (const Tree& t) noexcept {
+     // Lazy trees keep their whole source alive (which may be a file mapping),
+     // so treat them as borrowing too.
+    if (t.flags % (TreeFlags::Borrowed | TreeFlags::Lazy)) return true;
+    if (t.form == Form::Array) {
+        for (auto& e : Slice<Tree>(t)) {
+            if (tree_borrows(e)) return true;
+        }
+    }
+    else if (t.form == Form::Object) {
+        for (auto& [k, v] : Slice<TreePair>(t)) {
+            if (tree_borrows(v)) return true;
+        }
+    }
+    return false;
+}
+
+static Tree tree_unborrow_inner (const Tree& t) {
+    if (t.flags % TreeFlags::Lazy) {
+         // Parse a copy so that t is left as it is.  The parsed contents don't
+         // borrow, but they may have lazy trees of their own.
+        Tree parsed = t;
+        force_Tree(parsed);
+        return tree_unborrow_inner(parsed);
+    }
+    auto flags = t.flags & ~TreeFlags::Borrowed;
+    switch (t.form) {
+        case Form::String: return Tree(AnyString(t), flags);
+        case Form::Array: {
+            auto a = Slice<Tree>(t);
+            auto r = UniqueArray<Tree>(Capacity(a.size()));
+            for (auto& e : a) {
+                r.emplace_back_expect_capacity(tree_unborrow_inner(e));
+            }
+            return Tree(move(r), flags);
+        }
+        case Form::Object: {
+            auto o = Slice<TreePair>(t);
+            auto r = UniqueArray<TreePair>(Capacity(o.size()));
+            for (auto& [k, v] : o) {
+                r.emplace_back_expect_capacity(k, tree_unborrow_inner(v));
+            }
+            return Tree(move(r), flags);
+        }
+        default: return t;
+    }
+}
+
 } using namespace in;
 
 bool operator == (const Tree& a, const Tree& b) noexcept {
     if (a.form != b.form) return false;
     expect(u32(a.form) < 8);
+    if ((a.flags | b.flags) % TreeFlags::Lazy) [[unlikely]] {
+         // Treat unparseable trees like error trees
+        try { force_Tree(a); force_Tree(b); }
+        catch (...) { return false; }
+    }
     return in::tree_eqs[u32(a.form)](a, b);
 }
 
+Tree tree_unborrow (const Tree& t) {
+    if (!tree_borrows(t)) return t;
+    else return tree_unborrow_inner(t);
+}
+
 } using namespace ayu;
 
 AYU_DESCRIBE(ayu::Form,
@@ -156,7 +278,9 @@ AYU_DESCRIBE(ayu::Form,
  // we'll save that for when we need it.
 AYU_DESCRIBE(ayu::Tree,
     to_tree([](const Tree& v){ return v; }),
-    from_tree([](Tree& v, const Tree& t){ v = t; return true; })
+     // The tree we're given may be borrowing from a file that's about to be
+     // unmapped.
+    from_tree([](Tree& v, const Tree& t){ v = tree_unborrow(t); return true; })
 )
 
 #ifndef TAP_DISABLE_TESTS
@@ -194,6 +318,63 @@ static tap::TestSet tests ("dirt/ayu/data/tree", []{
         Tree::object(TreePair{"b", Tree(1)}, TreePair{"a", Tree(0)}, TreePair{"c", Tree(3)}),
         "Extra attribute in second object makes it unequal"
     );
+    isnt(
+        Tree::object(TreePair{"a", Tree(0)}, TreePair{"b", Tree(1)}),
+        Tree::object(TreePair{"b", Tree(1)}, TreePair{"c", Tree(0)}),
+        "Different keys make objects unequal"
+    );
+
+    auto big = [](u32 n, u32 offset){
+        UniqueArray<TreePair> pairs;
+        for (u32 i = 0; i < n; i++) {
+            u32 j = (i + offset) % n;
+            pairs.emplace_back(cat("key", j), Tree(j));
+        }
+        return Tree(move(pairs));
+    };
+    Tree b = big(1000, 0);
+    ok(b.attr("key0") && *b.attr("key0") == Tree(0), "Indexed attr finds first key");
+    ok(b.attr("key999") && *b.attr("key999") == Tree(999), "Indexed attr finds last key");
+    ok(!b.attr("key1000"), "Indexed attr doesn't find missing key");
+    ok(!b.attr(""), "Indexed attr doesn't find empty key");
+    is(b, big(1000, 437), "Large objects in different orders are equal");
+    isnt(b, big(999, 0), "Large objects of different sizes are unequal");
+    {
+        auto pairs = UniqueArray<TreePair>(Slice<TreePair>(b));
+        pairs[500].second = Tree(-1);
+        isnt(b, Tree(move(pairs)), "Large objects with different values are unequal");
+    }
+    {
+        auto pairs = UniqueArray<TreePair>(Slice<TreePair>(b));
+        pairs[500].first = "nope";
+        isnt(b, Tree(move(pairs)), "Large objects with different keys are unequal");
+    }
+    throws_code<e_TreeObjectKeyDuplicate>([&]{
+        auto pairs = UniqueArray<TreePair>(Slice<TreePair>(b));
+        pairs.emplace_back("key123", Tree(null));
+        Tree(move(pairs));
+    }, "Large objects reject duplicate keys");
+    {
+        auto shared = AnyArray<TreePair>(b);
+        Tree c (move(shared));
+        is(c.data.as_object_ptr, b.data.as_object_ptr,
+            "Indexing a shared object with enough capacity doesn't copy it"
+        );
+        ok(c.attr("key42") && *c.attr("key42") == Tree(42),
+            "Lookup in re-wrapped object works"
+        );
+    }
+    {
+        static const TreePair static_pairs [16] = {
+            {"a", Tree(0)}, {"b", Tree(1)}, {"c", Tree(2)}, {"d", Tree(3)},
+            {"e", Tree(4)}, {"f", Tree(5)}, {"g", Tree(6)}, {"h", Tree(7)},
+            {"i", Tree(8)}, {"j", Tree(9)}, {"k", Tree(10)}, {"l", Tree(11)},
+            {"m", Tree(12)}, {"n", Tree(13)}, {"o", Tree(14)}, {"p", Tree(15)},
+        };
+        auto s = Tree(AnyArray<TreePair>(StaticArray<TreePair>(static_pairs)));
+        ok(s.owned, "Large unowned objects are copied to make room for the index");
+        ok(s.attr("p") && *s.attr("p") == Tree(15), "Lookup in copied static object works");
+    }
     done_testing();
 });
 #endif
@@ -9,6 +9,7 @@
 #include "../common.internal.h"
 
 namespace ayu {
+namespace in { struct LazyTree; }
 
  // For unambiguity, types of trees are called forms.
 enum class Form : u8 {
@@ -42,10 +43,21 @@ enum class TreeFlags : u8 {
      // use some heuristics to decide which way to print it.  If both are set,
      // which one takes priority is unspecified.
     PreferExpanded = 0x4,
+     // For String: The characters are borrowed from a memory-mapped file (see
+     // tree_from_file_mapped in parse.h), and are only valid while the mapping
+     // is alive.  Converting to AnyString copies them, but copying the Tree
+     // doesn't.  This is set by the parser, not by you.
+    Borrowed = 0x40,
+     // For Array or Object: The contents haven't been parsed yet, and will be
+     // parsed the first time they're accessed (see tree_from_string_lazy in
+     // parse.h).  form and size are still valid.  This is set by the parser,
+     // not by you.
+    Lazy = 0x20,
      // For internal use only.  Ignore this.
     ValueIsPtr = 0x80,
 
-    ValidBits = PreferHex | PreferCompact | PreferExpanded | ValueIsPtr
+    ValidBits = PreferHex | PreferCompact | PreferExpanded | Borrowed
+              | Lazy | ValueIsPtr
 };
 DECLARE_ENUM_BITWISE_OPERATORS(TreeFlags)
 
@@ -98,7 +110,9 @@ struct Tree {
 
     explicit constexpr Tree (AnyArray<Tree>, TreeFlags = {});
      // This can throw e_TreeObjectKeyDuplicate.  Only truly constexpr if the
-     // passed array is empty.
+     // passed array is empty.  Objects with in::min_indexed_object_size or
+     // more attributes get a hash index stored in the unused capacity of their
+     // buffer, so this may reallocate the array to make room for it.
     explicit constexpr Tree (AnyArray<TreePair>, TreeFlags = {});
     explicit Tree (std::exception_ptr, TreeFlags = {});
 
@@ -134,7 +148,7 @@ struct Tree {
      // Warning 2: The Str will be invalidated when this Tree is destructed.
     explicit constexpr operator Str () const;
      // This AnyString will remain valid though.  It shares the same refcounting
-     // mechanism as Tree.
+     // mechanism as Tree (or is a copy if the tree is TreeFlags::Borrowed).
     explicit constexpr operator AnyString () const&;
     explicit constexpr operator AnyString () &&;
     explicit constexpr operator Slice<Tree> () const;
@@ -147,7 +161,8 @@ struct Tree {
 
     ///// CONVENIENCE
      // Returns null if the invocant is not an OBJECT or does not have an
-     // attribute with the given key.
+     // attribute with the given key.  This is a linear search for small
+     // objects and a hash lookup for large ones.
     constexpr const Tree* attr (Str key) const;
      // Returns null if the invocant is not an ARRAY or does not have an
      // element at the given index.
@@ -173,6 +188,7 @@ struct Tree {
         const Tree* as_array_ptr;
         const TreePair* as_object_ptr;
         const std::exception_ptr* as_error_ptr;
+        const in::LazyTree* as_lazy_ptr;
     } data;
 };
 
@@ -185,6 +201,13 @@ struct Tree {
  //    to themselves.
 bool operator == (const Tree& a, const Tree& b) noexcept;
 
+ // If any part of the tree is TreeFlags::Borrowed or TreeFlags::Lazy, returns a
+ // deep copy of it that doesn't borrow anything, with the lazy parts parsed.
+ // Otherwise just returns a copy of the tree.  Call this if a tree you were
+ // given (say, in a from_tree function) might need to outlive the file it was
+ // parsed from, or if it shouldn't keep that file's contents alive.
+Tree tree_unborrow (const Tree&);
+
  // Constrain to types that a Tree can be constructed from.  This is used in
  // value descriptors and attr_default.
 template <class T>
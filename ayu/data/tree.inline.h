@@ -14,9 +14,41 @@ static constexpr void check_form (const Tree& self, Form expected) {
     if (self.form != expected) in::raise_TreeWrongForm(self, expected);
 }
 
+ // These are defined in parse.cpp.  force_LazyTree replaces the tree in-place
+ // with its parsed contents, which is okay because the lazy stub is only an
+ // implementation detail, and trees can't be shared between threads anyway.
+NOINLINE
+void force_LazyTree (const Tree&);
+void delete_LazyTree (Tree&) noexcept;
+
+ // Call this before touching the data of an array or object.
+constexpr void force_Tree (const Tree& self) {
+    if (self.flags % TreeFlags::Lazy) [[unlikely]] force_LazyTree(self);
+}
+
  // Don't call with s<2!
 void check_uniqueness (u32 s, const TreePair* p);
 
+ // Objects at least this large are given a hash index, which lives after the
+ // attributes in the object's buffer.  It's an open-addressed table of u32
+ // attribute indexes plus one (0 is an empty slot), at most half full.
+constexpr u32 min_indexed_object_size = 16;
+
+constexpr usize object_index_slots (u32 size) {
+    return std::bit_ceil(usize(size) * 2);
+}
+ // How many TreePairs worth of capacity the index takes up.
+constexpr usize object_index_pairs (u32 size) {
+    return (object_index_slots(size) * sizeof(u32) + sizeof(TreePair) - 1)
+         / sizeof(TreePair);
+}
+
+ // Makes sure the array has room for the index after its elements, then builds
+ // it, throwing e_TreeObjectKeyDuplicate if any keys are the same.
+void index_object (AnyArray<TreePair>&);
+ // Don't call with objects smaller than min_indexed_object_size!
+const Tree* indexed_attr (const Tree&, Str key) noexcept;
+
 } // in
 
 constexpr Tree::Tree () :
@@ -64,11 +96,16 @@ constexpr Tree::Tree (AnyArray<TreePair> v, TreeFlags f) :
     owned(v.owned()), size(v.size()),
     data{.as_object_ptr = v.impl.data}
 {
-    if (size > 1) {
-         // Check for duplicate keys.  Exceptions in constructors do not trigger
-         // destructors, so we don't need to clean up our data members.  NOTE:
-         // If we move the data members to a subclass then we WILL need to clean
-         // them up!
+     // Check for duplicate keys.  Exceptions in constructors do not trigger
+     // destructors, so we don't need to clean up our data members.  NOTE: If
+     // we move the data members to a subclass then we WILL need to clean them
+     // up!
+    if (size >= in::min_indexed_object_size) {
+        in::index_object(v);
+        owned = true;
+        data.as_object_ptr = v.impl.data;
+    }
+    else if (size > 1) {
         in::check_uniqueness(size, data.as_object_ptr);
     }
     v.impl = {};
@@ -191,6 +228,9 @@ constexpr Tree::operator Str () const {
 }
 constexpr Tree::operator AnyString () const& {
     in::check_form(*this, Form::String);
+    if (flags % TreeFlags::Borrowed) [[unlikely]] {
+        return AnyString(Str(data.as_char_ptr, size));
+    }
     if (owned) {
         ++SharableBuffer<char>::header(data.as_char_ptr)->ref_count;
     }
@@ -201,6 +241,9 @@ constexpr Tree::operator AnyString () const& {
 }
 constexpr Tree::operator AnyString () && {
     in::check_form(*this, Form::String);
+    if (flags % TreeFlags::Borrowed) [[unlikely]] {
+        return AnyString(Str(data.as_char_ptr, size));
+    }
     AnyString r;
     r.impl.sizex2_with_owned = (size << 1) | owned;
     r.impl.data = const_cast<char*>(data.as_char_ptr);
@@ -209,10 +252,12 @@ constexpr Tree::operator AnyString () && {
 }
 constexpr Tree::operator Slice<Tree> () const {
     in::check_form(*this, Form::Array);
+    in::force_Tree(*this);
     return Slice<Tree>(data.as_array_ptr, size);
 }
 constexpr Tree::operator AnyArray<Tree> () const& {
     in::check_form(*this, Form::Array);
+    in::force_Tree(*this);
     if (owned) {
         ++SharableBuffer<Tree>::header(data.as_array_ptr)->ref_count;
     }
@@ -223,6 +268,7 @@ constexpr Tree::operator AnyArray<Tree> () const& {
 }
 constexpr Tree::operator AnyArray<Tree> () && {
     in::check_form(*this, Form::Array);
+    in::force_Tree(*this);
     AnyArray<Tree> r;
     r.impl.sizex2_with_owned = (size << 1) | owned;
     r.impl.data = const_cast<Tree*>(data.as_array_ptr);
@@ -231,10 +277,12 @@ constexpr Tree::operator AnyArray<Tree> () && {
 }
 constexpr Tree::operator Slice<TreePair> () const {
     in::check_form(*this, Form::Object);
+    in::force_Tree(*this);
     return Slice<TreePair>(data.as_object_ptr, size);
 }
 constexpr Tree::operator AnyArray<TreePair> () const& {
     in::check_form(*this, Form::Object);
+    in::force_Tree(*this);
     if (owned) {
         ++SharableBuffer<TreePair>::header(data.as_object_ptr)->ref_count;
     }
@@ -245,6 +293,7 @@ constexpr Tree::operator AnyArray<TreePair> () const& {
 }
 constexpr Tree::operator AnyArray<TreePair> () && {
     in::check_form(*this, Form::Object);
+    in::force_Tree(*this);
     AnyArray<TreePair> r;
     r.impl.sizex2_with_owned = (size << 1) | owned;
     r.impl.data = const_cast<TreePair*>(data.as_object_ptr);
@@ -258,6 +307,10 @@ inline Tree::operator std::exception_ptr () const {
 
 constexpr const Tree* Tree::attr (Str key) const {
     in::check_form(*this, Form::Object);
+    in::force_Tree(*this);
+    if (size >= in::min_indexed_object_size) {
+        return in::indexed_attr(*this, key);
+    }
     for (auto& p : Slice<TreePair>(*this)) {
         if (p.first == key) return &p.second;
     }
@@ -0,0 +1,330 @@
+#include "archive.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "../../iri/path.h"
+#include "../../uni/io.h"
+
+namespace ayu {
+namespace in {
+
+static constexpr usize archive_header_size = 16;
+static constexpr usize archive_entry_size = 24;
+
+[[noreturn, gnu::cold]]
+static void raise_ArchiveInvalid (Str filename, Str why) {
+    raise(e_ResourceArchiveInvalid, cat(
+        "Invalid resource archive ", filename, ": ", why
+    ));
+}
+
+static u64 read_archive_int (Str data, usize offset, usize size) {
+    expect(offset + size <= data.size());
+    u64 r = 0;
+    for (usize i = 0; i < size; i++) {
+        r |= u64(u8(data[offset + i])) << (i * 8);
+    }
+    return r;
+}
+
+static void write_archive_int (UniqueString& out, u64 v, usize size) {
+    for (usize i = 0; i < size; i++) out.push_back(char(v >> (i * 8)));
+}
+
+struct ArchiveEntry {
+    u64 data_offset;
+    u64 data_size;
+    u32 name_offset;
+    u32 name_size;
+};
+
+static ArchiveEntry read_archive_entry (Str data, u32 index) {
+    usize at = archive_header_size + usize(index) * archive_entry_size;
+    return ArchiveEntry{
+        read_archive_int(data, at, 8),
+        read_archive_int(data, at + 8, 8),
+        u32(read_archive_int(data, at + 16, 4)),
+        u32(read_archive_int(data, at + 20, 4)),
+    };
+}
+
+static Str archive_entry_name (Str data, const ArchiveEntry& e) {
+    return data.slice(e.name_offset, e.name_offset + e.name_size);
+}
+
+ // Lexicographic byte comparison, so that the order doesn't depend on the
+ // signedness of char.
+static bool archive_name_less (Str a, Str b) {
+    usize n = std::min(a.size(), b.size());
+    int c = n ? std::memcmp(a.data(), b.data(), n) : 0;
+    return c ? c < 0 : a.size() < b.size();
+}
+
+struct ArchiveFile {
+    UniqueString name;
+    UniqueString path;
+    u64 size;
+};
+
+static void find_archive_files (
+    UniqueArray<ArchiveFile>& files, Dir& dir, Str path, Str name
+) {
+    for (Str child : dir) {
+        if (child == "." || child == "..") continue;
+        auto child_path = cat(path, '/', child);
+        auto child_name = cat(name, '/', child);
+        Dir sub = Dir::try_open_at(dir.fd, child);
+        if (sub) {
+            find_archive_files(files, sub, child_path, child_name);
+            continue;
+        }
+        if (errno != ENOTDIR) sub.raise_open_failed(child_path);
+        if (iri::path_extension(child) == "ayua") continue;
+        uni::FileInfo info;
+        if (!uni::stat_utf8(child_path.c_str(), info)) {
+            raise(e_OpenFailed, cat("Failed to stat ", child_path));
+        }
+        files.push_back(ArchiveFile{
+            move(child_name), move(child_path), info.size
+        });
+    }
+}
+
+} using namespace in;
+
+ArchiveResourceScheme::ArchiveResourceScheme (
+    AnyString n, AnyString archive_filename, bool auto_activate
+) :
+    ResourceScheme(move(n), false),
+    mapping(mapping_from_file(archive_filename))
+{
+    Str data = mapping.contents();
+    if (data.size() < archive_header_size || data.slice(0, 4) != "ayua") {
+        raise_ArchiveInvalid(archive_filename, "missing header");
+    }
+    u32 version = read_archive_int(data, 4, 4);
+    if (version != archive_version) {
+        raise_ArchiveInvalid(archive_filename,
+            cat("unsupported version ", version)
+        );
+    }
+    count = read_archive_int(data, 8, 4);
+    if ((data.size() - archive_header_size) / archive_entry_size < count) {
+        raise_ArchiveInvalid(archive_filename, "index runs past end");
+    }
+     // Check everything up front, so that get_source doesn't have to.
+    Str prev;
+    for (u32 i = 0; i < count; i++) {
+        auto e = read_archive_entry(data, i);
+        if (e.name_offset > data.size()
+            || data.size() - e.name_offset < e.name_size
+            || e.data_offset > data.size()
+            || data.size() - e.data_offset < e.data_size
+        ) {
+            raise_ArchiveInvalid(archive_filename,
+                cat("entry ", i, " is out of range")
+            );
+        }
+        Str name = archive_entry_name(data, e);
+        if (i && !archive_name_less(prev, name)) {
+            raise_ArchiveInvalid(archive_filename, "index isn't sorted");
+        }
+        prev = name;
+    }
+    if (auto_activate) activate();
+}
+
+Str ArchiveResourceScheme::entry_name (u32 index) const {
+    require(index < count);
+    Str data = mapping.contents();
+    return archive_entry_name(data, read_archive_entry(data, index));
+}
+
+ResourceSource ArchiveResourceScheme::get_source (const IRI& iri) const {
+    Str data = mapping.contents();
+    auto name = iri::decode_path(iri.path());
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        auto e = read_archive_entry(data, mid);
+        Str mid_name = archive_entry_name(data, e);
+        if (archive_name_less(mid_name, name)) lo = mid + 1;
+        else if (archive_name_less(name, mid_name)) hi = mid;
+        else return ResourceSource{
+            mapping, data.slice(e.data_offset, e.data_offset + e.data_size)
+        };
+    }
+    return {};
+}
+
+void write_resource_archive (
+    const FolderResourceScheme& scheme, AnyString archive_filename
+) {
+    auto folder = iri::to_fs_path(scheme.folder);
+    Str root = iri::path_chop_last_slash(folder);
+    UniqueArray<ArchiveFile> files;
+    Dir dir (root);
+    find_archive_files(files, dir, root, "");
+    std::sort(files.begin(), files.end(),
+        [](const ArchiveFile& a, const ArchiveFile& b){
+            return archive_name_less(a.name, b.name);
+        }
+    );
+    require(files.size() <= u32(-1));
+
+    UniqueString head;
+    head.append("ayua");
+    write_archive_int(head, archive_version, 4);
+    write_archive_int(head, files.size(), 4);
+    write_archive_int(head, 0, 4);
+    usize names_offset = archive_header_size
+                       + files.size() * archive_entry_size;
+    usize names_size = 0;
+    for (auto& f : files) names_size += f.name.size();
+    require(names_offset + names_size <= u32(-1));
+    u64 name_at = names_offset;
+    u64 data_at = names_offset + names_size;
+    for (auto& f : files) {
+        write_archive_int(head, data_at, 8);
+        write_archive_int(head, f.size, 8);
+        write_archive_int(head, name_at, 4);
+        write_archive_int(head, f.name.size(), 4);
+        name_at += f.name.size();
+        data_at += f.size;
+    }
+    for (auto& f : files) head.append(f.name);
+
+    AtomicFile out (move(archive_filename));
+    out.write(head);
+    for (auto& f : files) {
+        auto contents = string_from_file(f.path);
+        if (contents.size() != f.size) {
+            raise(e_ReadFailed, cat(f.path, " changed while building archive"));
+        }
+        out.write(contents);
+    }
+    out.commit();
+}
+
+} using namespace ayu;
+
+#ifndef TAP_DISABLE_TESTS
+#include <filesystem>
+#include "../../uni/time.h"
+#include "../test/test-environment.private.h"
+#include "../reflection/describe-standard.h"
+#include "../traversal/to-tree.h"
+#include "resource.h"
+
+static tap::TestSet tests ("dirt/ayu/resources/archive", []{
+    using namespace tap;
+    test::TestEnvironment env;
+    auto folder = iri::to_fs_path(env.trs->folder);
+    auto archive_filename = cat(folder, "test-archive.ayua");
+
+    doesnt_throw([&]{ write_resource_archive(*env.trs, archive_filename); },
+        "write_resource_archive"
+    );
+    {
+        ArchiveResourceScheme scheme ("ayu-archive", archive_filename);
+        ok(scheme.count > 0, "Archive has entries");
+        bool sorted = true;
+        for (u32 i = 1; i < scheme.count; i++) {
+            if (!archive_name_less(
+                scheme.entry_name(i - 1), scheme.entry_name(i)
+            )) {
+                sorted = false;
+            }
+        }
+        ok(sorted, "Archive index is sorted");
+
+        auto source = scheme.get_source(IRI("ayu-archive:/testfile.ayu"));
+        Str contents = scheme.mapping.contents();
+        ok(source.contents.begin() >= contents.begin()
+            && source.contents.end() <= contents.end(),
+            "Source points into archive mapping"
+        );
+        is(source.contents, string_from_file(cat(folder, "testfile.ayu")),
+            "Source has file's contents"
+        );
+        ok(!scheme.get_source(IRI("ayu-archive:/nope.ayu")).mapping,
+            "Missing entry has no source"
+        );
+
+        SharedResource packed (IRI("ayu-archive:/othertest.ayu"));
+        SharedResource loose (IRI("ayu-test:/othertest.ayu"));
+        doesnt_throw([&]{ load(packed); }, "Load resource from archive");
+         // Print with routes so references to other resources are relative.
+        is(item_to_tree(packed->ref(), SharedRoute(packed)),
+            item_to_tree(loose->ref(), SharedRoute(loose)),
+            "Resource from archive matches original"
+        );
+        is(packed["ext_ref"][1].get_as<AnyRef>().address_as<i32>(),
+            SharedResource(IRI("ayu-archive:/testfile.ayu"))["foo"][1]
+                .address_as<i32>(),
+            "References inside archive resolve to archive"
+        );
+        ok(source_exists(IRI("ayu-archive:/ユニコード.ayu")),
+            "source_exists for archive entry with non-ASCII name"
+        );
+        load(SharedResource(IRI("ayu-archive:/ユニコード.ayu")));
+        unload(packed);
+        unload(loose);
+        unload();
+    }
+    remove_utf8(archive_filename.c_str());
+
+    string_to_file("not an archive", archive_filename);
+    throws_code<e_ResourceArchiveInvalid>([&]{
+        ArchiveResourceScheme("ayu-archive", archive_filename);
+    }, "Invalid archive is rejected");
+    remove_utf8(archive_filename.c_str());
+
+    {
+        constexpr u32 n = 1000;
+        auto bench = cat(folder, "archive-bench");
+        std::filesystem::create_directories(bench.c_str());
+        for (u32 i = 0; i < n; i++) {
+            string_to_file(
+                cat("[ayu::Document {n:[i32 ", i, "] _next_id:0}]"),
+                cat(bench, '/', i, ".ayu")
+            );
+        }
+        auto bench_scheme = test::TestResourceScheme(
+            "ayu-archive-bench", bench
+        );
+        auto bench_archive = cat(folder, "bench.ayua");
+        write_resource_archive(bench_scheme, bench_archive);
+        ArchiveResourceScheme scheme ("ayu-archive", bench_archive);
+        is(scheme.count, n, "Archive has all files from folder");
+
+        auto load_all = [&](Str scheme_name){
+            UniqueArray<SharedResource> reses;
+            for (u32 i = 0; i < n; i++) {
+                reses.emplace_back(IRI(cat(scheme_name, ":/", i, ".ayu")));
+            }
+            double start = uni::steady_clock();
+            for (auto& res : reses) load(res);
+            double time = uni::steady_clock() - start;
+            bool right = true;
+            for (u32 i = 0; i < n; i++) {
+                if (reses[i]["n"][1].get_as<i32>() != i32(i)) right = false;
+            }
+            for (auto& res : reses) unload(res);
+            return right ? time : -1;
+        };
+        double loose_time = load_all("ayu-archive-bench");
+        double packed_time = load_all("ayu-archive");
+        ok(loose_time >= 0 && packed_time >= 0,
+            "Loaded the same resources from folder and archive"
+        );
+        diag(cat("Loaded ", n, " resources from files in ",
+            loose_time * 1000, "ms and from archive in ",
+            packed_time * 1000, "ms"
+        ));
+        std::filesystem::remove_all(bench.c_str());
+        remove_utf8(bench_archive.c_str());
+    }
+    done_testing();
+});
+#endif
@@ -0,0 +1,61 @@
+// An archive packs many resource files into one file, so that loading them
+// takes one mapping instead of opening and reading each file separately.  This
+// helps a lot on slow (especially network) filesystems.  Files in the archive
+// are stored unchanged, so text resources are still parsed (without copying
+// strings), and .ayub resources are still decoded from the binary format.
+//
+// All integers are little-endian.  Offsets are from the start of the archive.
+//     header: "ayua" u32(version) u32(count) u32(0)
+//     index: [u64(data offset) u64(data size) u32(name offset) u32(name size)]...
+//     names: name bytes...
+//     data: file contents...
+// Names are paths relative to the folder the archive was built from, starting
+// with a /, and are not %-encoded.  The index is sorted by name (comparing
+// bytes) so it can be binary searched.
+//
+// Archives are read-only, so resources from an ArchiveResourceScheme can't be
+// saved.
+
+#pragma once
+#include "../common.h"
+#include "scheme.h"
+
+namespace ayu {
+
+constexpr u32 archive_version = 1;
+
+ // Serves resources from an archive.  The archive is mapped into memory and
+ // its index is checked when this is constructed, and it stays mapped until
+ // this is destroyed (or longer, if loaded resources' trees still refer to
+ // it).
+struct ArchiveResourceScheme : ResourceScheme {
+    SharedMapping mapping;
+    u32 count;
+
+    ArchiveResourceScheme (
+        AnyString name, AnyString archive_filename, bool auto_activate = true
+    );
+
+    bool accepts_name (const IRI& iri) const override {
+        return !iri.has_authority() && !iri.has_query()
+            && iri.hierarchical();
+    }
+
+    ResourceSource get_source (const IRI&) const override;
+
+     // Returns the name of the entry at this index in the archive's index.
+    Str entry_name (u32 index) const;
+};
+
+ // Builds an archive out of every file in a FolderResourceScheme's folder and
+ // its subfolders, except for files ending in .ayua (so the archive can be
+ // kept in the folder it's built from).  The archive is written atomically (see
+ // uni::AtomicFile).
+void write_resource_archive (
+    const FolderResourceScheme&, AnyString archive_filename
+);
+
+ // The archive file is malformed or has an unsupported version.
+constexpr ErrorCode e_ResourceArchiveInvalid = "ayu::e_ResourceArchiveInvalid";
+
+} // namespace ayu
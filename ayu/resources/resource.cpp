@@ -1,6 +1,15 @@
 #include "resource.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
 #include "../../iri/iri.h"
+#include "../../uni/lilac.h"
 #include "../../uni/io.h"
+#include "../data/binary.h"
 #include "../data/parse.h"
 #include "../data/print.h"
 #include "../reflection/anyref.h"
@@ -110,7 +119,9 @@ struct ROV {
     void rollback () {
         auto data = static_cast<ResourceData*>(res.data.p);
         data->value = move(old_value);
+        data->forget_value_caches();
         data->state = RS::Loaded;
+        universe().resource_graph_dirty = true;
     }
 };
 
@@ -127,9 +138,10 @@ ResourceState Resource::state () const noexcept {
 
 AnyVal& Resource::value () {
     auto data = static_cast<ResourceData*>(this);
-    if (data->state == RS::Unloaded) {
+    if (data->state == RS::Unloaded || data->state == RS::LoadPending) {
         load(ResourceRef(this));
     }
+    data->last_used = ++universe().use_clock;
     return data->value;
 }
 AnyVal& Resource::get_value () noexcept {
@@ -139,7 +151,7 @@ AnyVal& Resource::get_value () noexcept {
 void Resource::set_value (AnyVal&& value) {
     auto data = static_cast<ResourceData*>(this);
     AnyVal v = move(value);
-    if (data->state == RS::Loading) {
+    if (data->state == RS::Loading || data->state == RS::LoadPending) {
         raise_ResourceStateInvalid("set_value", this);
     }
     if (!v) {
@@ -161,7 +173,9 @@ void Resource::set_value (AnyVal&& value) {
             void rollback () noexcept override {
                 auto data = static_cast<ResourceData*>(res.data.p);
                 data->value = move(old_value);
+                data->forget_value_caches();
                 data->state = data->value ?  RS::Loaded : RS::Unloaded;
+                universe().resource_graph_dirty = true;
             }
         };
         ResourceTransaction::add_committer(
@@ -169,7 +183,13 @@ void Resource::set_value (AnyVal&& value) {
         );
     }
     data->value = move(v);
+    data->forget_value_caches();
     data->state = RS::Loaded;
+     // We don't know what references the new value has.
+    data->refs_out = {};
+    universe().resource_graph_dirty = true;
+    universe().load_count++;
+    data->last_used = ++universe().use_clock;
 }
 
 AnyRef Resource::operator[] (const AnyString& key) { return ref()[key]; }
@@ -211,31 +231,63 @@ void in::delete_Resource_if_unloaded (Resource* res) noexcept {
 static void load_cancel (ResourceRef res) {
     auto data = static_cast<ResourceData*>(res.data);
     data->value = {};
+    data->forget_value_caches();
     data->state = RS::Unloaded;
+    data->refs_out = {};
+     // Other resources that were loading at the same time may have recorded
+     // references to this one.
+    universe().resource_graph_dirty = true;
 }
 
-void load (ResourceRef res) {
-    auto data = static_cast<ResourceData*>(res.data);
-    if (data->state != RS::Unloaded) return;
+ // Parses a source from ResourceScheme::get_source.  Strings borrow from the
+ // source, and its mapping is moved into the result, so this doesn't touch the
+ // mapping's (non-threadsafe) reference count and can run on any thread.
+static MappedTree read_resource_source (
+    ResourceSource& source, bool binary, Str filename
+) {
+    MappedTree r;
+    r.tree = binary ? BinaryView(source.contents).decode(true)
+                    : tree_from_string_borrowed(source.contents, filename);
+    r.mapping = move(source.mapping);
+    return r;
+}
 
-    data->state = RS::Loading;
-    try {
-        auto scheme = universe().require_scheme(data->name);
-        auto filename = scheme->get_file(data->name);
-        Tree tree = tree_from_file(move(filename));
-        auto tnt = verify_tree_for_scheme(res, scheme, tree);
-         // Run item_from_tree on the AnyVal's value, not on the AnyVal
-         // itself.  Otherwise, the associated locations will have an extra +1
-         // in the fragment.
-        expect(!data->value);
-        data->value = AnyVal(tnt.type);
-        item_from_tree(
-            data->value.ptr(), tnt.tree, SharedRoute(res),
-            FromTreeOptions::DelaySwizzle
-        );
+static MappedTree read_resource_file (
+    const ResourceScheme* scheme, const IRI& name
+) {
+    bool binary = scheme->get_format(name) == ResourceFormat::Binary;
+    if (auto source = scheme->get_source(name); source.mapping) {
+        return read_resource_source(source, binary, name.spec());
     }
-    catch (...) { load_cancel(res); throw; }
+    auto filename = scheme->get_file(name);
+    if (binary) {
+        return tree_from_binary_file_mapped(move(filename));
+    }
+    else if (auto cache = scheme->get_cache_file(name)) {
+        return tree_from_file_cached(move(filename), move(cache));
+    }
+    else return tree_from_file_mapped(move(filename), true);
+}
 
+static void load_from_tree (
+    ResourceRef res, const ResourceScheme* scheme, const Tree& tree
+) {
+    auto data = static_cast<ResourceData*>(res.data);
+    auto tnt = verify_tree_for_scheme(res, scheme, tree);
+     // Run item_from_tree on the AnyVal's value, not on the AnyVal itself.
+     // Otherwise, the associated locations will have an extra +1 in the
+     // fragment.
+    expect(!data->value);
+    data->value = AnyVal(tnt.type);
+    data->forget_value_caches();
+    item_from_tree(
+        data->value.ptr(), tnt.tree, SharedRoute(res),
+        FromTreeOptions::DelaySwizzle
+    );
+}
+
+static void load_commit (ResourceRef res) {
+    auto data = static_cast<ResourceData*>(res.data);
     if (ResourceTransaction::depth) {
         struct LoadCommitter : Committer {
             SharedResource res;
@@ -249,52 +301,479 @@ void load (ResourceRef res) {
         );
     }
     data->state = RS::Loaded;
+    data->last_used = ++universe().use_clock;
+    universe().load_count++;
 }
 
-void save (ResourceRef res, PrintOptions opts) {
+namespace in { static void finish_async_load (ResourceRef); }
+
+void load (ResourceRef res) {
     auto data = static_cast<ResourceData*>(res.data);
+    if (data->state == RS::LoadPending) return finish_async_load(res);
+    if (data->state != RS::Unloaded) return;
+
+    data->state = RS::Loading;
+    try {
+        auto scheme = universe().require_scheme(data->name);
+         // Strings borrow from the mapped file, and get copied as they're
+         // deserialized.  The mapping is released at the end of this scope.
+        auto mapped = read_resource_file(scheme, data->name);
+        load_from_tree(res, scheme, mapped.tree);
+    }
+    catch (...) { load_cancel(res); throw; }
+    load_commit(res);
+}
+
+namespace in {
+
+struct LoadJob {
+    ResourceRef res;
+    const ResourceScheme* scheme;
+    AnyString filename;
+    AnyString cache_filename;
+     // If the scheme provides this, filename is just for error messages.
+    ResourceSource source;
+    bool binary;
+     // Accessed through std::atomic_ref, because UniqueArray needs its
+     // elements to be movable.
+    bool ready = false;
+    MappedTree mapped;
+    std::exception_ptr error;
+};
+
+ // Asks the scheme where the resource comes from.  Schemes aren't necessarily
+ // thread-safe, so this has to be called on the main thread.
+static void set_load_job_source (
+    LoadJob& job, const ResourceScheme* scheme, const IRI& name
+) {
+    job.binary = scheme->get_format(name) == ResourceFormat::Binary;
+    job.source = scheme->get_source(name);
+    if (job.source.mapping) {
+        job.filename = name.spec();
+        return;
+    }
+    job.filename = scheme->get_file(name);
+    job.cache_filename = scheme->get_cache_file(name);
+}
+
+static void read_load_job_source (LoadJob& job) noexcept {
+    try {
+         // Parse eagerly, since the point is to get the parsing done on this
+         // thread instead of the main thread.
+        job.mapped = job.source.mapping
+                ? read_resource_source(job.source, job.binary, job.filename)
+            : job.binary ? tree_from_binary_file_mapped(job.filename)
+            : job.cache_filename
+                ? tree_from_file_cached(job.filename, job.cache_filename)
+                : tree_from_file_mapped(job.filename);
+    }
+    catch (...) { job.error = std::current_exception(); }
+}
+
+static void set_load_job_ready (LoadJob& job) noexcept {
+    auto ready = std::atomic_ref(job.ready);
+    ready.store(true, std::memory_order_release);
+    ready.notify_one();
+}
+
+static void read_load_job (LoadJob& job) noexcept {
+    read_load_job_source(job);
+    set_load_job_ready(job);
+}
+
+ // Runs work(job) on worker threads for each job, handing out jobs in order.
+ // Stops handing out jobs and waits for the workers when destroyed.
+template <class Job>
+struct Workers {
+    UniqueArray<Job>& jobs;
+    std::atomic<usize> next = 0;
+    UniqueArray<std::thread> threads;
+
+    template <class F>
+    Workers (UniqueArray<Job>& j, u32 n_threads, F work) : jobs(j) {
+        threads = UniqueArray<std::thread>(Capacity(n_threads));
+         // lilac is single-threaded.  See parse_list_parallel.
+        lilac::MallocScope malloc_scope;
+        for (u32 t = 0; t < n_threads; t++) {
+            threads.emplace_back_expect_capacity([this, work]{
+                lilac::MallocScope malloc_scope;
+                for (;;) {
+                    usize i = next.fetch_add(1, std::memory_order_relaxed);
+                    if (i >= jobs.size()) break;
+                    work(jobs[i]);
+                }
+            });
+        }
+    }
+
+    ~Workers () {
+        next.store(jobs.size(), std::memory_order_relaxed);
+        for (auto& t : threads) t.join();
+    }
+};
+
+} // in
+
+void load (Slice<ResourceRef> reses, u32 threads) {
+    ResourceTransaction tr;
+     // Ask the schemes where everything is first, since they may not be
+     // thread-safe.
+    UniqueArray<LoadJob> jobs (Capacity(reses.size()));
+    for (auto res : reses) {
+        auto data = static_cast<ResourceData*>(res.data);
+        if (data->state == RS::LoadPending) finish_async_load(res);
+        if (data->state != RS::Unloaded) continue;
+        auto scheme = universe().require_scheme(data->name);
+        auto& job = jobs.emplace_back_expect_capacity();
+        job.res = res;
+        job.scheme = scheme;
+        set_load_job_source(job, scheme, data->name);
+    }
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (threads <= 1 || jobs.size() <= 1) {
+        for (auto& job : jobs) load(job.res);
+        return;
+    }
+     // Files are read and parsed on the workers, but deserialization has to
+     // happen here, in order, because it can touch anything.
+    Workers workers (
+        jobs, std::min<usize>(threads, jobs.size()), read_load_job
+    );
+    for (auto& job : jobs) {
+        std::atomic_ref(job.ready).wait(false, std::memory_order_acquire);
+        auto data = static_cast<ResourceData*>(job.res.data);
+         // Deserializing an earlier resource may have loaded this one already
+         // (or it may have been listed twice).
+        if (data->state != RS::Unloaded) {
+            job.mapped = {};
+            continue;
+        }
+        if (job.error) std::rethrow_exception(move(job.error));
+        data->state = RS::Loading;
+        try { load_from_tree(job.res, job.scheme, job.mapped.tree); }
+        catch (...) { load_cancel(job.res); throw; }
+        load_commit(job.res);
+         // Release the mapping as soon as we're done with it.
+        job.mapped = {};
+    }
+}
+
+namespace in {
+
+struct AsyncLoad {
+     // Keeps the resource from being deleted while it's pending.
+    SharedResource handle;
+    LoadJob job;
+     // Set (with the mutex locked) by whichever thread reads the file.
+    bool taken = false;
+     // Set by force_unload.  The job is still deleted by the main thread.
+    bool cancelled = false;
+};
+
+struct AsyncLoader {
+    std::mutex mutex;
+    std::condition_variable cv;
+     // Loads waiting for the background thread.  Only the main thread changes
+     // the array itself, since lilac can't allocate from the background
+     // thread.  The background thread just advances queue_next.
+    UniqueArray<AsyncLoad*> queue;
+    usize queue_next = 0;
+     // Unfinished loads in the order they were started.  Only accessed by the
+     // main thread.
+    UniqueArray<AsyncLoad*> pending;
+    std::thread thread;
+
+    void run () {
+        lilac::MallocScope malloc_scope;
+        std::unique_lock lock (mutex);
+        for (;;) {
+            cv.wait(lock, [this]{ return queue_next < queue.size(); });
+            AsyncLoad* load = queue[queue_next++];
+             // Taken by the main thread, which may have deleted it already.
+            if (!load) continue;
+            load->taken = true;
+            lock.unlock();
+            read_load_job_source(load->job);
+            lock.lock();
+             // The main thread may delete the load as soon as it sees that it's
+             // ready, so only say so while holding the mutex.  See
+             // delete_async_load.
+            set_load_job_ready(load->job);
+        }
+    }
+
+     // Returns true if the background thread hasn't started reading this, in
+     // which case it never will.  Also removes it from the queue, so it can be
+     // deleted without the background thread seeing it.
+    bool take (AsyncLoad* load) {
+        std::lock_guard lock (mutex);
+        if (load->taken) return false;
+        load->taken = true;
+        for (usize i = queue_next; i < queue.size(); i++) {
+            if (queue[i] == load) {
+                queue[i] = null;
+                break;
+            }
+        }
+        return true;
+    }
+
+     // Cancelled loads may linger in pending until the background thread is
+     // done with them, and the resource may have been queued again since.
+    usize find (ResourceRef res) {
+        for (usize i = 0; i < pending.size(); i++) {
+            if (pending[i]->job.res == res && !pending[i]->cancelled) return i;
+        }
+        never();
+    }
+};
+
+ // Never destroyed, because the background thread never stops.
+static AsyncLoader& async_loader () {
+    static Indestructible<AsyncLoader> r;
+    return *r;
+}
+
+static bool async_load_ready (AsyncLoad* load) {
+    return std::atomic_ref(load->job.ready).load(std::memory_order_acquire);
+}
+
+ // The background thread marks loads ready with the mutex locked, so once we can
+ // lock it, the background thread is done with this load.
+static void delete_async_load (AsyncLoad* load) {
+    { std::lock_guard lock (async_loader().mutex); }
+    delete load;
+}
+
+ // Deserializes a load whose file has been read.  Removes it from pending
+ // before running item_from_tree, because that may finish other loads.
+static void commit_async_load (usize i) {
+    auto& loader = async_loader();
+    AsyncLoad* load = loader.pending[i];
+    loader.pending.erase(i);
+    auto res = load->job.res;
+    auto data = static_cast<ResourceData*>(res.data);
+    try {
+        if (!load->cancelled) {
+            expect(data->state == RS::LoadPending);
+            if (load->job.error) {
+                data->state = RS::Unloaded;
+                std::rethrow_exception(move(load->job.error));
+            }
+            data->state = RS::Loading;
+            try { load_from_tree(res, load->job.scheme, load->job.mapped.tree); }
+            catch (...) { load_cancel(res); throw; }
+            load_commit(res);
+        }
+    }
+    catch (...) { delete_async_load(load); throw; }
+    delete_async_load(load);
+}
+
+static void finish_async_load (ResourceRef res) {
+    auto& loader = async_loader();
+    usize i = loader.find(res);
+    AsyncLoad* load = loader.pending[i];
+    if (loader.take(load)) {
+         // Still in the queue, so don't wait for everything ahead of it.
+        read_load_job(load->job);
+    }
+    else std::atomic_ref(load->job.ready).wait(false, std::memory_order_acquire);
+    commit_async_load(i);
+}
+
+static void cancel_async_load (ResourceRef res) {
+    auto& loader = async_loader();
+    usize i = loader.find(res);
+    AsyncLoad* load = loader.pending[i];
+    load->cancelled = true;
+    static_cast<ResourceData*>(res.data)->state = RS::Unloaded;
+    if (loader.take(load)) {
+        loader.pending.erase(i);
+        delete load;
+    }
+}
+
+} using namespace in;
+
+void load_async (ResourceRef res) {
+    auto data = static_cast<ResourceData*>(res.data);
+    if (data->state != RS::Unloaded) return;
+    auto scheme = universe().require_scheme(data->name);
+    auto load = new AsyncLoad{res, {}};
+    load->job.res = res;
+    load->job.scheme = scheme;
+    set_load_job_source(load->job, scheme, data->name);
+    data->state = RS::LoadPending;
+
+    auto& loader = async_loader();
+    loader.pending.push_back(load);
+    {
+        std::lock_guard lock (loader.mutex);
+        if (loader.queue_next == loader.queue.size()) {
+            loader.queue.clear();
+            loader.queue_next = 0;
+        }
+        loader.queue.push_back(load);
+        if (!loader.thread.joinable()) {
+            lilac::MallocScope malloc_scope;
+            loader.thread = std::thread([&loader]{ loader.run(); });
+        }
+    }
+    loader.cv.notify_one();
+}
+
+usize poll_async_loads () {
+    auto& loader = async_loader();
+    for (usize i = 0; i < loader.pending.size();) {
+        if (async_load_ready(loader.pending[i])) commit_async_load(i);
+        else i++;
+    }
+    return loader.pending.size();
+}
+
+namespace in {
+
+struct SaveJob {
+    ResourceRef res;
+    AnyString filename;
+    bool binary;
+    bool sync;
+     // Accessed through std::atomic_ref, like LoadJob::ready.
+    bool ready = false;
+    Tree tree;
+    AnyString contents;
+    std::exception_ptr error;
+};
+
+ // Checks the resource and serializes it.  This has to happen on the main
+ // thread, since serialization can touch anything.
+static void prepare_save_job (SaveJob& job) {
+    auto data = static_cast<ResourceData*>(job.res.data);
     if (data->state != RS::Loaded) {
-        raise_ResourceStateInvalid("save", res);
+        raise_ResourceStateInvalid("save", job.res);
     }
     if (!data->value) {
-        raise_ResourceValueEmpty("save", res);
+        raise_ResourceValueEmpty("save", job.res);
     }
     auto scheme = universe().require_scheme(data->name);
     if (!scheme->accepts_type(data->value.type)) {
-        raise_ResourceTypeRejected("save", res, data->value.type);
+        raise_ResourceTypeRejected("save", job.res, data->value.type);
     }
-    auto filename = scheme->get_file(data->name);
+    job.filename = scheme->get_file(data->name);
+    job.binary = scheme->get_format(data->name) == ResourceFormat::Binary;
+    job.sync = scheme->sync_on_save(data->name);
      // Do type and value separately, because the Route refers to the value,
      // not the whole AnyVal.
-    KeepRouteCache klc;
     auto type = data->value.type.name();
-    auto value_tree = item_to_tree(data->value.ptr(), SharedRoute(res));
-    auto contents = tree_to_string_for_file(
-        Tree::array(Tree(type), move(value_tree)), opts
-    );
+    auto value_tree = item_to_tree(data->value.ptr(), SharedRoute(job.res));
+    job.tree = Tree::array(Tree(type), move(value_tree));
+}
+
+ // Prints the tree.  This can happen on any thread.  The tree isn't destroyed
+ // here, because it was allocated on the main thread.
+static void print_save_job (SaveJob& job, PrintOptions opts) noexcept {
+    try {
+        job.contents = job.binary
+            ? AnyString(tree_to_binary(job.tree))
+            : AnyString(tree_to_string_for_file(job.tree, opts));
+    }
+    catch (...) { job.error = std::current_exception(); }
+    auto ready = std::atomic_ref(job.ready);
+    ready.store(true, std::memory_order_release);
+    ready.notify_one();
+}
 
-    auto outfile = File(filename, "wb");
+ // Finishes writing the file to a temporary location, then moves it into place
+ // now, or when the ResourceTransaction commits.  Errors writing the contents
+ // are thrown here, so only the rename can fail at commit time, and that can
+ // only be warned about.
+static void write_save_file (AtomicFile&& file, bool sync) {
+    file.finish(sync);
     if (ResourceTransaction::depth) {
         struct SaveCommitter : Committer {
-            AnyString contents;
-            File outfile;
-            SaveCommitter (AnyString&& c, File&& f) :
-                contents(move(c)), outfile(move(f))
-            { }
+            AtomicFile file;
+            bool sync;
+            SaveCommitter (AtomicFile&& f, bool s) : file(move(f)), sync(s) { }
             void commit () noexcept override {
-                outfile.write(contents);
+                file.commit_or_warn(sync);
             }
+             // On rollback the temporary file is deleted by AtomicFile's
+             // destructor.
         };
         ResourceTransaction::add_committer(
-            new SaveCommitter(move(contents), move(outfile))
+            new SaveCommitter(move(file), sync)
         );
     }
-    else {
-        outfile.write(contents);
+    else file.commit(sync);
+}
+
+static void write_save_job (SaveJob& job) {
+    auto file = AtomicFile(move(job.filename));
+    file.write(job.contents);
+    job.contents = {};
+    write_save_file(move(file), job.sync);
+}
+
+} // in
+
+void save (ResourceRef res, PrintOptions opts) {
+    SaveJob job;
+    job.res = res;
+    KeepRouteCache klc;
+    prepare_save_job(job);
+    if (!job.binary) {
+         // Print straight to the (temporary) file, so the whole document
+         // never has to be in memory.
+        auto file = AtomicFile(move(job.filename));
+        tree_to_file(job.tree, file.file, opts);
+        job.tree = {};
+        write_save_file(move(file), job.sync);
+        return;
+    }
+    print_save_job(job, opts);
+    if (job.error) std::rethrow_exception(move(job.error));
+    job.tree = {};
+    write_save_job(job);
+}
+
+void save (Slice<ResourceRef> reses, PrintOptions opts, u32 threads) {
+    ResourceTransaction tr;
+    KeepRouteCache klc;
+    auto jobs = UniqueArray<SaveJob>(Capacity(reses.size()));
+    for (auto res : reses) {
+        auto& job = jobs.emplace_back_expect_capacity();
+        job.res = res;
+        prepare_save_job(job);
+    }
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (threads <= 1 || jobs.size() <= 1) {
+        for (auto& job : jobs) {
+            print_save_job(job, opts);
+            if (job.error) std::rethrow_exception(move(job.error));
+            job.tree = {};
+            write_save_job(job);
+        }
+        return;
+    }
+     // Print on the workers while writing finished ones here.  Nothing is
+     // moved into place until the transaction commits, so if one fails, none
+     // of the files are changed.
+    Workers workers (
+        jobs, std::min<usize>(threads, jobs.size()),
+        [opts](SaveJob& job){ print_save_job(job, opts); }
+    );
+    for (auto& job : jobs) {
+        std::atomic_ref(job.ready).wait(false, std::memory_order_acquire);
+        if (job.error) std::rethrow_exception(move(job.error));
+        job.tree = {};
+        write_save_job(job);
     }
 }
 
 static void really_unload (ResourceData* data) {
+    data->refs_out = {};
+    data->forget_value_caches();
     if (ResourceTransaction::depth) {
         struct ForceUnloadCommitter : Committer {
             ROV rov;
@@ -317,47 +796,129 @@ static void really_unload (ResourceData* data) {
     }
 }
 
-struct ResourceScanInfo {
-    ResourceData* data;
-    UniqueArray<AnyRef> outgoing_refs;
-};
  // TODO: replace with binary search
 using RefsToReses = std::unordered_map<AnyRef, ResourceData*>;
 
-static void reach_reference (
-    const UniqueArray<ResourceScanInfo>& scan_info,
-    const RefsToReses& refs_to_reses,
-    const AnyRef& item
-) {
-    auto it = refs_to_reses.find(item);
-    if (it == refs_to_reses.end()) {
-         // Reference is already invalid?  Either that or it points to the
-         // root set, which we didn't bother studying because we already
-         // know it's reachable.
-        return;
+ // Per-thread state for scan_resource_graph.
+struct ResourceScanThread {
+    RefsToReses refs_to_reses;
+     // The resource this thread is currently scanning.
+    ResourceData* current = null;
+     // Items of type AnyRef and the resources they're in.  These aren't read
+     // until after the scan, because copying an AnyRef that's stored in program
+     // data isn't thread-safe.
+    UniqueArray<Pair<ResourceData*, AnyRef>> outgoing_refs;
+};
+
+static void reach_resource (ResourceData* data) {
+    if (data->reachable) return;
+    data->reachable = true;
+     // Use an explicit stack, because chains of resources can be long.
+    UniqueArray<ResourceData*> stack;
+    stack.push_back(data);
+    while (stack) {
+        auto from = stack.back();
+        stack.pop_back();
+        for (auto to : from->refs_out) {
+            auto to_data = static_cast<ResourceData*>(to.data);
+            if (!to_data->reachable) {
+                to_data->reachable = true;
+                stack.push_back(to_data);
+            }
+        }
+    }
+}
+
+ // Rebuilds refs_out for all loaded resources by scanning their values, and
+ // marks resources referenced by tracked items as reachable.
+static void scan_resource_graph (Slice<ResourceData*> loaded) {
+     // Unfortunately we can't traverse the data graph directly, because finding
+     // out what Resource a reference points to requires a full scan itself.  We
+     // don't have to cache as much data as reference_to_route though; we only
+     // need to keep track of the Route's root, not the whole Route itself.
+     // Resources may be scanned in parallel (see set_resource_scan_threads),
+     // in which case each thread's findings are merged afterwards.
+    u32 n_threads = universe().scan_threads_for(loaded.size());
+    auto threads = UniqueArray<ResourceScanThread>(n_threads);
+    auto reses = UniqueArray<ResourceRef>(Capacity(loaded.size()));
+    for (auto data : loaded) reses.emplace_back_expect_capacity(data);
+    scan_resources_references_parallel(reses, n_threads,
+        [&threads](u32 t, const AnyRef& item, const ScanRoute& rt)
+    {
+        auto& thread = threads[t];
+         // The scan of each resource starts at its root.
+        if (!rt.parent) {
+            thread.current = static_cast<ResourceData*>(
+                rt.materialize()->resource().data
+            );
+        }
+        thread.refs_to_reses.emplace(item, thread.current);
+        if (item.type() == Type::For<AnyRef>()) {
+            thread.outgoing_refs.emplace_back(thread.current, item);
+        }
+        return false;
+    });
+    auto& refs_to_reses = threads[0].refs_to_reses;
+    for (u32 t = 1; t < n_threads; t++) {
+        refs_to_reses.merge(threads[t].refs_to_reses);
+    }
+    for (auto data : loaded) data->refs_out = {};
+    for (auto& thread : threads)
+    for (auto& [from, ref_ref] : thread.outgoing_refs) {
+        ref_ref.read([&refs_to_reses, from](Type, Mu* v){
+            auto it = refs_to_reses.find(*reinterpret_cast<AnyRef*>(v));
+             // If it's not found, the reference is already invalid.
+            if (it != refs_to_reses.end()) {
+                record_resource_reference(from, it->second);
+            }
+        });
+    }
+    universe().resource_graph_dirty = false;
+    for (auto& g : universe().tracked) {
+        scan_references(
+            g, {},
+            [&refs_to_reses](const AnyRef& item, const ScanRoute&)
+        {
+            item.read([&refs_to_reses](Type t, Mu* v){
+                if (t == Type::For<AnyRef>()) {
+                    auto it = refs_to_reses.find(*reinterpret_cast<AnyRef*>(v));
+                    if (it != refs_to_reses.end()) reach_resource(it->second);
+                }
+            });
+            return false;
+        });
+    }
+}
+
+ // Marks everything reachable from the loaded resources that have root set.
+ // reachable must have been cleared on all of them first.
+static void mark_reachable (Slice<ResourceData*> loaded) {
+     // The references between resources were recorded as they were loaded, so
+     // usually we can just walk the recorded graph without looking at any
+     // values.  If something happened that might have added references
+     // without recording them, or if there are tracked items (which are
+     // outside of the graph), fall back to scanning everything.
+    if (universe().resource_graph_dirty || universe().tracked) {
+        scan_resource_graph(loaded);
     }
-    auto to_data = it->second;
-    if (to_data->reachable) return;
-    to_data->reachable = true;
-    for (auto& ref : scan_info[to_data->node_id].outgoing_refs) {
-        reach_reference(scan_info, refs_to_reses, ref);
+    for (auto data : loaded) {
+        if (data->root) reach_resource(data);
     }
 }
 
 void unload (Slice<ResourceRef> to_unload) {
     auto& resources = universe().resources;
      // TODO: Track how many loaded resources there are to preallocate this.
-    auto scan_info = UniqueArray<ResourceScanInfo>(Capacity(resources.size()));
+    auto loaded = UniqueArray<ResourceData*>(Capacity(resources.size()));
      // Start out by getting a bit of info about all loaded resources.
     bool none_root = true;
     bool all_root = true;
     for (auto& [name, res] : resources) {
+        if (!res) continue;
         auto data = static_cast<ResourceData*>(res.data);
          // Only scan loaded resources
         if (data->state != RS::Loaded) continue;
-         // Assign integer ID for indexing
-        data->node_id = scan_info.size();
-        scan_info.emplace_back_expect_capacity(data, UniqueArray<AnyRef>());
+        loaded.emplace_back_expect_capacity(data);
          // Our root set for the reachability traversal is all resources that
          // have a reference count but were not explicitly requested to be
          // unloaded.
@@ -383,55 +944,10 @@ void unload (Slice<ResourceRef> to_unload) {
     if (none_root && !universe().tracked) {
          // Root set is empty!  We get to skip reachability scanning and just
          // unload everything.
-        scan_info.consume([](auto&& info){ really_unload(info.data); });
+        loaded.consume([](ResourceData* data){ really_unload(data); });
         return;
     }
-     // Collect as much info as we can from one scan.  Unfortunately we can't
-     // traverse the data graph directly, because finding out what Resource a
-     // reference points to requires a full scan itself.  We don't have to cache
-     // as much data as reference_to_route though; we only need to keep track of
-     // the Route's root, not the whole Route itself.
-    auto refs_to_reses = std::unordered_map<AnyRef, ResourceData*>();
-    for (auto& info : scan_info) {
-         // TODO: Don't generate routes if we're throwing them away
-        scan_resource_references(info.data,
-            [&refs_to_reses, &info](const AnyRef& item, RouteRef)
-        {
-             // Don't need to enumerate references for resources in the root
-             // set, because they start out reachable.
-            if (!info.data->root) {
-                refs_to_reses.emplace(item, info.data);
-            }
-            item.read([&info](Type t, Mu* v){
-                if (t == Type::For<AnyRef>()) {
-                    info.outgoing_refs.emplace_back(
-                        *reinterpret_cast<AnyRef*>(v)
-                    );
-                }
-            });
-            return false;
-        });
-    }
-     // Now traverse the graph starting with the tracked items and roots.
-    for (auto& g : universe().tracked) {
-        scan_references(
-            g, {},
-            [&scan_info, refs_to_reses](const AnyRef& item, RouteRef)
-        {
-            if (item.type() == Type::For<AnyRef>()) {
-                reach_reference(scan_info, refs_to_reses, item);
-            }
-            return false;
-        });
-    }
-    for (auto& info : scan_info) {
-        if (info.data->root) {
-            info.data->reachable = true;
-            for (auto& ref : scan_info[info.data->node_id].outgoing_refs) {
-                reach_reference(scan_info, refs_to_reses, ref);
-            }
-        }
-    }
+    mark_reachable(loaded);
      // At this point, all resources should be marked whether they're reachable.
      // First throw an error if any resources we were explicitly told to unload
      // are still reachable.
@@ -445,18 +961,144 @@ void unload (Slice<ResourceRef> to_unload) {
         }
     }
      // Now finally unload all unreachable resources.
-    for (auto& info : scan_info) {
-        if (!info.data->reachable) really_unload(info.data);
+    for (auto data : loaded) {
+        if (!data->reachable) really_unload(data);
+    }
+}
+
+usize resource_memory (ResourceRef res, bool recalculate) {
+    auto data = static_cast<ResourceData*>(res.data);
+    if (data->state != RS::Loaded || !data->value) return 0;
+    if (data->memory && !recalculate) return data->memory;
+     // Items that don't fit inside the item they're a child of must have
+     // been allocated separately.  Keep a stack of the current item's
+     // ancestors to check that.
+    struct Frame {
+        const ScanRoute* route;
+        usize begin;
+        usize end;
+    };
+    UniqueArray<Frame> stack;
+    usize total = sizeof(ResourceData);
+    scan_resource_pointers(res, [&](AnyPtr item, const ScanRoute& rt){
+        usize begin = usize(item.address);
+        usize end = begin + item.type().cpp_size();
+         // If an item only has a delegate, it's visited again with the same
+         // route as its child.  A sibling's route may also have the same
+         // address as this one, but a sibling won't contain this item.
+        while (stack && stack.back().route != rt.parent
+                     && !(stack.back().route == &rt &&
+                          begin >= stack.back().begin &&
+                          end <= stack.back().end)
+        ) stack.pop_back();
+        if (!stack || begin < stack.back().begin || end > stack.back().end) {
+            total += end - begin;
+        }
+        if (item.type() == Type::For<std::string>()) {
+            auto& s = *reinterpret_cast<std::string*>(item.address);
+             // Short strings are stored inside the std::string.
+            auto self = reinterpret_cast<const char*>(&s);
+            if (s.data() < self || s.data() >= self + sizeof(s)) {
+                total += s.capacity() + 1;
+            }
+        }
+        stack.push_back(Frame{&rt, begin, end});
+        return false;
+    });
+    return data->memory = total;
+}
+
+usize loaded_resources_memory () {
+    usize total = 0;
+    for (auto& [name, res] : universe().resources) {
+        if (res) total += resource_memory(res);
+    }
+    return total;
+}
+
+usize unload_to_budget (usize budget) {
+    auto& resources = universe().resources;
+    UniqueArray<ResourceData*> loaded;
+    usize total = 0;
+    bool any_unrooted = false;
+    for (auto& [name, res] : resources) {
+        if (!res) continue;
+        auto data = static_cast<ResourceData*>(res.data);
+        if (data->state != RS::Loaded) continue;
+        loaded.push_back(data);
+        total += resource_memory(res);
+        data->root = !!data->ref_count;
+        if (!data->root) any_unrooted = true;
+        data->reachable = false;
+    }
+    if (total <= budget || !any_unrooted) return total;
+    mark_reachable(loaded);
+     // Only unload a resource once no resource that's staying loaded refers
+     // to it.  node_id counts the remaining referrers among the candidates
+     // (reachable resources never refer to unreachable ones).
+    UniqueArray<ResourceData*> candidates;
+    for (auto data : loaded) {
+        data->node_id = 0;
+        if (!data->reachable) candidates.push_back(data);
     }
+    for (auto data : candidates) {
+        for (auto to : data->refs_out) {
+            static_cast<ResourceData*>(to.data)->node_id++;
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](ResourceData* a, ResourceData* b){ return a->last_used < b->last_used; }
+    );
+    UniqueArray<ResourceData*> evicted;
+    for (bool progress = true; progress && total > budget;) {
+        progress = false;
+        for (auto& data : candidates) {
+            if (!data || data->node_id) continue;
+            for (auto to : data->refs_out) {
+                static_cast<ResourceData*>(to.data)->node_id--;
+            }
+            total -= data->memory;
+            evicted.push_back(data);
+            data = null;
+            progress = true;
+            if (total <= budget) break;
+        }
+    }
+    for (auto data : evicted) really_unload(data);
+    return total;
+}
+
+void invalidate_resource_graph () noexcept {
+    universe().resource_graph_dirty = true;
+}
+
+void set_reload_trusts_resource_graph (bool trust) noexcept {
+    universe().reload_trusts_resource_graph = trust;
+}
+
+bool reload_trusts_resource_graph () noexcept {
+    return universe().reload_trusts_resource_graph;
+}
+
+void set_resource_scan_threads (u32 threads) noexcept {
+    universe().scan_threads = threads;
+}
+
+u32 resource_scan_threads () noexcept {
+    return universe().scan_threads;
 }
 
 void force_unload (ResourceRef res) noexcept {
     auto data = static_cast<ResourceData*>(res.data);
     switch (data->state) {
         case RS::Unloaded: return;
+        case RS::LoadPending: return cancel_async_load(res);
         case RS::Loaded: break;
         default: raise_ResourceStateInvalid("force_unload", res);
     }
+     // Other resources may still have references to this one, which will be
+     // dangling now.
+    universe().resource_graph_dirty = true;
     really_unload(data);
 }
 
@@ -465,6 +1107,15 @@ struct Update {
     AnyRef new_ref;
 };
 
+ // A reference into a reloaded resource's old value, found by scanning.
+struct ReloadRef {
+    AnyRef ref_ref;
+     // Route to ref_ref, in case it breaks.
+    SharedRoute route;
+     // Route to the item ref_ref pointed to in the old value.
+    const SharedRoute* old_route;
+};
+
 NOINLINE static void reload_commit (UniqueArray<Update>&& updates) {
     updates.consume([](Update&& update){
         update.ref_ref.write(
@@ -480,7 +1131,9 @@ NOINLINE static void reload_rollback (UniqueArray<ROV>&& rovs) {
     rovs.consume([](auto&& rov){
         auto data = static_cast<ResourceData*>(rov.res.data.p);
         data->value = move(rov.old_value);
+        data->forget_value_caches();
     });
+    universe().resource_graph_dirty = true;
 }
 
 void reload (Slice<ResourceRef> reses) {
@@ -505,66 +1158,96 @@ void reload (Slice<ResourceRef> reses) {
             auto data = static_cast<ResourceData*>(res.data);
             data->state = RS::Loading;
             auto scheme = universe().require_scheme(data->name);
-            auto filename = scheme->get_file(data->name);
-            Tree tree = tree_from_file(move(filename));
-            auto tnt = verify_tree_for_scheme(res, scheme, tree);
+            auto mapped = read_resource_file(scheme, data->name);
+            auto tnt = verify_tree_for_scheme(res, scheme, mapped.tree);
             expect(!data->value);
             data->value = AnyVal(tnt.type);
+            data->forget_value_caches();
+            data->refs_out = {};
              // Do not DelaySwizzle for reload.  TODO: Forbid reload while a
              // serialization operation is ongoing.
             item_from_tree(data->value.ptr(), tnt.tree, SharedRoute(res));
             data->state = RS::Loaded;
         }
-         // Verify step
+         // Verify step.  If we're allowed to trust the resource graph and it's
+         // up to date, only the resources that refer to the reloaded ones (and
+         // the reloaded ones themselves) can contain references that need
+         // updating, so we don't have to scan the rest.
+        bool use_graph = universe().reload_trusts_resource_graph &&
+                         !universe().resource_graph_dirty;
         UniqueArray<ResourceRef> others;
         for (auto& [name, other] : universe().resources) {
+            if (!other) continue;
             switch (other->state()) {
-                case RS::Unloaded: continue;
-                case RS::Loaded: others.emplace_back(&*other); break;
+                case RS::Unloaded: case RS::LoadPending: continue;
+                case RS::Loaded: break;
                 default: raise_ResourceStateInvalid("scan for reload", &*other);
             }
-            for (auto res : reses) {
-                if (res == other) goto next_other;
+            if (use_graph) {
+                for (auto res : reses) {
+                    if (res == other) goto scan_other;
+                }
+                for (auto to : static_cast<ResourceData*>(other.data)->refs_out)
+                for (auto res : reses) {
+                    if (res == to) goto scan_other;
+                }
+                continue;
             }
-            next_other:;
+            scan_other:
+            others.emplace_back(&*other);
         }
-         // If we're reloading everything, no need to do any scanning.
-        if (others) {
+        if (others || universe().tracked) {
              // First build mapping of old refs to locations
             std::unordered_map<AnyRef, SharedRoute> old_refs;
             for (auto& rov : rovs) {
                 scan_references(
                     rov.old_value.ptr(), SharedRoute(rov.res),
-                    [&old_refs](const AnyRef& ref, RouteRef rt) {
+                    [&old_refs](const AnyRef& ref, const ScanRoute& rt) {
                         old_refs.emplace(ref, rt);
                         return false;
                     }
                 );
             }
-             // Then build set of ref-refs to update.
-            UniqueArray<Break> breaks;
-            auto check_ref =
-                [&updates, &old_refs, &breaks](AnyRef ref_ref, RouteRef rt)
-            {
+             // Then find ref-refs that point into the old values.  The other
+             // resources may be scanned in parallel, and resolving the new
+             // references has to wait until after the scan, because it isn't
+             // thread-safe.
+            u32 n_threads = universe().scan_threads_for(others.size());
+            auto found = UniqueArray<UniqueArray<ReloadRef>>(n_threads);
+            auto check_ref = [&found, &old_refs](
+                u32 t, const AnyRef& ref_ref, const ScanRoute& rt
+            ) {
                  // TODO: check for AnyPtr as well?
                 if (ref_ref.type() != Type::For<AnyRef>()) return false;
-                AnyRef ref = ref_ref.get_as<AnyRef>();
-                auto iter = old_refs.find(ref);
-                if (iter == old_refs.end()) return false;
-                try {
-                    AnyRef new_ref = reference_from_route(iter->second);
-                    updates.emplace_back(move(ref_ref), move(new_ref));
-                }
-                catch (std::exception&) {
-                    breaks.emplace_back(rt, iter->second);
-                }
+                ref_ref.read([&](Type, Mu* v){
+                    auto iter = old_refs.find(*reinterpret_cast<AnyRef*>(v));
+                    if (iter == old_refs.end()) return;
+                    found[t].emplace_back(ref_ref, rt, &iter->second);
+                });
                 return false;
             };
+             // Only AnyRefs matter here, so skip anything that can't have them.
             for (auto tracked : universe().tracked) {
-                scan_references(tracked, {}, check_ref);
+                scan_references_pruned(tracked, {},
+                    [&check_ref](const AnyRef& ref_ref, const ScanRoute& rt){
+                        return check_ref(0, ref_ref, rt);
+                    }
+                );
             }
-            for (auto other : others) {
-                scan_resource_references(other, check_ref);
+            scan_resources_references_parallel(
+                others, n_threads, check_ref, true
+            );
+             // Then build set of ref-refs to update.
+            UniqueArray<Break> breaks;
+            for (auto& thread_found : found)
+            for (auto& f : thread_found) {
+                try {
+                    AnyRef new_ref = reference_from_route(*f.old_route);
+                    updates.emplace_back(move(f.ref_ref), move(new_ref));
+                }
+                catch (std::exception&) {
+                    breaks.emplace_back(move(f.route), *f.old_route);
+                }
             }
             if (breaks) {
                 raise_would_break(e_ResourceReloadWouldBreak, move(breaks));
@@ -615,8 +1298,15 @@ void rename (ResourceRef old_res, ResourceRef new_res) {
     }
     expect(!new_data->value);
     new_data->value = move(old_data->value);
+    new_data->forget_value_caches();
+    old_data->forget_value_caches();
+    new_data->refs_out = move(old_data->refs_out);
     new_data->state = RS::Loaded;
     old_data->state = RS::Unloaded;
+     // Other resources' references to the old resource now refer to the new
+     // one.
+    universe().resource_graph_dirty = true;
+    universe().load_count++;
 }
 
 AnyString resource_filename (const IRI& name) {
@@ -632,6 +1322,7 @@ void remove_source (const IRI& name) {
 
 bool source_exists (const IRI& name) {
     auto scheme = universe().require_scheme(name);
+    if (scheme->get_source(name).mapping) return true;
     auto filename = scheme->get_file(name);
     if (std::FILE* f = fopen_utf8(filename.c_str())) {
         fclose(f);
@@ -643,7 +1334,7 @@ bool source_exists (const IRI& name) {
 UniqueArray<SharedResource> loaded_resources () noexcept {
     UniqueArray<SharedResource> r;
     for (auto& [name, rd] : universe().resources)
-    if (rd->state() != RS::Unloaded) {
+    if (rd && rd->state() != RS::Unloaded && rd->state() != RS::LoadPending) {
         r.push_back(rd);
     }
     return r;
@@ -691,6 +1382,7 @@ AnyRef track_ptr (AnyPtr item, const IRI& loc) {
 AYU_DESCRIBE(ayu::ResourceState,
     values(
         value("unloaded", RS::Unloaded),
+        value("load_pending", RS::LoadPending),
         value("loading", RS::Loading),
         value("loaded", RS::Loaded)
     )
@@ -717,10 +1409,38 @@ AYU_DESCRIBE(ayu::ResourceRef,
 ///// TESTS
 
 #ifndef TAP_DISABLE_TESTS
+#include <cstring>
+#include <filesystem>
 #include "../test/test-environment.private.h"
+#include "../../uni/time.h"
 
 AYU_DESCRIBE_INSTANTIATE(std::vector<i32*>)
 
+ // Makes n resources named ayu-test:/<prefix><i>.ayu, without values.
+static UniqueArray<SharedResource> test_resources (Str prefix, u32 n) {
+    auto reses = UniqueArray<SharedResource>(Capacity(n));
+    for (u32 i = 0; i < n; i++) {
+        reses.emplace_back_expect_capacity(
+            IRI(cat("ayu-test:/", prefix, i, ".ayu"))
+        );
+    }
+    return reses;
+}
+
+ // Same, but each has a Document value, which fill(doc, i) puts items in.
+template <class F>
+static UniqueArray<SharedResource> test_documents (Str prefix, u32 n, F fill) {
+    auto reses = UniqueArray<SharedResource>(Capacity(n));
+    for (u32 i = 0; i < n; i++) {
+        auto& res = reses.emplace_back_expect_capacity(
+            IRI(cat("ayu-test:/", prefix, i, ".ayu")),
+            AnyVal::make<ayu::Document>()
+        );
+        fill(res->value().as<ayu::Document>(), i);
+    }
+    return reses;
+}
+
 static tap::TestSet tests ("dirt/ayu/resources/resource", []{
     using namespace tap;
 
@@ -801,6 +1521,35 @@ static tap::TestSet tests ("dirt/ayu/resources/resource", []{
     is(tree_from_file(resource_filename(output->name())), tree_from_string(
         "[ayu::Document {bar:[std::string qux] asdf:[i32 51] _0:[ayu::AnyRef #/bar+1] _1:[i32* #/asdf+1] _next_id:2}]"
     ), "File was saved with correct reference as route");
+    {
+        auto data = static_cast<ResourceData*>(output.data.p);
+        ok(data->have_route_cache, "Route cache is kept after saving");
+        u32 session = data->route_cache_session;
+        doesnt_throw([&]{ save(output); }, "save again with pointer");
+        is(data->route_cache_session, session, "Saving again reuses route cache");
+        doc->new_<i32*>(doc->new_<i32>(52));
+        doesnt_throw([&]{ save(output); },
+            "save with pointer to item added after building route cache"
+        );
+        invalidate_route_cache(output);
+        ok(!data->have_route_cache, "invalidate_route_cache");
+
+        auto x = doc->new_with_name<std::vector<i32>>("x", std::vector<i32>{1});
+        auto y = doc->new_with_name<std::vector<i32>>("y", std::vector<i32>{2});
+        doc->new_with_name<i32*>("p", x->data());
+        save(output);
+         // Now p points to an item that has the same address and type as
+         // before but a different route.
+        std::swap(*x, *y);
+        save(output);
+        auto saved = tree_from_file(resource_filename(output->name()));
+        is(*saved.elem(1)->attr("p"), tree_from_string("[i32* #/y+1+0]"),
+            "Stale route from earlier session's route cache isn't used"
+        );
+        doc->delete_with_name("p");
+        doc->delete_with_name("x");
+        doc->delete_with_name("y");
+    }
     throws_code<e_OpenFailed>([&]{
         load(badinput);
     }, "Can't load file with incorrect reference in it");
@@ -852,6 +1601,28 @@ static tap::TestSet tests ("dirt/ayu/resources/resource", []{
     }, "Can unload reference cycle by unload both resources at once");
      // TODO: test that calling unload unloads dependent resources if there are
      // no SharedResource handles pointing to them.
+    {
+        load(input2);
+        auto& refs = static_cast<ResourceData*>(input2.data.p)->refs_out;
+        ok(refs.size() == 1 && refs[0] == input,
+            "Loading records references to other resources"
+        );
+        invalidate_resource_graph();
+        throws_code<e_ResourceUnloadWouldBreak>([&]{
+            unload(input);
+        }, "Can't unload referenced resource after rescanning");
+        ok(!universe().resource_graph_dirty, "Rescanning cleans resource graph");
+        ok(refs.size() == 1 && refs[0] == input,
+            "Rescanning finds the same references"
+        );
+        throws_code<e_ResourceUnloadWouldBreak>([&]{
+            unload(input);
+        }, "Can't unload referenced resource without rescanning");
+        doesnt_throw([&]{ unload({input, input2}); },
+            "Can unload referring resources together"
+        );
+        is(refs.size(), 0u, "Unloading clears recorded references");
+    }
 
     load(rec1);
     int* old_p = rec1["ref"][1].get_as<int*>();
@@ -864,11 +1635,663 @@ static tap::TestSet tests ("dirt/ayu/resources/resource", []{
     int* new_p = rec1["ref"][1].get_as<int*>();
     isnt(new_p, old_p, "Reference to reloaded file was updated");
     is(global_p, new_p, "Global was updated.");
+    ayu::untrack(global_p);
+
+    is(resource_scan_threads(), 1u, "Resources are scanned on one thread by default");
+    set_resource_scan_threads(4);
+    invalidate_resource_graph();
+    doesnt_throw([&]{
+        reload(rec2);
+    }, "Can reload while scanning on multiple threads");
+    isnt(rec1["ref"][1].get_as<int*>(), new_p,
+        "Reference was updated by scan on multiple threads"
+    );
+    invalidate_resource_graph();
+    throws_code<e_ResourceUnloadWouldBreak>([&]{
+        unload(rec2);
+    }, "Rescan on multiple threads finds references");
+    set_resource_scan_threads(1);
 
     throws_code<e_ResourceTypeRejected>([&]{
         load(SharedResource(IRI("ayu-test:/wrongtype.ayu")));
     }, "ResourceScheme::accepts_type rejects wrong type");
 
+    SharedResource binary (
+        IRI("ayu-test:/test-output.ayub"), AnyVal::make<ayu::Document>()
+    );
+    auto& bdoc = binary->value().as<ayu::Document>();
+    bdoc.new_with_name<std::string>("s", "hello");
+    bdoc.new_with_name<i32>("n", 51);
+    doesnt_throw([&]{ save(binary); }, "save .ayub resource");
+    is(tree_from_binary_file(resource_filename(binary->name())), tree_from_string(
+        "[ayu::Document {s:[std::string hello] n:[i32 51] _next_id:0}]"
+    ), ".ayub resource was saved in binary format");
+    doesnt_throw([&]{
+        unload(binary);
+        load(binary);
+    }, "load .ayub resource");
+    is(binary["s"][1].get_as<std::string>(), "hello",
+        ".ayub resource was loaded correctly"
+    );
+    remove_source(binary->name());
+
+    {
+        constexpr u32 n = 64;
+        auto reses = test_documents("batch-", n,
+            [](ayu::Document& doc, u32 i){
+                for (u32 j = 0; j < 200; j++) {
+                    doc.new_<std::string>(cat("item ", i, ' ', j));
+                }
+                doc.new_with_name<i32>("n", i32(i));
+            }
+        );
+        for (auto& res : reses) {
+            save(res);
+            unload(res);
+        }
+        auto refs = UniqueArray<ResourceRef>(n, [&](usize i){
+            return ResourceRef(reses[i]);
+        });
+        for (u32 threads : {1, 4}) {
+            doesnt_throw([&]{ load(refs, threads); },
+                cat("Batch load on ", threads, " thread(s)")
+            );
+            u32 bad = 0;
+            for (u32 i = 0; i < n; i++) {
+                if (reses[i]->state() != RS::Loaded ||
+                    reses[i]["n"][1].get_as<i32>() != i32(i)
+                ) bad++;
+            }
+            is(bad, 0u, cat("Batch load on ", threads, " thread(s) is correct"));
+            usize serial = 0;
+            scan_universe_pointers([&serial](AnyPtr, const ScanRoute&){
+                serial++;
+                return false;
+            });
+            auto counts = UniqueArray<usize>(threads, usize(0));
+            doesnt_throw([&]{
+                scan_universe_pointers_parallel(threads,
+                    [&counts](u32 t, AnyPtr, const ScanRoute&){
+                        counts[t]++;
+                        return false;
+                    }
+                );
+            }, cat("Parallel scan on ", threads, " thread(s)"));
+            usize parallel = 0;
+            for (auto c : counts) parallel += c;
+            is(parallel, serial, cat(
+                "Parallel scan on ", threads, " thread(s) visits every item"
+            ));
+            unload(refs);
+        }
+        refs.push_back(badinput);
+        throws_code<e_OpenFailed>([&]{ load(refs, 4); },
+            "Batch load with bad reference throws"
+        );
+        u32 loaded = 0;
+        for (auto& r : reses) loaded += r->state() != RS::Unloaded;
+        is(loaded, 0u, "Failed batch load doesn't load anything");
+        doesnt_throw([&]{ load({input2, input}, 4); },
+            "Batch load with reference to later resource"
+        );
+        is(input->state(), RS::Loaded, "Batch load loaded referenced resource");
+        is(input2["ext_pointer"][1].get_as<std::string*>(),
+            input["bar"][1].address_as<std::string>(),
+            "Batch load swizzled reference to later resource"
+        );
+        unload({input, input2});
+
+        auto wait_for_loads = [](){
+            double start = uni::steady_clock();
+            while (poll_async_loads()) {
+                if (uni::steady_clock() - start > 10) return false;
+                std::this_thread::yield();
+            }
+            return true;
+        };
+        load_async(refs.slice(0, 8));
+        is(reses[0]->state(), RS::LoadPending, "load_async makes resource pending");
+        ok(!reses[0]->get_value(), "Pending resource has no value");
+        is(reses[0]["n"][1].get_as<i32>(), 0,
+            "Accessing pending resource waits for it"
+        );
+        is(reses[0]->state(), RS::Loaded, "Accessing pending resource loads it");
+        force_unload(reses[1]);
+        is(reses[1]->state(), RS::Unloaded, "force_unload cancels pending load");
+        ok(wait_for_loads(), "poll_async_loads finishes pending loads");
+        u32 bad = 0;
+        for (u32 i = 2; i < 8; i++) {
+            if (reses[i]->state() != RS::Loaded ||
+                reses[i]["n"][1].get_as<i32>() != i32(i)
+            ) bad++;
+        }
+        is(bad, 0u, "Async loads are correct");
+        is(reses[1]->state(), RS::Unloaded, "Cancelled load stays unloaded");
+        load_async(reses[1]);
+        force_unload(reses[1]);
+        load_async(reses[1]);
+        is(reses[1]["n"][1].get_as<i32>(), 1,
+            "Async load after cancelled async load"
+        );
+        ok(wait_for_loads(), "Cancelled async load is cleaned up");
+        load_async(badinput);
+        throws_code<e_OpenFailed>([&]{ wait_for_loads(); },
+            "Async load failure is thrown from poll_async_loads"
+        );
+        is(badinput->state(), RS::Unloaded, "Failed async load is unloaded");
+        SharedResource missing (IRI("ayu-test:/nonexistent.ayu"));
+        load_async(missing);
+        throws_code<e_OpenFailed>([&]{ wait_for_loads(); },
+            "Async load of missing file fails"
+        );
+        is(missing->state(), RS::Unloaded, "Failed async read is unloaded");
+        unload(refs);
+        for (auto& res : reses) remove_source(res->name());
+    }
+    {
+        SharedResource res (
+            IRI("ayu-test:/cached.ayu"), AnyVal::make<ayu::Document>()
+        );
+        auto& doc = res->value().as<ayu::Document>();
+        for (u32 i = 0; i < 20000; i++) {
+            doc.new_<std::string>(cat("cached item ", i));
+        }
+        doc.new_with_name<i32>("n", 1);
+        save(res);
+        unload(res);
+        auto source = resource_filename(res->name());
+        auto expected = tree_from_file(source);
+
+        env.trs->cache_folder = iri::to_fs_path(env.trs->folder);
+        auto cache = env.trs->get_cache_file(res->name());
+        remove_utf8(cache.c_str());
+        load(res);
+        is(res["n"][1].get_as<i32>(), 1, "Load with empty cache");
+        uni::FileInfo cache_info;
+        ok(stat_utf8(cache.c_str(), cache_info), "Loading writes cache");
+        unload(res);
+        load(res);
+        is(res["n"][1].get_as<i32>(), 1, "Load from cache");
+        unload(res);
+        is(tree_from_file_cached(source, cache).tree, expected,
+            "Cached tree is correct"
+        );
+
+         // Changing the modification time but not the contents uses the cache
+         // and updates its time.
+        auto cache_mtime = [&]{
+            UniqueString c = string_from_file(cache);
+            i64 mtime;
+            std::memcpy(&mtime, c.data() + 16, 8);
+            return mtime;
+        };
+        i64 old_mtime = cache_mtime();
+        std::filesystem::last_write_time(source.c_str(),
+            std::filesystem::last_write_time(source.c_str())
+                + std::chrono::seconds(10)
+        );
+        is(tree_from_file_cached(source, cache).tree, expected,
+            "Touched file reads the same tree"
+        );
+        isnt(cache_mtime(), old_mtime, "Touching file updates cache's time");
+
+         // Changing the contents invalidates the cache.
+        string_to_file("[ayu::Document {n:[i32 2] _next_id:0}]", source);
+        is(res["n"][1].get_as<i32>(), 2, "Changed file invalidates cache");
+        unload(res);
+        string_to_file("garbage", cache);
+        is(res["n"][1].get_as<i32>(), 2, "Corrupt cache is ignored");
+        unload(res);
+        env.trs->cache_folder = "";
+        remove_source(res->name());
+        remove_utf8(cache.c_str());
+    }
+
+    {
+        UniqueArray<SharedResource> reses;
+        for (i32 i = 0; i < 10; i++) {
+            reses.emplace_back(
+                IRI(cat("ayu-test:/order-", i, ".ayu")),
+                AnyVal::make<ayu::Document>()
+            );
+        }
+        unload(reses[2]);
+        unload(reses[5]);
+        reses[2] = {};
+        reses[5] = {};
+        UniqueString order;
+        for (auto& r : loaded_resources()) {
+            Str path = r->name().path();
+            if (path.substr(0, 7) == "/order-") order.push_back(path[7]);
+        }
+        is(order, "01346789",
+            "loaded_resources keeps creation order after deletions"
+        );
+        ok(SharedResource(IRI("ayu-test:/order-4.ayu")) == reses[4],
+            "Looking up a resource after deletions finds the same resource"
+        );
+        is(SharedResource(IRI("ayu-test:/order-5.ayu"))->state(), RS::Unloaded,
+            "Deleted resource is recreated unloaded"
+        );
+        for (auto& r : reses) if (r) unload(r);
+    }
+    {
+         // Enough to grow, compact, and rebuild the index several times.
+        constexpr u32 n = 2000;
+        auto reses = test_resources("many/", n);
+        u32 mismatches = 0;
+        for (u32 i = 0; i < n; i++) {
+            SharedResource r (IRI(cat("ayu-test:/many/", i, ".ayu")));
+            if (r != reses[i]) mismatches++;
+        }
+        reses = {};
+        is(mismatches, 0u, "Looking up many resources finds the right ones");
+        UniqueArray<SharedResource> leftover;
+        for (auto& [_, r] : universe().resources) {
+            if (r && r->name().path().substr(0, 6) == "/many/") {
+                leftover.push_back(r);
+            }
+        }
+        is(leftover.size(), 0u, "Dropping references deletes unloaded resources");
+    }
+    {
+        constexpr u32 n = 500;
+        auto reses = test_documents("unload-graph/", n,
+            [](ayu::Document& doc, u32 i){ doc.new_<i32>(i32(i)); }
+        );
+        unload(reses[0]);
+        ok(!universe().resource_graph_dirty, "Unloading rescans resource graph");
+        for (u32 i = 1; i < 101; i++) unload(reses[i]);
+        ok(reses[100]->state() == RS::Unloaded
+            && reses[101]->state() == RS::Loaded,
+            "Unloading with recorded resource graph"
+        );
+        for (auto& r : reses) unload(r);
+    }
+    {
+        SharedResource res (
+            IRI("ayu-test:/pruned-scan.ayu"), AnyVal::make<ayu::Document>()
+        );
+        auto& doc = res->value().as<ayu::Document>();
+        doc.new_<std::vector<i32>>(std::vector<i32>(1000, 7));
+        doc.new_<i32*>(doc.new_<i32>(3));
+        usize full = 0;
+        scan_resource_references(res, [&full](const AnyRef&, const ScanRoute&){
+            full++;
+            return false;
+        });
+        usize pruned = 0;
+        usize refs = 0;
+        scan_resource_references_pruned(res,
+            [&pruned, &refs](const AnyRef& item, const ScanRoute&)
+        {
+            pruned++;
+            if (item.type() == Type::For<AnyRef>()) refs++;
+            return false;
+        });
+        ok(pruned + 1000 <= full, "Pruned scan skips array of plain data");
+        is(refs, 1u, "Pruned scan still finds pointer");
+        unload(res);
+    }
+
+    {
+        constexpr u32 n = 500;
+        auto reses = test_documents("reload-graph/", n,
+            [](ayu::Document& doc, u32 i){ doc.new_<i32>(i32(i)); }
+        );
+        SharedResource target (
+            IRI("ayu-test:/reload-target.ayu"), AnyVal::make<ayu::Document>()
+        );
+        target->value().as<ayu::Document>().new_with_name<i32>("val", 1);
+        save(target);
+        SharedResource writer (
+            IRI("ayu-test:/reload-writer.ayu"), AnyVal::make<ayu::Document>()
+        );
+        int** written = writer->value().as<ayu::Document>()
+            .new_with_name<int*>("p", null);
+         // Rescan to clean the resource graph.
+        unload(target);
+        ok(!universe().resource_graph_dirty, "Unload cleaned resource graph");
+        SharedResource referrer (IRI("ayu-test:/reload-referrer.ayu"));
+        string_to_file(
+            "[ayu::Document {ref:[i32* reload-target.ayu#/val+1]}]",
+            resource_filename(referrer->name())
+        );
+        load(referrer);
+        is(reload_trusts_resource_graph(), false,
+            "Reload doesn't trust the resource graph by default"
+        );
+        set_reload_trusts_resource_graph(true);
+        int* old_p = referrer["ref"][1].get_as<int*>();
+        reload(target);
+        int* new_p = referrer["ref"][1].get_as<int*>();
+        ok(new_p != old_p && new_p == target["val"][1].address_as<int>(),
+            "Reload updates references found through resource graph"
+        );
+        set_reload_trusts_resource_graph(false);
+        reload(target);
+        is(referrer["ref"][1].get_as<int*>(), target["val"][1].address_as<int>(),
+            "Reload updates references found by scanning"
+        );
+         // The resource graph doesn't know about references that the program
+         // writes itself.
+        *written = target["val"][1].address_as<int>();
+        reload(target);
+        is(*written, target["val"][1].address_as<int>(),
+            "Reload updates reference written after loading"
+        );
+        unload(writer);
+        unload(referrer);
+        unload(target);
+        for (auto& r : reses) unload(r);
+        remove_source(referrer->name());
+        remove_source(target->name());
+    }
+
+    {
+        constexpr u32 n = 64;
+        auto reses = test_documents("save-batch-", n,
+            [](ayu::Document& doc, u32 i){
+                for (u32 j = 0; j < 200; j++) {
+                    doc.new_<std::string>(cat("item ", j, " of ", i));
+                }
+            }
+        );
+        auto refs = UniqueArray<ResourceRef>(n, [&](usize i){
+            return ResourceRef(reses[i]);
+        });
+        save(refs, {}, 1);
+        UniqueArray<UniqueString> contents;
+        for (auto& res : reses) {
+            contents.push_back(string_from_file(resource_filename(res->name())));
+        }
+        save(refs, {}, 4);
+        bool same = true;
+        for (u32 i = 0; i < n; i++) {
+            auto c = string_from_file(resource_filename(reses[i]->name()));
+            if (c != contents[i]) same = false;
+        }
+        ok(same, "Batch save on worker threads writes the same files");
+
+        auto filename = resource_filename(reses[0]->name());
+        auto tmp_filename = cat(filename, ".tmp");
+        reses[0]->value().as<ayu::Document>().new_<std::string>("extra");
+        try {
+            ResourceTransaction tr;
+            save(refs, {}, 4);
+            is(string_from_file(filename), contents[0],
+                "Saved file isn't replaced before transaction commits"
+            );
+            raise(e_General, "Rollback");
+        }
+        catch (std::exception&) { }
+        is(string_from_file(filename), contents[0],
+            "Rolled back save doesn't change file"
+        );
+        uni::FileInfo info;
+        ok(!stat_utf8(tmp_filename.c_str(), info),
+            "Rolled back save deletes temporary file"
+        );
+        save(reses[0]);
+        isnt(string_from_file(filename), contents[0], "Saved changed file");
+        ok(!stat_utf8(tmp_filename.c_str(), info),
+            "Save doesn't leave temporary file"
+        );
+        string_to_file_atomic("synced", filename, true);
+        is(string_from_file(filename), "synced", "Atomic write with sync");
+        for (auto& res : reses) {
+            unload(res);
+            remove_source(res->name());
+        }
+    }
+
+    {
+        unload();
+        auto name = [](u32 i){
+            return IRI(cat("ayu-test:/budget-", i, ".ayu"));
+        };
+        for (u32 i = 0; i < 5; i++) {
+            SharedResource res (name(i), AnyVal::make<ayu::Document>());
+            auto& doc = res->value().as<ayu::Document>();
+            for (u32 j = 0; j < 100; j++) {
+                doc.new_<std::string>(cat("a string long enough to allocate ", j));
+            }
+        }
+        usize m = resource_memory(SharedResource(name(0)));
+        ok(m > 100 * 40 && m < 100 * 200, "resource_memory estimate is sane");
+        SharedResource(name(0))->value();
+        usize total = loaded_resources_memory();
+        usize remaining = unload_to_budget(total - m * 5 / 2);
+        ok(remaining <= total - m * 5 / 2 && remaining > total - m * 4,
+            "unload_to_budget unloads just enough"
+        );
+        ok(SharedResource(name(0))->state() == RS::Loaded
+            && SharedResource(name(1))->state() == RS::Unloaded
+            && SharedResource(name(2))->state() == RS::Unloaded
+            && SharedResource(name(3))->state() == RS::Unloaded
+            && SharedResource(name(4))->state() == RS::Loaded,
+            "unload_to_budget unloads least recently used first"
+        );
+        is(resource_memory(SharedResource(name(1))), 0u,
+            "Unloaded resource uses no memory"
+        );
+        SharedResource kept (name(0));
+        unload_to_budget(0);
+        is(kept->state(), RS::Loaded, "unload_to_budget keeps rooted resources");
+        is(SharedResource(name(4))->state(), RS::Unloaded,
+            "unload_to_budget can unload everything else"
+        );
+        unload(kept);
+
+        SharedResource short_str (name(5), AnyVal::make<ayu::Document>());
+        short_str->value().as<ayu::Document>().new_<std::string>("short");
+        SharedResource long_str (name(6), AnyVal::make<ayu::Document>());
+        long_str->value().as<ayu::Document>().new_<std::string>(
+            "twenty characters..."
+        );
+        ok(resource_memory(long_str) >= resource_memory(short_str) + 20,
+            "resource_memory counts string just too long to store inline"
+        );
+        unload({short_str, long_str});
+
+        SharedResource target (
+            IRI("ayu-test:/budget-target.ayu"), AnyVal::make<ayu::Document>()
+        );
+        target->value().as<ayu::Document>().new_with_name<i32>("val", 1);
+        save(target);
+        unload(target);
+        {
+            SharedResource referrer (IRI("ayu-test:/budget-referrer.ayu"));
+            string_to_file(
+                "[ayu::Document {ref:[i32* budget-target.ayu#/val+1]}]",
+                resource_filename(referrer->name())
+            );
+             // Loads target first
+            load(referrer);
+        }
+        SharedResource referrer (IRI("ayu-test:/budget-referrer.ayu"));
+        ResourceRef target_ref = target;
+        target = {}; referrer = {};
+        unload_to_budget(loaded_resources_memory() - 1);
+        ok(target_ref->state() == RS::Loaded,
+            "unload_to_budget doesn't unload resource referenced by loaded one"
+        );
+        target = target_ref;
+        ok(SharedResource(IRI("ayu-test:/budget-referrer.ayu"))->state()
+            == RS::Unloaded,
+            "unload_to_budget unloads referrer instead"
+        );
+        unload(target);
+        remove_source(target->name());
+        remove_source(IRI("ayu-test:/budget-referrer.ayu"));
+    }
+
+    done_testing();
+});
+
+#ifdef AYU_BENCHMARKS
+ // Returns how many seconds f() took.
+template <class F>
+static double seconds_for (F f) {
+    double start = uni::steady_clock();
+    f();
+    return uni::steady_clock() - start;
+}
+
+static tap::TestSet benchmarks ("dirt/ayu/resources/resource-bench", []{
+    using namespace tap;
+    test::TestEnvironment env;
+
+    {
+        constexpr u32 n = 64;
+        auto reses = test_documents("batch-", n,
+            [](ayu::Document& doc, u32 i){
+                for (u32 j = 0; j < 200; j++) {
+                    doc.new_<std::string>(cat("item ", i, ' ', j));
+                }
+            }
+        );
+        for (auto& res : reses) {
+            save(res);
+            unload(res);
+        }
+        auto refs = UniqueArray<ResourceRef>(n, [&](usize i){
+            return ResourceRef(reses[i]);
+        });
+        for (u32 threads : {1, 4}) {
+            double time = seconds_for([&]{ load(refs, threads); });
+            diag(cat("Loaded ", n, " resources on ", threads, " thread(s) in ",
+                time * 1000, "ms"
+            ));
+            unload(refs);
+        }
+        for (auto& res : reses) remove_source(res->name());
+    }
+    {
+        SharedResource res (
+            IRI("ayu-test:/cached.ayu"), AnyVal::make<ayu::Document>()
+        );
+        auto& doc = res->value().as<ayu::Document>();
+        for (u32 i = 0; i < 20000; i++) {
+            doc.new_<std::string>(cat("cached item ", i));
+        }
+        save(res);
+        unload(res);
+        auto source = resource_filename(res->name());
+        env.trs->cache_folder = iri::to_fs_path(env.trs->folder);
+        auto cache = env.trs->get_cache_file(res->name());
+        remove_utf8(cache.c_str());
+        double miss_time = seconds_for([&]{ load(res); });
+        unload(res);
+        double hit_time = seconds_for([&]{ load(res); });
+        unload(res);
+        diag(cat("Loaded with cache miss in ", miss_time * 1000,
+            "ms and cache hit in ", hit_time * 1000, "ms"
+        ));
+        double parse_time = seconds_for([&]{
+            for (u32 i = 0; i < 10; i++) tree_from_file_mapped(source);
+        });
+        double cached_time = seconds_for([&]{
+            for (u32 i = 0; i < 10; i++) tree_from_file_cached(source, cache);
+        });
+        diag(cat("Parsed in ", parse_time * 100, "ms and read from cache in ",
+            cached_time * 100, "ms"
+        ));
+        env.trs->cache_folder = "";
+        remove_source(res->name());
+        remove_utf8(cache.c_str());
+    }
+    {
+        constexpr u32 n = 100000;
+        UniqueArray<SharedResource> reses;
+        double created = seconds_for([&]{
+            reses = test_resources("bench/", n);
+        });
+        u32 mismatches = 0;
+        double looked_up = seconds_for([&]{
+            for (u32 i = 0; i < n; i++) {
+                SharedResource r (IRI(cat("ayu-test:/bench/", i, ".ayu")));
+                if (r != reses[i]) mismatches++;
+            }
+        });
+        double deleted = seconds_for([&]{ reses = {}; });
+        is(mismatches, 0u, "Looked up the right resources");
+        diag(cat(n, " resources: created in ", created * 1000,
+            "ms, looked up in ", looked_up * 1000,
+            "ms, deleted in ", deleted * 1000, "ms"
+        ));
+    }
+    {
+        constexpr u32 n = 10000;
+        auto reses = test_documents("unload-bench/", n,
+            [](ayu::Document& doc, u32 i){ doc.new_<i32>(i32(i)); }
+        );
+        double scanned = seconds_for([&]{ unload(reses[0]); });
+        double walked = seconds_for([&]{
+            for (u32 i = 1; i < 101; i++) unload(reses[i]);
+        });
+        diag(cat("Unloading 1 of ", n, " resources: ",
+            scanned * 1000, "ms with scan, ",
+            walked * 10, "ms without"
+        ));
+        for (auto& r : reses) unload(r);
+    }
+    {
+        constexpr u32 n = 10000;
+        auto reses = test_documents("reload-bench/", n,
+            [](ayu::Document& doc, u32 i){ doc.new_<i32>(i32(i)); }
+        );
+        SharedResource target (
+            IRI("ayu-test:/reload-target.ayu"), AnyVal::make<ayu::Document>()
+        );
+        target->value().as<ayu::Document>().new_with_name<i32>("val", 1);
+        save(target);
+         // Rescan to clean the resource graph.
+        unload(target);
+        SharedResource referrer (IRI("ayu-test:/reload-referrer.ayu"));
+        string_to_file(
+            "[ayu::Document {ref:[i32* reload-target.ayu#/val+1]}]",
+            resource_filename(referrer->name())
+        );
+        load(referrer);
+        set_reload_trusts_resource_graph(true);
+        double walked = seconds_for([&]{ reload(target); });
+        set_reload_trusts_resource_graph(false);
+        double scanned = seconds_for([&]{ reload(target); });
+        diag(cat("Reloading 1 of ", n, " resources: ",
+            scanned * 1000, "ms with scan, ",
+            walked * 1000, "ms without"
+        ));
+        unload(referrer);
+        unload(target);
+        for (auto& r : reses) unload(r);
+        remove_source(referrer->name());
+        remove_source(target->name());
+    }
+    {
+        constexpr u32 n = 64;
+        auto reses = test_documents("save-batch-", n,
+            [](ayu::Document& doc, u32 i){
+                for (u32 j = 0; j < 500; j++) {
+                    doc.new_<std::string>(cat("item ", j, " of ", i));
+                }
+            }
+        );
+        auto refs = UniqueArray<ResourceRef>(n, [&](usize i){
+            return ResourceRef(reses[i]);
+        });
+        double serial = seconds_for([&]{ save(refs, {}, 1); });
+        double parallel = seconds_for([&]{ save(refs, {}, 4); });
+        diag(cat("Saved ", n, " resources on 1 thread in ",
+            serial * 1000, "ms and on 4 threads in ", parallel * 1000, "ms"
+        ));
+        for (auto& res : reses) {
+            unload(res);
+            remove_source(res->name());
+        }
+    }
+
     done_testing();
 });
 #endif
+#endif
@@ -21,6 +21,9 @@ namespace ayu {
 enum class ResourceState : u8 {
      // This resource is not loaded and has an empty value.
     Unloaded,
+     // load_async has been called on this resource, but its value hasn't been
+     // deserialized yet.  Its value is empty.
+    LoadPending,
      // This resource is currently being loaded.  Its value exists but is
      // currently having item_from_tree run on it.
     Loading,
@@ -39,7 +42,8 @@ struct Resource : in::RefCounted {
     ResourceState state () const noexcept;
 
      // If the resource is RS::Unloaded, automatically loads the resource from
-     // disk.  Will throw if the load fails.  If a ResourceTransaction is
+     // disk.  If it's RS::LoadPending, waits for the background load to finish
+     // and deserializes it.  Will throw if the load fails.  If a ResourceTransaction is
      // currently active, the value will be cleared if the ResourceTransaction
      // is rolled back.
     AnyVal& value ();
@@ -128,23 +132,50 @@ using ResourceTransaction = Transaction<Resource>;
  // not RS::Unloaded.  Throws if the source doesn't exist or can't be read.
 void load (ResourceRef);
  // Load multiple resources.  If an error is thrown, none of the resources will
- // be loaded.
-inline void load (Slice<ResourceRef> rs) {
-    ResourceTransaction tr;
-    for (auto& r : rs) load(r);
+ // be loaded.  The files are read and parsed on up to this many worker threads
+ // (0 means one per core) while the main thread deserializes them in order, so
+ // resources that refer to each other are handled the same as when loading
+ // them one at a time.  ResourceScheme::get_file and get_format are called on
+ // the calling thread.
+void load (Slice<ResourceRef>, u32 threads = 0);
+
+ // Starts loading a resource in the background, and returns immediately.  Does
+ // nothing if the resource is not RS::Unloaded.  The resource becomes
+ // RS::LoadPending while its source is read and parsed on a background thread.
+ // Deserializing has to happen on the main thread, so the resource stays
+ // pending until one of these happens on the main thread:
+ //   - poll_async_loads() is called after the background thread is done.
+ //   - load() or Resource::value() is called on the resource, which waits for
+ //     the background thread if it's still working on it.
+ // The SharedResource serves as the handle; check its state() to see whether
+ // it's done.  force_unload() cancels a pending load.  Throws if there's no
+ // ResourceScheme for the resource; other errors are thrown when the load is
+ // finished.
+void load_async (ResourceRef);
+inline void load_async (Slice<ResourceRef> rs) {
+    for (auto& r : rs) load_async(r);
 }
+ // Finishes all pending loads whose sources have been read, in the order they
+ // were started.  Call this periodically from the main loop.  If one of them
+ // fails, that resource goes back to RS::Unloaded and the exception is thrown
+ // (any later loads stay pending until the next call).  Returns the number of
+ // loads still pending.
+usize poll_async_loads ();
 
  // Saves a loaded resource to its source.  Throws if the resource is not
- // RS::Loaded.  May overwrite an existing file.  If called in a
- // ResourceTransaction, no files will actually be written until the transaction
- // succeeds.
+ // RS::Loaded.  May overwrite an existing file.  The file is written under a
+ // temporary name and then renamed over the old one, so a crash while saving
+ // won't leave a partly-written file behind (see AtomicFile in uni/io.h).  If
+ // ResourceScheme::sync_on_save returns true, also waits for the file to reach
+ // the disk.  If called in a ResourceTransaction, the temporary file is
+ // written and closed now, but it won't replace the old file until the
+ // transaction succeeds.  If that rename fails, it's too late to throw, so a
+ // warning is printed instead.
 void save (ResourceRef, PrintOptions opts = {});
  // Save multiple resources.  If an error is thrown, none of the resources will
- // be saved.
-inline void save (Slice<ResourceRef> rs, PrintOptions opts = {}) {
-    ResourceTransaction tr;
-    for (auto& r : rs) save(r, opts);
-}
+ // be saved.  The resources are serialized on the calling thread, but printed
+ // on up to this many worker threads (0 means one per core).
+void save (Slice<ResourceRef>, PrintOptions opts = {}, u32 threads = 0);
 
  // Attempts to unload the given resources and any resources that are not
  // currently reachable.  Essentially, this does a garbage collection on all
@@ -170,6 +201,15 @@ inline void save (Slice<ResourceRef> rs, PrintOptions opts = {}) {
  // arguments in the same call or from having no SharedResource handles pointing
  // to them).
  //
+ // To find which resources are reachable, unload() uses a graph of references
+ // between resources that is recorded as resources are loaded (or as anything
+ // is deserialized into them), so it doesn't usually have to look at the
+ // resources' values.  The graph is rebuilt by scanning every loaded resource
+ // if it might be out of date (after set_value, rename, force_unload, or a
+ // rollback) or if there are any tracked items.  If you write a reference to
+ // another resource's item into a resource's value yourself, call
+ // invalidate_resource_graph() before the next unload().
+ //
  // This operation is fully transactional.  If a recoverable error occurs, no
  // resources will be unloaded.  If called during a ResourceTransaction and the
  // transaction rolls back, all the unloaded resources will be restored to their
@@ -178,6 +218,33 @@ void unload (ResourceRef);
 void unload (Slice<ResourceRef> = {});
 inline void unload (ResourceRef r) { unload(Slice<ResourceRef>(&r, 1)); }
 
+ // Makes the next unload() rescan all loaded resources for references to
+ // each other.
+void invalidate_resource_graph () noexcept;
+
+ // Estimates how many bytes of memory a loaded resource is using (0 if it isn't
+ // loaded).  This walks the resource's value with scan_resource_pointers,
+ // counting the size of every item that isn't stored inside its parent item,
+ // plus the buffers of std::strings.  Other memory the value owns that isn't
+ // visible as items (like spare capacity in vectors) isn't counted.  The result
+ // is cached until the resource's value is replaced (by load, reload,
+ // set_value, etc.), so if you change a value a lot in place, pass recalculate
+ // = true.
+usize resource_memory (ResourceRef, bool recalculate = false);
+ // Sum of resource_memory() for all loaded resources.
+usize loaded_resources_memory ();
+
+ // Unloads resources that unload() would consider unreachable, in order of
+ // least recently used first, until loaded_resources_memory() is at most
+ // budget.  A resource is used when it's loaded and when its value() is
+ // accessed.  Unreachable resources that are referenced by other unreachable
+ // resources are only unloaded after those are (so unreachable reference
+ // cycles are never unloaded by this; use unload() for those).  This lets you
+ // keep resources you aren't holding SharedResource handles to cached while
+ // staying within a memory budget.  Returns the memory remaining, which may
+ // still be over budget if the rest is all reachable.
+usize unload_to_budget (usize budget);
+
  // Immediately unloads the resource without checking for reachability.  This is
  // faster, but if there are any references to items in this resource, they will
  // be left dangling.  This can still be rolled back by a ResourceTransaction.
@@ -194,7 +261,8 @@ inline void force_unload (Slice<ResourceRef> rs) noexcept {
  //     and updates them to point to the new value instead of the old one.  If a
  //     reference would become invalid or cannot be updated, the reload is
  //     cancelled, the resource's old value is restored, and ReloadWouldBreak is
- //     thrown.
+ //     thrown.  All loaded resources are scanned unless
+ //     set_reload_trusts_resource_graph(true) has been called.
  //   4. Destroys the old value.
  //
  // This operation is fully transactional.  If a recoverable exception is thrown
@@ -207,6 +275,27 @@ void reload (ResourceRef);
 void reload (Slice<ResourceRef>);
 inline void reload (ResourceRef r) { reload(Slice<ResourceRef>(&r, 1)); }
 
+ // If set to true, reload() only scans the reloaded resources, tracked items,
+ // and resources that the resource graph (see unload()) says refer to the
+ // reloaded resources, instead of all loaded resources.  This is much faster
+ // when a lot of resources are loaded, but the resource graph only knows about
+ // references that were deserialized (or found by a rescan), so if your
+ // program writes a reference to another resource's item into a resource's
+ // value, you must call invalidate_resource_graph() before the next reload(),
+ // or that reference will be left dangling.  Defaults to false.
+void set_reload_trusts_resource_graph (bool) noexcept;
+bool reload_trusts_resource_graph () noexcept;
+
+ // Sets how many threads unload(), reload(), and building route caches for
+ // find_pointer and friends may use to scan loaded resources (0 means one per
+ // core).  The default is 1, which scans everything on the calling thread.
+ // Only raise this if every description used in your resources can have its
+ // accessors (including value_funcs, mixed_funcs, computed_attrs,
+ // computed_elems, and keys functions) called from multiple threads at once,
+ // as described for the parallel scans in traversal/scan.h.
+void set_resource_scan_threads (u32 threads) noexcept;
+u32 resource_scan_threads () noexcept;
+
 ///// RESOURCE FILE MANIPULATION (NON-TRANSACTIONAL)
 
  // Moves old_res's value to new_res.  Does not change the names of any Resource
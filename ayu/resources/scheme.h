@@ -6,11 +6,29 @@
 #pragma once
 #include "../../iri/iri.h"
 #include "../../iri/path.h"
+#include "../../uni/hash.h"
+#include "../../uni/io.h"
 #include "../common.h"
 #include "../reflection/type.h"
 
 namespace ayu {
 
+ // How a resource's file is encoded.  Binary is the ayub format from
+ // ../data/binary.h.
+enum class ResourceFormat : u8 {
+    Text,
+    Binary,
+};
+
+ // The contents of a resource's source, for resource schemes that don't keep
+ // each resource in a separate file.  contents must point into mapping, which
+ // keeps it alive.  Text sources are parsed without copying strings out of
+ // the mapping.
+struct ResourceSource {
+    SharedMapping mapping;
+    Str contents;
+};
+
  // Registers a resource scheme at startup.  The path parameter passed to all
  // the virtual methods is just the path part of the name, and is always
  // canonicalized and absolute.
@@ -43,7 +61,28 @@ struct ResourceScheme {
      // valid filename for this IRI.  It is okay to return non-existent
      // filenames.
     virtual AnyString get_file (const IRI&) const { return ""; }
-     // TODO: Non-file resource schemes
+     // Which format to read and write this resource's file in.  The default
+     // picks Binary for names ending in .ayub and Text for everything else.
+    virtual ResourceFormat get_format (const IRI& iri) const {
+        Str path = iri.path();
+        return path.size() >= 5 && path.slice(path.size() - 5) == ".ayub"
+            ? ResourceFormat::Binary : ResourceFormat::Text;
+    }
+     // If this returns a filename, text resources will be loaded through a
+     // cache of their parsed trees stored in that file (see
+     // tree_from_file_cached in ../data/binary.h).  The default returns "",
+     // meaning no cache.
+    virtual AnyString get_cache_file (const IRI&) const { return ""; }
+     // If this returns true, save() will wait for this resource's file to be
+     // flushed to disk (with fsync or equivalent), so that it survives an OS
+     // crash or power failure.  This is much slower, so the default is false.
+    virtual bool sync_on_save (const IRI&) const { return false; }
+     // Schemes whose resources aren't separate files can override this to
+     // provide a resource's source directly (see ResourceSource).  The
+     // default returns an empty ResourceSource, meaning the source should be
+     // read from get_file().  This is always called on the main thread, though
+     // the contents may be parsed on another thread.
+    virtual ResourceSource get_source (const IRI&) const { return {}; }
 
     explicit ResourceScheme (AnyString n, bool auto_activate = true) :
         name(move(n))
@@ -79,6 +118,9 @@ constexpr ErrorCode e_ResourceSchemeNotFound = "ayu::e_ResourceSchemeNotFound";
 struct FolderResourceScheme : ResourceScheme {
      // Must be a file:/ IRI
     IRI folder;
+     // If not empty, a folder to put parse caches in (see get_cache_file).
+     // Caches are named after a hash of the source's filename.
+    AnyString cache_folder;
 
     bool accepts_name (const IRI& iri) const override {
         return !iri.has_authority() && !iri.has_query()
@@ -91,6 +133,11 @@ struct FolderResourceScheme : ResourceScheme {
         return iri::to_fs_path(abs);
     }
 
+    AnyString get_cache_file (const IRI& iri) const override {
+        if (!cache_folder) return "";
+        return cat(cache_folder, '/', hash64(get_file(iri)), ".ayuc");
+    }
+
     FolderResourceScheme (
         AnyString n, Str folder, bool auto_activate = true
     ) :
@@ -1,14 +1,48 @@
  // The "Universe" manages the set of loaded resources and related global data.
 
 #pragma once
+#include <algorithm>
+#include <bit>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 #include "../../uni/indestructible.h"
 #include "../common.h"
+#include "../reflection/anyptr.h"
+#include "../traversal/route.h"
 #include "resource.h"
 #include "scheme.h"
 
 namespace ayu::in {
 
+ // Sorted by AnyPtr for binary search.  Stores a typed AnyPtr instead of a Mu*
+ // because items at the same address with different types are different items.
+using RouteCache = UniqueArray<Pair<AnyPtr, SharedRoute>>;
+
+ // One step of a route being resolved, for the resolution cache (see
+ // KeepResolutionCache).  parent is the cached reference to the parent item, or
+ // null if the parent is the resource's value.
+struct ResolutionKey {
+    const AnyRef* parent;
+    RouteForm form;
+    u32 index;
+    AnyString key;
+
+    friend bool operator== (
+        const ResolutionKey&, const ResolutionKey&
+    ) = default;
+};
+struct ResolutionKeyHash {
+    usize operator () (const ResolutionKey& k) const {
+        return hash_combine(
+            hash_combine(std::hash<const AnyRef*>{}(k.parent), usize(k.form)),
+            k.form == RF::Key ? hash(Str(k.key)) : usize(k.index)
+        );
+    }
+};
+using ResolutionCache =
+    std::unordered_map<ResolutionKey, AnyRef, ResolutionKeyHash>;
+
 struct ResourceData : Resource {
     ResourceState state = RS::Unloaded;
      // These are only used during reachability scanning, but we have extra room
@@ -21,36 +55,151 @@ struct ResourceData : Resource {
     u32 node_id;
     IRI name;
     AnyVal value {};
+     // Other resources that this one refers to, recorded as references are
+     // deserialized into it (see record_resource_reference).  This may still
+     // contain resources that are no longer referred to, but unless
+     // universe().resource_graph_dirty is set, it won't be missing any.
+    UniqueArray<ResourceRef> refs_out;
+     // Cached result of resource_memory(), or 0 if it hasn't been calculated
+     // for the current value.  Reset whenever value is replaced.
+    usize memory = 0;
+     // When this was last loaded or had its value accessed, according to
+     // universe().use_clock.  Used to pick resources for unload_to_budget().
+    u64 last_used = 0;
+     // Routes to all addressable items in value, for find_pointer (see
+     // KeepRouteCache).  Built the first time it's needed and kept until
+     // value is replaced or invalidate_route_cache() is called.
+    RouteCache route_cache;
+    bool have_route_cache = false;
+     // Which KeepRouteCache session route_cache was built in.
+    u32 route_cache_session = 0;
+     // References found by reference_from_route while a KeepResolutionCache
+     // is alive.
+    ResolutionCache resolution_cache;
     ResourceData (const IRI& n) : name(n) { }
+
+     // Call whenever value is replaced or destroyed, to drop everything that
+     // was calculated from it.
+    void forget_value_caches () noexcept {
+        memory = 0;
+        route_cache = {};
+        have_route_cache = false;
+        resolution_cache.clear();
+    }
 };
 
 struct Universe {
+     // All resources in the order they were created.  Deleting a resource
+     // leaves a null entry behind instead of shifting the rest of the array
+     // down, so that positions in resource_index stay valid.  Skip null entries
+     // when iterating.  The array is compacted when more than half of it is
+     // null.
     UniqueArray<Hashed<ResourceRef>> resources;
+     // Open-addressed hash table of positions in resources plus one, so that
+     // 0 is an empty slot.  Kept at most half full.
+    UniqueArray<u32> resource_index;
+    u32 dead_resources = 0;
+     // Set when references between resources may have changed without being
+     // recorded in refs_out, so unload() can't trust the resource graph and has
+     // to scan the values of all loaded resources.  Cleared by that scan.
+    bool resource_graph_dirty = false;
+     // See set_reload_trusts_resource_graph().
+    bool reload_trusts_resource_graph = false;
+     // See set_resource_scan_threads().  0 means one per core.
+    u32 scan_threads = 1;
+     // Incremented whenever a resource newly becomes loaded, so that
+     // ResourceWatchers can tell when there are new files to watch.
+    u64 load_count = 0;
+     // Ticks whenever a resource is used, to order ResourceData::last_used.
+    u64 use_clock = 0;
     UniqueArray<Hashed<const ResourceScheme*>> schemes;
     UniqueArray<AnyPtr> tracked;
+     // Resources whose resolution_cache may be non-empty, to be cleared when
+     // the last KeepResolutionCache is destroyed.
+    UniqueArray<SharedResource> resolution_cached;
+
+     // How many threads to use for an internal scan of n resources.
+    u32 scan_threads_for (usize n) const {
+        u32 threads = scan_threads
+            ? scan_threads : std::thread::hardware_concurrency();
+        return std::max<usize>(std::min<usize>(threads, n), 1);
+    }
 
     ResourceRef get_resource (const IRI& name) {
         Str spec = expect(name.spec());
         expect(spec.begin() < spec.end());
         usize h = uni::hash(spec);
 
-        for (auto& r : resources) {
-            if (r.hash == h && r.value->name().spec_ == spec) {
-                return r.value;
+        usize mask = resource_index.size() - 1;
+        if (resource_index) {
+            for (usize i = h & mask;; i = (i + 1) & mask) {
+                u32 s = resource_index[i];
+                if (!s) break;
+                auto& r = resources[s - 1];
+                if (r.hash == h && r.value->name().spec_ == spec) {
+                    return r.value;
+                }
             }
         }
+        usize live = resources.size() - dead_resources;
+        if ((live + 1) * 2 > resource_index.size()) {
+            rebuild_resource_index(live + 1);
+            mask = resource_index.size() - 1;
+        }
         auto data = new ResourceData(name);
-        return resources.emplace_back(h, data).value;
+        resources.emplace_back(h, data);
+        usize i = h & mask;
+        while (resource_index[i]) i = (i + 1) & mask;
+        resource_index[i] = resources.size();
+        return data;
     }
+
     void delete_resource (ResourceRef r) {
-        for (auto& e : resources) {
-            if (e.value == r) {
-                resources.erase(&e);
-                delete r.data;
-                return;
+        usize h = uni::hash(static_cast<ResourceData*>(r.data)->name.spec());
+        usize mask = resource_index.size() - 1;
+        usize i = h & mask;
+        for (;; i = (i + 1) & mask) {
+            u32 s = require(resource_index[i]);
+            if (resources[s - 1].value == r) {
+                resources[s - 1].value = null;
+                dead_resources++;
+                break;
+            }
+        }
+         // Backward-shift deletion.  Move later entries in this probe sequence
+         // into the hole unless that would put them before their home slot.
+        for (usize j = (i + 1) & mask;; j = (j + 1) & mask) {
+            u32 s = resource_index[j];
+            if (!s) break;
+            usize home = resources[s - 1].hash & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                resource_index[i] = s;
+                i = j;
+            }
+        }
+        resource_index[i] = 0;
+        delete r.data;
+        if (dead_resources > resources.size() / 2) {
+            usize live = 0;
+            for (auto& e : resources) {
+                if (e.value) resources[live++] = e;
             }
+            resources.shrink(live);
+            dead_resources = 0;
+            rebuild_resource_index(live);
+        }
+    }
+
+    void rebuild_resource_index (usize live) {
+        usize slots = std::bit_ceil(std::max<usize>(live * 2, 16));
+        resource_index = UniqueArray<u32>(slots, 0);
+        usize mask = slots - 1;
+        for (u32 p = 0; p < resources.size(); p++) {
+            if (!resources[p].value) continue;
+            usize i = resources[p].hash & mask;
+            while (resource_index[i]) i = (i + 1) & mask;
+            resource_index[i] = p + 1;
         }
-        require(false);
     }
 
     void register_scheme (const ResourceScheme* scheme) {
@@ -93,5 +242,14 @@ inline Universe& universe () {
     return *r;
 }
 
+ // Called when a reference to something in the resource to is deserialized into
+ // the resource from.
+inline void record_resource_reference (ResourceRef from, ResourceRef to) {
+    if (from == to) return;
+    auto& refs = static_cast<ResourceData*>(from.data)->refs_out;
+    for (auto r : refs) if (r == to) return;
+    refs.push_back(to);
+}
+
 } // namespace ayu::in
 
@@ -0,0 +1,320 @@
+#include "watch.h"
+#include <cstring>
+#include "../../uni/io.h"
+#include "../../uni/time.h"
+#include "universe.private.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace ayu {
+namespace in {
+
+#ifdef __linux__
+struct WatchedFolder {
+    int wd;
+    AnyString path;
+};
+#else
+struct PolledFile {
+    AnyString filename;
+    uni::FileInfo info;
+};
+#endif
+
+ // Returns "" if the resource's scheme doesn't give it a file (or has been
+ // deactivated).
+static AnyString watched_file (ResourceRef res) {
+    auto data = static_cast<ResourceData*>(res.data);
+    Str scheme = data->name.scheme();
+    for (auto& s : universe().schemes) {
+        if (s.value->name == scheme) return s.value->get_file(data->name);
+    }
+    return "";
+}
+
+} using namespace in;
+
+struct ResourceWatcher::Data {
+     // The universe's load_count when we last looked for files to watch.
+    u64 load_count = u64(-1);
+     // Filenames that changed since the last reload, in no particular order.
+    UniqueArray<AnyString> changed;
+     // If we lost track of which files changed, reload all of them.
+    bool all_changed = false;
+    double last_change = 0;
+#ifdef __linux__
+    int fd;
+    UniqueArray<WatchedFolder> folders;
+#else
+    UniqueArray<PolledFile> files;
+    double last_check = -1e300;
+#endif
+
+    void add_change (AnyString filename) {
+        last_change = uni::steady_clock();
+        for (auto& c : changed) if (c == filename) return;
+        changed.push_back(move(filename));
+    }
+
+#ifdef __linux__
+    void watch_folders () {
+        auto& u = universe();
+        if (load_count == u.load_count) return;
+        load_count = u.load_count;
+        for (auto& [h, res] : u.resources) {
+            if (!res || res->state() != RS::Loaded) continue;
+            AnyString file = watched_file(res);
+            usize slash = file.size();
+            while (slash && file[slash - 1] != '/') slash--;
+            if (!slash) continue;
+            Str folder = file.slice(0, slash - 1);
+             // Resources in the same folder tend to be next to each other.
+            if (folders && folders.back().path == folder) continue;
+            for (auto& f : folders) if (f.path == folder) goto next;
+            {
+                int wd = inotify_add_watch(
+                    fd, UniqueString(folder).c_str(),
+                    IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO
+                );
+                 // If the folder doesn't exist, try again the next time
+                 // something is loaded.
+                if (wd >= 0) folders.push_back(WatchedFolder{wd, folder});
+            }
+            next:;
+        }
+    }
+
+    void collect_changes (double) {
+        watch_folders();
+        alignas(inotify_event) char buf[4096];
+        for (;;) {
+            isize n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (char* p = buf; p < buf + n;) {
+                auto e = reinterpret_cast<inotify_event*>(p);
+                p += sizeof(inotify_event) + e->len;
+                if (e->mask & IN_Q_OVERFLOW) {
+                    all_changed = true;
+                    last_change = uni::steady_clock();
+                }
+                else if (e->mask & IN_IGNORED) {
+                     // The folder was deleted or moved.  Look for it again
+                     // next time.
+                    for (auto& f : folders) if (f.wd == e->wd) {
+                        folders.erase(&f);
+                        break;
+                    }
+                    load_count = u64(-1);
+                }
+                else if (e->len) for (auto& f : folders) if (f.wd == e->wd) {
+                    add_change(cat(f.path, '/', Str(e->name)));
+                    break;
+                }
+            }
+        }
+    }
+#else
+    void watch_files () {
+        auto& u = universe();
+        if (load_count == u.load_count) return;
+        load_count = u.load_count;
+        UniqueArray<PolledFile> old = move(files);
+        usize o = 0;
+        for (auto& [h, res] : u.resources) {
+            if (!res || res->state() != RS::Loaded) continue;
+            AnyString file = watched_file(res);
+            if (!file) continue;
+             // Keep the old info for files we were already watching, so
+             // changes between the last check and now aren't missed.  The
+             // resource array keeps its order, so look where we left off
+             // first.
+            for (usize i = 0; i < old.size(); i++) {
+                usize j = (o + i) % old.size();
+                if (old[j].filename == file) {
+                    files.push_back(move(old[j]));
+                    old.erase(j);
+                    o = old.size() ? j % old.size() : 0;
+                    goto next;
+                }
+            }
+            {
+                uni::FileInfo info {};
+                uni::stat_utf8(file.c_str(), info);
+                files.push_back(PolledFile{move(file), info});
+            }
+            next:;
+        }
+    }
+
+    void collect_changes (double settle_time) {
+         // Start watching new files right away, so that changes made soon
+         // after they're loaded aren't missed.
+        watch_files();
+        double now = uni::steady_clock();
+        if (now - last_check < settle_time) return;
+        last_check = now;
+        for (auto& f : files) {
+            uni::FileInfo info {};
+            uni::stat_utf8(f.filename.c_str(), info);
+            if (info.size != f.info.size || info.mtime != f.info.mtime) {
+                f.info = info;
+                add_change(f.filename);
+            }
+        }
+    }
+#endif
+};
+
+ResourceWatcher::ResourceWatcher (double s) : settle_time(s) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        raise(e_ResourceWatchFailed, cat(
+            "Failed to initialize inotify: ", std::strerror(errno)
+        ));
+    }
+    data = new Data;
+    data->fd = fd;
+#else
+    data = new Data;
+#endif
+    data->collect_changes(settle_time);
+}
+
+ResourceWatcher::~ResourceWatcher () {
+#ifdef __linux__
+    close(data->fd);
+#endif
+    delete data;
+}
+
+usize ResourceWatcher::poll () {
+    data->collect_changes(settle_time);
+    if (!data->changed && !data->all_changed) return 0;
+    if (uni::steady_clock() - data->last_change < settle_time) return 0;
+
+    auto changed = move(data->changed);
+    bool all = data->all_changed;
+    data->all_changed = false;
+    UniqueArray<ResourceRef> reses;
+    for (auto& [h, res] : universe().resources) {
+        if (!res || res->state() != RS::Loaded) continue;
+        AnyString file = watched_file(res);
+        if (!file) continue;
+        if (all) reses.push_back(res);
+        else for (auto& c : changed) if (c == file) {
+            reses.push_back(res);
+            break;
+        }
+    }
+    if (reses) reload(reses);
+    return reses.size();
+}
+
+void ResourceWatcher::discard_changes () {
+    data->collect_changes(0);
+    data->changed = {};
+    data->all_changed = false;
+}
+
+} using namespace ayu;
+
+#ifndef TAP_DISABLE_TESTS
+#include <thread>
+#include "../data/parse.h"
+#include "../test/test-environment.private.h"
+
+static tap::TestSet tests ("dirt/ayu/resources/watch", []{
+    using namespace tap;
+    test::TestEnvironment env;
+
+    auto make = [](Str name, i32 n){
+        SharedResource res (
+            IRI(cat("ayu-test:/", name)), AnyVal::make<ayu::Document>()
+        );
+        res->value().as<ayu::Document>().new_with_name<i32>("n", n);
+        save(res);
+        unload(res);
+        return res;
+    };
+    auto write = [](ResourceRef res, i32 n){
+        string_to_file(
+            cat("[ayu::Document {n:[i32 ", n, "] _next_id:0}]"),
+            resource_filename(res->name())
+        );
+    };
+    SharedResource a = make("watch-a.ayu", 1);
+    SharedResource b = make("watch-b.ayu", 1);
+    SharedResource c = make("watch-c.ayu", 1);
+    load(a); load(b); load(c);
+
+    ResourceWatcher watcher (0.05);
+     // Changes are noticed by the first poll after they happen, and reloaded
+     // by the first poll at least settle_time after that.  Poll against a
+     // deadline instead of sleeping for a fixed time, so a slow machine
+     // doesn't make these fail.
+    auto poll_until_reload = [&]() -> usize {
+        double start = uni::steady_clock();
+        for (;;) {
+            usize n = watcher.poll();
+            if (n || uni::steady_clock() - start > 10) return n;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    };
+     // For checking that nothing gets reloaded.  Returns how many resources
+     // were reloaded while polling for several times settle_time.
+    auto poll_for_a_while = [&]() -> usize {
+        usize n = 0;
+        double start = uni::steady_clock();
+        while (uni::steady_clock() - start < 0.2) {
+            n += watcher.poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return n;
+    };
+    is(watcher.poll(), 0u, "Nothing to reload at first");
+    write(a, 2);
+    is(watcher.poll(), 0u, "Doesn't reload before changes settle");
+    is(a["n"][1].get_as<i32>(), 1, "Resource isn't reloaded yet");
+    is(poll_until_reload(), 1u, "Reloads after changes settle");
+    is(a["n"][1].get_as<i32>(), 2, "Resource was reloaded");
+    is(poll_for_a_while(), 0u, "Doesn't reload again");
+
+    write(a, 3);
+    write(b, 3);
+    write(a, 4);
+    is(poll_until_reload(), 2u, "Burst of changes is reloaded in one batch");
+    is(a["n"][1].get_as<i32>(), 4, "Reloaded latest contents");
+    is(b["n"][1].get_as<i32>(), 3, "Reloaded other resource in batch");
+    is(c["n"][1].get_as<i32>(), 1, "Unchanged resource isn't reloaded");
+
+    *c->value().as<ayu::Document>().find_with_name("n").upcast_to<i32>() = 5;
+    save(c);
+    watcher.discard_changes();
+    is(poll_for_a_while(), 0u, "discard_changes ignores own saves");
+    is(c["n"][1].get_as<i32>(), 5, "Saved value wasn't reloaded");
+
+    SharedResource d = make("watch-d.ayu", 1);
+    load(d);
+    is(watcher.poll(), 0u, "Nothing to reload after loading new resource");
+    write(d, 2);
+    is(poll_until_reload(), 1u, "Newly loaded resource is watched");
+    is(d["n"][1].get_as<i32>(), 2, "Newly loaded resource was reloaded");
+
+    string_to_file("[ayu::Document {n:[i32 ", resource_filename(b->name()));
+    throws_code<e_ParseFailed>([&]{ poll_until_reload(); },
+        "Reload error is thrown from poll"
+    );
+    is(b["n"][1].get_as<i32>(), 3, "Failed reload keeps old value");
+    is(poll_for_a_while(), 0u, "Failed change isn't retried");
+
+    for (auto& res : {a, b, c, d}) {
+        unload(res);
+        remove_source(res->name());
+    }
+    done_testing();
+});
+#endif
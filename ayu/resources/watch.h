@@ -0,0 +1,53 @@
+// Watches the source files of loaded resources, and reloads resources when
+// their files change.  This is intended for editors and development builds,
+// where you want changes made in other programs to show up without restarting.
+//
+// On Linux this uses inotify on the folders containing loaded resources'
+// files.  On other platforms it falls back to checking the files' sizes and
+// modification times every settle_time seconds.
+
+#pragma once
+#include "../common.h"
+#include "resource.h"
+
+namespace ayu {
+
+struct ResourceWatcher {
+     // Files have to go this many seconds without changing before their
+     // resources are reloaded.  Programs often save files in several writes,
+     // and people often save several files in quick succession, so this
+     // gathers all of those changes into one reload.
+    double settle_time;
+
+     // Starts watching.  Resources that are loaded later will also be watched.
+    explicit ResourceWatcher (double settle_time = 0.2);
+    ~ResourceWatcher ();
+    ResourceWatcher (const ResourceWatcher&) = delete;
+    ResourceWatcher& operator= (const ResourceWatcher&) = delete;
+
+     // Call this periodically from the main loop.  Starts watching files of
+     // newly loaded resources and collects changes to watched files.  Once no
+     // watched file has changed for settle_time seconds, reloads every loaded
+     // resource whose file changed with a single call to reload(Slice), and
+     // returns the number of resources reloaded.  Changes are timed from the
+     // poll that notices them, so call this often (every frame is fine; it's
+     // cheap when nothing has changed).  If the reload throws, the changes are
+     // forgotten before the exception propagates, so a broken file won't be
+     // retried until it's changed again.
+     //
+     // Saving a resource also changes its file, so resources you save will be
+     // reloaded too.  Call discard_changes() after saving to avoid that.
+    usize poll ();
+
+     // Forgets about any changes collected so far, after first collecting any
+     // that haven't been noticed yet.
+    void discard_changes ();
+
+    struct Data;
+    Data* data;
+};
+
+ // Couldn't start watching for file changes.
+constexpr ErrorCode e_ResourceWatchFailed = "ayu::e_ResourceWatchFailed";
+
+} // namespace ayu
@@ -115,19 +115,25 @@ struct TraverseFromTree {
     NOINLINE static
     void do_swizzle_init (IFTContext& ctx) {
         if (ctx.swizzle_ops) {
-            ctx.swizzle_ops.consume([](SwizzleOp&& op){
-                expect(!op.base->parent());
-                CurrentBase curb (move(op.base));
-                try {
-                    op.item.modify(AccessCB(op, [](auto& op, Type, Mu* v){
-                        op.f(*v, op.tree);
-                    }));
-                }
-                catch (...) {
-                    rethrow_with_scanned_route(op.item);
-                }
-                expect(!op.base);
-            });
+            {
+                 // Swizzling resolves a lot of routes into the same resources.
+                 // Let go of the cache before running any inits, since those
+                 // may move things around.
+                KeepResolutionCache krc;
+                ctx.swizzle_ops.consume([](SwizzleOp&& op){
+                    expect(!op.base->parent());
+                    CurrentBase curb (move(op.base));
+                    try {
+                        op.item.modify(AccessCB(op, [](auto& op, Type, Mu* v){
+                            op.f(*v, op.tree);
+                        }));
+                    }
+                    catch (...) {
+                        rethrow_with_scanned_route(op.item);
+                    }
+                    expect(!op.base);
+                });
+            }
              // Swizzling might add more swizzle ops; this will happen if we're
              // swizzling a pointer which points to a separate resource; that
              // resource will be load()ed in op.f().
@@ -262,6 +268,8 @@ struct TraverseFromTree {
          // 4096 triggers some extra code on GCC
         constexpr usize stack_capacity_3 = 4080; // 1019 keys
 #endif
+         // The claim_attrs functions read the object's data directly.
+        force_Tree(*trav.tree);
         auto len = trav.tree->size;
         if (len <= stack_capacity_0 / 4 - 1) [[likely]] {
             use_attrs_stack<stack_capacity_0>(trav, attrs, len);
@@ -724,8 +732,10 @@ struct TraverseFromTree {
          // We're repeating the to_reference work if there's both a swizzle and
          // an init, but almost no types are going to have both.
         if (auto swizzle = desc->swizzle()) {
+             // Swizzling may be delayed until after the file this tree was
+             // parsed from is unmapped.
             auto& op = IFTContext::current->swizzle_ops.emplace_back(
-                current_base, AnyRef(), swizzle->f, *trav.tree
+                current_base, AnyRef(), swizzle->f, tree_unborrow(*trav.tree)
             );
             trav.to_reference(&op.item);
         }
@@ -3,6 +3,7 @@
 #include <charconv>
 #include "../../iri/iri.h"
 #include "../reflection/describe.h"
+#include "../resources/universe.private.h"
 #include "compound.h"
 #include "traversal.private.h"
 
@@ -23,12 +24,62 @@ void delete_Route (const Route* p) noexcept {
     }
 }
 
+ // Returns the cached reference for a route under a resource, resolving it and
+ // its parents if they aren't cached yet.  Returns null for the resource's
+ // value itself, which isn't cached (so that it still gets loaded if needed).
+static const AnyRef* cached_reference_from_route (
+    ResourceData* data, const AnyRef& value, RouteRef rt
+) {
+    if (rt->form == RF::Resource) return null;
+    RouteRef parent_rt = rt->parent();
+    const AnyRef* parent = cached_reference_from_route(data, value, parent_rt);
+    ResolutionKey k;
+    k.parent = parent;
+    k.form = rt->form;
+    if (rt->form == RF::Key) {
+        k.index = 0;
+        k.key = *rt->key();
+    }
+    else k.index = *rt->index();
+    auto iter = data->resolution_cache.find(k);
+    if (iter != data->resolution_cache.end()) return &iter->second;
+
+    const AnyRef& parent_ref = parent ? *parent : value;
+    AnyRef r = rt->form == RF::Key
+        ? item_attr(parent_ref, k.key, parent_rt)
+        : item_elem(parent_ref, k.index, parent_rt);
+    if (data->resolution_cache.empty()) {
+        universe().resolution_cached.emplace_back(data);
+    }
+     // Inserting doesn't move existing entries, so parent pointers in keys
+     // stay valid.
+    return &data->resolution_cache.emplace(move(k), move(r)).first->second;
+}
+
+void clear_resolution_caches () noexcept {
+    auto& reses = universe().resolution_cached;
+    for (auto& res : reses) {
+        static_cast<ResourceData*>(&*res)->resolution_cache.clear();
+    }
+    reses = {};
+}
+
 } using namespace in;
 
  // It would be nice to be able to use Traversal for this, but Routes are kind
  // of inside-out compared to traversals, so we'd have to reverse it first.
 AnyRef reference_from_route (RouteRef rt) {
     if (!rt) return AnyRef();
+    if (keep_resolution_cache_count && rt->parent()) {
+        RouteRef root = rt->root();
+        if (root->form == RF::Resource) {
+            ResourceRef res = root->resource();
+            AnyRef value = res->ref();
+            return *cached_reference_from_route(
+                static_cast<ResourceData*>(res.data), value, rt
+            );
+        }
+    }
     switch (rt->form) {
         case RF::Resource: return rt->resource()->ref();
         case RF::Reference: return *rt->reference();
@@ -159,6 +210,11 @@ SharedRoute route_from_iri (const IRI& iri) {
     }
     else {
         new (&r) SharedRoute(ResourceRef(root_iri));
+         // If we're deserializing into a resource, note the dependency for
+         // unload().
+        if (current_base && current_base->form == RF::Resource) {
+            record_resource_reference(current_base->resource(), r->resource());
+        }
     }
     if (p < end && *p != '/' && *p != '+') {
          // #foo is a shortcut for #/foo+1
@@ -254,6 +310,42 @@ static tap::TestSet tests ("dirt/ayu/traversal/route", []{
     ok(!r->parent(), "No parent at root");
     is(r.data, rt->root().data, "Route::root()");
 
+    {
+        SharedResource res (IRI("ayu-test:/testfile.ayu"));
+        auto data = static_cast<ResourceData*>(res.data.p);
+        auto foo = route_from_iri(IRI("ayu-test:/testfile.ayu#foo"));
+        AnyRef uncached = reference_from_route(foo);
+        {
+            KeepResolutionCache krc;
+            is(reference_from_route(foo), uncached,
+                "reference_from_route with resolution cache"
+            );
+            is(data->resolution_cache.size(), 2u,
+                "Resolution cache has route and its parent"
+            );
+            is(reference_from_route(
+                    route_from_iri(IRI("ayu-test:/testfile.ayu#foo"))
+                ), uncached,
+                "Resolution cache used for equivalent route"
+            );
+            is(data->resolution_cache.size(), 2u,
+                "Resolution cache didn't grow for equivalent route"
+            );
+            reload(res);
+            ok(data->resolution_cache.empty(),
+                "Resolution cache cleared on reload"
+            );
+            is(reference_from_route(foo).address_as<i32>(),
+                res["foo"][1].address_as<i32>(),
+                "Resolution after reload finds new value"
+            );
+        }
+        ok(data->resolution_cache.empty(),
+            "Resolution cache cleared after KeepResolutionCache"
+        );
+        unload(res);
+    }
+
     done_testing();
 });
 #endif
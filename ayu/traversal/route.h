@@ -98,6 +98,23 @@ struct RouteRef {
  // reference_to_route is in scan.h
 AnyRef reference_from_route (RouteRef);
 
+ // While this is alive, reference_from_route remembers the references it finds
+ // for items under resources, along with the references to their parents, so
+ // resolving many routes into the same resource doesn't walk the same attrs and
+ // elems over and over.  One of these is kept alive while item_from_tree is
+ // swizzling, which is when pointers and AnyRefs being loaded are resolved.  A
+ // resource's remembered references are thrown away when its value is replaced
+ // (by load, reload, unload, set_value, rename, or a rollback), and all of them
+ // are thrown away when the last KeepResolutionCache is destroyed.
+ //
+ // Like with KeepRouteCache, there's no way to notice when you modify a
+ // resource's value in place, so do not add, move, or remove items in a loaded
+ // resource while one of these is alive.
+struct KeepResolutionCache {
+    KeepResolutionCache ();
+    ~KeepResolutionCache ();
+};
+
 ///// IRI CONVERSION
 
  // Gets an IRI corresponding to the given Route.  If the root is a resource,
@@ -81,6 +81,18 @@ inline RouteRef Route::root () const noexcept {
     return r;
 }
 
+namespace in {
+    inline u32 keep_resolution_cache_count = 0;
+    void clear_resolution_caches () noexcept;
+}
+
+inline KeepResolutionCache::KeepResolutionCache () {
+    in::keep_resolution_cache_count++;
+}
+inline KeepResolutionCache::~KeepResolutionCache () {
+    if (!--in::keep_resolution_cache_count) in::clear_resolution_caches();
+}
+
 inline const IRI& current_base_iri () noexcept {
     static constexpr IRI empty;
     if (!current_base) return empty;
@@ -1,5 +1,11 @@
 #include "scan.h"
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "../../uni/lilac.h"
 #include "../reflection/anyptr.h"
 #include "../reflection/anyref.h"
 #include "../reflection/description.private.h"
@@ -15,7 +21,7 @@ struct ScanContext;
 
 struct ScanTraversalHead {
     ScanContext* context;
-    RouteRef rt;
+    const ScanRoute* rt;
 };
 
 template <class T = Traversal>
@@ -24,8 +30,114 @@ struct ScanTraversal : ScanTraversalHead, T { };
 struct ScanContext {
     CallbackRef<void(const ScanTraversal<>&)> cb;
     bool done = false;
+     // Skip subtrees that can't contain pointers or AnyRefs.
+    bool pruned = false;
 };
 
+ // Whether items of a type might contain pointers or AnyRefs, judging only by
+ // its description.  Children whose types can only be known at runtime (from
+ // computed attrs or elems, or from function accessors) are assumed to contain
+ // some.  Descriptions are constant, so finished results are cached on the side
+ // once for the whole program.  Each thread also keeps its own copy (with its
+ // in-progress entries) so that lookups during scans don't have to lock.
+enum class RefsSummary : u8 {
+    InProgress,
+    No,
+    Yes,
+};
+static thread_local
+std::unordered_map<const DescriptionPrivate*, RefsSummary> refs_summaries;
+static std::mutex shared_refs_summaries_mutex;
+ // Only grows, and only allocates under a MallocScope, so that threads other
+ // than the main one never touch lilac through it.
+static std::unordered_map<const DescriptionPrivate*, bool> shared_refs_summaries;
+
+static bool find_shared_refs_summary (const DescriptionPrivate* desc, bool& r) {
+    std::lock_guard lock (shared_refs_summaries_mutex);
+    auto it = shared_refs_summaries.find(desc);
+    if (it == shared_refs_summaries.end()) return false;
+    r = it->second;
+    return true;
+}
+
+static void publish_refs_summary (const DescriptionPrivate* desc, bool r) {
+    std::lock_guard lock (shared_refs_summaries_mutex);
+    lilac::MallocScope malloc_scope;
+    shared_refs_summaries.emplace(desc, r);
+}
+
+static bool desc_may_contain_refs (const DescriptionPrivate*, bool& cycle);
+
+static bool acr_may_contain_refs (const Accessor* acr, bool& cycle) {
+    switch (acr->form) {
+        case AF::Reinterpret: case AF::Member: case AF::RefFunc:
+        case AF::ConstantPtr: case AF::Variable: {
+            auto type = static_cast<const TypedAcr*>(acr)->type;
+            return desc_may_contain_refs(DescriptionPrivate::get(type), cycle);
+        }
+        default: return true;
+    }
+}
+
+static bool desc_may_contain_refs (
+    const DescriptionPrivate* desc, bool& cycle
+) {
+    if (desc == DescriptionPrivate::get(Type::For<AnyRef>()) ||
+        desc == DescriptionPrivate::get(Type::For<AnyPtr>())
+    ) return true;
+    auto [it, inserted] = refs_summaries.emplace(desc, RefsSummary::InProgress);
+     // References to elements are stable when the map grows, but iterators
+     // aren't, so only use the reference after the recursive calls.
+    auto& summary = it->second;
+    if (!inserted) {
+        if (summary == RefsSummary::InProgress) [[unlikely]] {
+             // A cycle doesn't add anything by itself, but anything we
+             // calculate while in it is incomplete, so don't cache that.
+            cycle = true;
+            return false;
+        }
+        return summary == RefsSummary::Yes;
+    }
+    bool r = false;
+    if (find_shared_refs_summary(desc, r)) {
+        summary = r ? RefsSummary::Yes : RefsSummary::No;
+        return r;
+    }
+    bool child_cycle = false;
+     // Scans don't look under these.
+    if (desc->type_flags % TypeFlags::NoRefsToChildren) { }
+    else if (desc->keys_acr() || desc->length_acr()) r = true;
+    else {
+        if (auto attrs = desc->attrs()) {
+            for (u32 i = 0; !r && i < attrs->n_attrs; i++) {
+                r = acr_may_contain_refs(attrs->attr(i)->acr(), child_cycle);
+            }
+        }
+        if (auto elems = desc->elems()) {
+            for (u32 i = 0; !r && i < elems->n_elems; i++) {
+                r = acr_may_contain_refs(elems->elem(i)->acr(), child_cycle);
+            }
+        }
+        if (auto acr = desc->delegate_acr(); !r && acr) {
+            r = acr_may_contain_refs(acr, child_cycle);
+        }
+    }
+    if (r || !child_cycle) {
+        summary = r ? RefsSummary::Yes : RefsSummary::No;
+        publish_refs_summary(desc, r);
+    }
+    else {
+        cycle = true;
+        refs_summaries.erase(desc);
+    }
+    return r;
+}
+
+static bool may_contain_refs (Type type) {
+    bool cycle = false;
+    return desc_may_contain_refs(DescriptionPrivate::get(type), cycle);
+}
+
 struct TraverseScan {
 
     static
@@ -41,7 +153,7 @@ struct TraverseScan {
                 cb, [](auto& cb, const ScanTraversal<>& trav) {
                     if (!(trav.caps % AC::AddressChildren)) return;
                     bool done = trav.caps % AC::Address &&
-                        cb(AnyPtr(trav.type, trav.address, trav.caps), trav.rt);
+                        cb(AnyPtr(trav.type, trav.address, trav.caps), *trav.rt);
                     if (done) [[unlikely]] trav.context->done = true;
                     else after_cb(trav);
                 }
@@ -49,9 +161,10 @@ struct TraverseScan {
         };
          // Don't set the current base when scanning.  The scanning process was
          // likely started implicitly and shouldn't need it.
+        ScanRoute base (base_rt);
         ScanTraversal<StartTraversal> child;
         child.context = &ctx;
-        child.rt = base_rt;
+        child.rt = &base;
         child.collapse_optional = false;
         trav_start<visit>(child, base_item, AC::Read);
         currently_scanning = false;
@@ -61,14 +174,14 @@ struct TraverseScan {
     static
     bool start_references (
         const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb,
-        bool ignore_no_refs_to_children
+        bool ignore_no_refs_to_children, bool pruned
     ) {
         using CBCB = void(decltype(cb)&, const ScanTraversal<>&);
         CBCB* cbcb = [](auto& cb, const ScanTraversal<>& trav) {
             bool done; {
                 AnyRef ref;
                 trav.to_reference(&ref);
-                done = cb(ref, trav.rt);
+                done = cb(ref, *trav.rt);
             }
             if (done) [[unlikely]] trav.context->done = true;
             else after_cb(trav);
@@ -77,7 +190,7 @@ struct TraverseScan {
             bool done; {
                 AnyRef ref;
                 trav.to_reference(&ref);
-                done = cb(ref, trav.rt);
+                done = cb(ref, *trav.rt);
             }
             if (done) [[unlikely]] trav.context->done = true;
             else after_cb_ignoring_no_refs_to_children(trav);
@@ -87,9 +200,11 @@ struct TraverseScan {
                 cb, ignore_no_refs_to_children ? cbcb_ignore : cbcb
             )
         };
+        ctx.pruned = pruned;
+        ScanRoute base (base_rt);
         ScanTraversal<StartTraversal> child;
         child.context = &ctx;
-        child.rt = base_rt;
+        child.rt = &base;
         child.collapse_optional = false;
         child.collapsed_elem_shift = 0;
         trav_start<visit>(child, base_item, AC::Read);
@@ -111,6 +226,7 @@ struct TraverseScan {
         if (desc->type_flags % TypeFlags::NoRefsToChildren) {
             return;
         }
+        if (trav.context->pruned && !may_contain_refs(trav.type)) return;
         if (desc->preference() == DescFlags::PreferObject) {
             if (auto keys = desc->keys_acr()) {
                 use_computed_attrs(trav, keys);
@@ -160,23 +276,17 @@ struct TraverseScan {
             auto attr = attrs->attr(i);
              // Scan invisible attrs as well
             auto acr = attr->acr();
-            SharedRoute child_rt;
+            ScanRoute child_rt (*trav.rt, attr->key);
              // TODO: verify that the child item is object-like.
             ScanTraversal<AttrTraversal> child;
             child.context = trav.context;
-            if (acr->attr_flags % AttrFlags::Collapse) {
-                 // Behave as though all collapsed attrs are collapsed (leave
-                 // out the route segment for the collapsed attr).
-                child.rt = trav.rt;
-            }
-            else {
-                child_rt = SharedRoute(trav.rt, attr->key);
-                child.rt = child_rt;
-            }
+             // Behave as though all collapsed attrs are collapsed (leave out
+             // the route segment for the collapsed attr).
+            child.rt = acr->attr_flags % AttrFlags::Collapse
+                ? trav.rt : &child_rt;
             child.collapse_optional = acr->attr_flags % AttrFlags::CollapseOptional;
             child.collapsed_elem_shift = 0;
             trav_attr<visit>(child, trav, acr, attr->key, AC::Read);
-            child_rt = {};
             if (child.context->done) [[unlikely]] return;
         }
     }
@@ -198,10 +308,10 @@ struct TraverseScan {
         for (auto& key : keys) {
             auto ref = f(*trav.address, key);
             if (!ref) raise_AttrNotFound(trav.type, key);
-            auto child_rt = SharedRoute(trav.rt, key);
+            ScanRoute child_rt (*trav.rt, key);
             ScanTraversal<ComputedAttrTraversal> child;
             child.context = trav.context;
-            child.rt = child_rt;
+            child.rt = &child_rt;
             child.collapse_optional = false;
             child.collapsed_elem_shift = 0;
             trav_computed_attr<visit>(
@@ -216,7 +326,7 @@ struct TraverseScan {
         for (u32 i = 0; i < elems->n_elems; i++) {
             auto elem = elems->elem(i);
             auto acr = elem->acr();
-            SharedRoute child_rt;
+            ScanRoute child_rt (*trav.rt, i + trav.collapsed_elem_shift);
             ScanTraversal<ElemTraversal> child;
             child.context = trav.context;
             child.collapsed_elem_shift = trav.collapsed_elem_shift;
@@ -239,10 +349,7 @@ struct TraverseScan {
                 }
                 child.rt = trav.rt;
             }
-            else {
-                child_rt = SharedRoute(trav.rt, i + trav.collapsed_elem_shift);
-                child.rt = child_rt;
-            }
+            else child.rt = &child_rt;
             child.collapse_optional = false;
             trav_elem<visit>(child, trav, acr, i, AC::Read);
             if (child.context->done) [[unlikely]] return;
@@ -259,7 +366,7 @@ struct TraverseScan {
         for (u32 i = 0; i < len; i++) {
             auto ref = f(*trav.address, i);
             if (!ref) raise_ElemNotFound(trav.type, i);
-            SharedRoute child_rt;
+            ScanRoute child_rt (*trav.rt, i + trav.collapsed_elem_shift);
             ScanTraversal<ComputedElemTraversal> child;
             child.context = trav.context;
             if (trav.collapse_optional) {
@@ -268,16 +375,12 @@ struct TraverseScan {
                 }
                 child.rt = trav.rt;
             }
-            else {
-                child_rt = SharedRoute(trav.rt, i + trav.collapsed_elem_shift);
-                child.rt = child_rt;
-            }
+            else child.rt = &child_rt;
             child.collapse_optional = false;
             child.collapsed_elem_shift = 0;
             trav_computed_elem<visit>(
                 child, trav, ref, f, i, AC::Read
             );
-            child_rt = {};
             if (child.context->done) [[unlikely]] return;
         }
     }
@@ -291,8 +394,11 @@ struct TraverseScan {
         if (!len) return;
         auto f = expect(trav.desc()->contiguous_elems())->f;
         auto ptr = f(*trav.address);
+         // The element type wasn't known until now, so this is where large
+         // arrays of plain data get skipped.
+        if (trav.context->pruned && !may_contain_refs(ptr.type())) return;
         for (u32 i = 0; i < len; i++) {
-            SharedRoute child_rt;
+            ScanRoute child_rt (*trav.rt, i + trav.collapsed_elem_shift);
             ScanTraversal<ContiguousElemTraversal> child;
             child.context = trav.context;
             child.collapse_optional = false;
@@ -303,14 +409,10 @@ struct TraverseScan {
                 }
                 child.rt = trav.rt;
             }
-            else {
-                child_rt = SharedRoute(trav.rt, i + trav.collapsed_elem_shift);
-                child.rt = child_rt;
-            }
+            else child.rt = &child_rt;
             trav_contiguous_elem<visit>(
                 child, trav, ptr, f, i, AC::Read
             );
-            child_rt = {};
             if (child.context->done) [[unlikely]] return;
             ptr.address = (Mu*)((char*)ptr.address + ptr.type().cpp_size());
         }
@@ -327,25 +429,74 @@ struct TraverseScan {
     }
 };
 
- // Store a typed AnyPtr instead of a Mu* because items at the same address
- // with different types are different items.
-static UniqueArray<Pair<AnyPtr, SharedRoute>> route_cache;
-static bool have_route_cache = false;
+ // Calls scan(thread, res) for each resource in reses, spread over up to
+ // threads threads.  Set stop to make the threads stop picking up resources.
+static void for_resources_parallel (
+    Slice<ResourceRef> reses, u32 threads, std::atomic<bool>& stop,
+    CallbackRef<void(u32, ResourceRef)> scan
+) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (threads <= 1 || reses.size() <= 1) {
+        for (auto res : reses) {
+            if (stop.load(std::memory_order_relaxed)) break;
+            scan(0, res);
+        }
+        return;
+    }
+    std::atomic<usize> next = 0;
+    std::atomic<bool> failed = false;
+    std::exception_ptr error;
+    auto work = [&](u32 t){
+        try {
+            while (!stop.load(std::memory_order_relaxed)) {
+                usize i = next.fetch_add(1, std::memory_order_relaxed);
+                if (i >= reses.size()) break;
+                scan(t, reses[i]);
+            }
+        }
+        catch (...) {
+            if (!failed.exchange(true)) error = std::current_exception();
+            stop.store(true, std::memory_order_relaxed);
+        }
+    };
+    u32 n_threads = std::min<usize>(threads, reses.size());
+    auto others = UniqueArray<std::thread>(Capacity(n_threads - 1));
+    {
+         // lilac is single-threaded.  See parse_list_parallel.
+        lilac::MallocScope malloc_scope;
+        for (u32 t = 1; t < n_threads; t++) {
+            others.emplace_back_expect_capacity([&work, t]{
+                lilac::MallocScope malloc_scope;
+                work(t);
+            });
+        }
+    }
+    work(0);
+    for (auto& t : others) t.join();
+    if (error) std::rethrow_exception(move(error));
+}
+
+ // The current base's route cache, if the current base isn't a resource.  This
+ // is thrown away when the last KeepRouteCache is destroyed, since the current
+ // base will be something else next time.
+static RouteCache base_route_cache;
+static bool have_base_route_cache = false;
 
 NOINLINE // Noinline the slow path to make the callback leaner
-bool realloc_cache (auto& cache, AnyPtr ptr, RouteRef rt) {
+bool realloc_cache (auto& cache, AnyPtr ptr, const ScanRoute& rt) {
     cache.reserve_plenty(cache.size() + 1);
-    expect(rt);
-    cache.emplace_back_expect_capacity(ptr, rt);
+    expect(rt.materialize());
+    cache.emplace_back_expect_capacity(ptr, rt.materialize());
     return false;
 }
 
 NOINLINE
-void gen_route_cache () {
+void gen_route_cache (RouteCache& cache, AnyPtr base_item, RouteRef base_rt) {
     plog("Generate route cache begin");
-    route_cache.reserve(256);
-    scan_universe_pointers(CallbackRef<bool(AnyPtr, RouteRef)>(
-        route_cache, [](auto& cache, AnyPtr ptr, RouteRef rt)
+    cache = {};
+    cache.reserve(256);
+    scan_pointers(base_item, base_rt, ScanPointersCB(
+        cache, [](auto& cache, AnyPtr ptr, const ScanRoute& rt)
     {
          // We're deliberately ignoring the case where the same typed
          // pointer turns up twice in the data tree.  If this happens, we're
@@ -355,40 +506,63 @@ void gen_route_cache () {
          // readonlyness, but that should probably never happen.
         expect(cache.owned());
         if (cache.size() < cache.capacity()) {
-            expect(rt);
-            cache.emplace_back_expect_capacity(ptr, rt);
+            expect(rt.materialize());
+            cache.emplace_back_expect_capacity(ptr, rt.materialize());
             return false;
         }
         else return realloc_cache(cache, ptr, rt);
     }));
     plog("Generate route cache sort");
      // Disable refcounting while sorting
-    auto uncounted = route_cache.reinterpret<Pair<AnyPtr, RouteRef>>();
+    auto uncounted = cache.reinterpret<Pair<AnyPtr, RouteRef>>();
     std::sort(uncounted.begin(), uncounted.end(),
         [](const auto& a, const auto& b){ return a.first < b.first; }
     );
-    have_route_cache = true;
     plog("Generate route cache end");
 #ifdef AYU_PROFILE
-    fprintf(stderr, "Route cache entries: %ld\n", route_cache.size());
+    fprintf(stderr, "Route cache entries: %ld\n", cache.size());
 #endif
 }
 
-bool get_route_cache () {
-    if (!keep_route_cache_count) return false;
-    if (!have_route_cache) gen_route_cache();
-    return true;
+void gen_resource_route_cache (ResourceData* data) {
+    gen_route_cache(
+        data->route_cache, data->value.ptr(), SharedRoute(ResourceRef(data))
+    );
+    data->have_route_cache = true;
+    data->route_cache_session = route_cache_session;
+}
+
+ // Resources are independent, so if scanning on multiple threads is enabled
+ // (see set_resource_scan_threads), build all the missing route caches at once
+ // when we need one.  It's likely that most of them will be needed anyway.
+NOINLINE
+void gen_missing_route_caches () {
+    UniqueArray<ResourceRef> missing;
+    for (auto& [_, res] : universe().resources) {
+        if (!res) continue;
+        auto data = static_cast<ResourceData*>(res.data);
+        if (data->state != RS::Loaded || data->have_route_cache) continue;
+        missing.emplace_back(res);
+    }
+    std::atomic<bool> stop = false;
+    for_resources_parallel(
+        missing, universe().scan_threads_for(missing.size()), stop,
+        [](u32, ResourceRef res){
+            gen_resource_route_cache(static_cast<ResourceData*>(res.data));
+        }
+    );
 }
 
  // This optimization interferes with conditional move conversion in recent gcc
 [[gnu::optimize("-fno-thread-jumps")]]
-const Pair<AnyPtr, SharedRoute>* search_route_cache (AnyPtr item) {
-    if (!have_route_cache) return null;
+const Pair<AnyPtr, SharedRoute>* search_route_cache (
+    const RouteCache& cache, AnyPtr item
+) {
     u32 bottom = 0;
-    u32 top = route_cache.size();
+    u32 top = cache.size();
     while (top != bottom) {
         u32 mid = (top + bottom) / 2;
-        auto& e = route_cache[mid];
+        auto& e = cache[mid];
         if (e.first.address == item.address) {
             Type aa = e.first.type();
             Type bb = item.type();
@@ -406,9 +580,61 @@ const Pair<AnyPtr, SharedRoute>* search_route_cache (AnyPtr item) {
     return null;
 }
 
+ // A route cache built in an earlier session may be out of date, if items were
+ // moved or removed since then and their addresses reused by other items of
+ // the same type.  Check that the route still leads to the item.
+static bool route_cache_entry_valid (const Pair<AnyPtr, SharedRoute>& e) {
+    try { return reference_from_route(e.second).address() == e.first; }
+    catch (...) { return false; }
+}
+
+ // Searches the current base and then all loaded resources, in the same order
+ // as scan_universe_pointers.  Only call while a KeepRouteCache is alive.
+const Pair<AnyPtr, SharedRoute>* search_route_caches (AnyPtr item) {
+    expect(keep_route_cache_count);
+    if (current_base) {
+        if (auto ref = current_base->reference())
+        if (auto address = ref->address()) {
+            if (!have_base_route_cache) {
+                gen_route_cache(base_route_cache, address, current_base);
+                have_base_route_cache = true;
+            }
+            if (auto e = search_route_cache(base_route_cache, item)) return e;
+        }
+    }
+    auto& resources = universe().resources;
+    for (auto& [_, res] : resources) {
+        if (!res) continue;
+        auto data = static_cast<ResourceData*>(res.data);
+        if (data->state != RS::Loaded) continue;
+        if (!data->have_route_cache) {
+            if (universe().scan_threads == 1) gen_resource_route_cache(data);
+            else gen_missing_route_caches();
+        }
+        if (auto e = search_route_cache(data->route_cache, item)) {
+            if (data->route_cache_session == route_cache_session ||
+                route_cache_entry_valid(*e)
+            ) return e;
+            gen_resource_route_cache(data);
+            if (auto e = search_route_cache(data->route_cache, item)) return e;
+        }
+    }
+     // Not found.  Maybe the item was added to a resource after its route cache
+     // was built, so rebuild any that weren't built during this session.
+    for (auto& [_, res] : resources) {
+        if (!res) continue;
+        auto data = static_cast<ResourceData*>(res.data);
+        if (data->state != RS::Loaded) continue;
+        if (data->route_cache_session == route_cache_session) continue;
+        gen_resource_route_cache(data);
+        if (auto e = search_route_cache(data->route_cache, item)) return e;
+    }
+    return null;
+}
+
 void clear_route_cache () {
-    have_route_cache = false;
-    route_cache.clear();
+    have_base_route_cache = false;
+    base_route_cache = {};
 }
 
 } using namespace in;
@@ -424,13 +650,20 @@ NOINLINE
 bool scan_references (
     const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb
 ) {
-    return TraverseScan::start_references(base_item, base_rt, cb, false);
+    return TraverseScan::start_references(base_item, base_rt, cb, false, false);
 }
 
 bool scan_references_ignoring_no_refs_to_children (
     const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb
 ) {
-    return TraverseScan::start_references(base_item, base_rt, cb, true);
+    return TraverseScan::start_references(base_item, base_rt, cb, true, false);
+}
+
+NOINLINE
+bool scan_references_pruned (
+    const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb
+) {
+    return TraverseScan::start_references(base_item, base_rt, cb, false, true);
 }
 
 bool scan_resource_pointers (ResourceRef res, ScanPointersCB cb) {
@@ -446,6 +679,12 @@ bool scan_resource_references (ResourceRef res, ScanReferencesCB cb) {
     return scan_references(value.ptr(), SharedRoute(res), cb);
 }
 
+bool scan_resource_references_pruned (ResourceRef res, ScanReferencesCB cb) {
+    auto& value = res->get_value();
+    if (!value) return false;
+    return scan_references_pruned(value.ptr(), SharedRoute(res), cb);
+}
+
 bool scan_universe_pointers (ScanPointersCB cb) {
     if (current_base) {
         if (auto ref = current_base->reference())
@@ -454,7 +693,7 @@ bool scan_universe_pointers (ScanPointersCB cb) {
         }
     }
     for (auto& [_, res] : universe().resources) {
-        if (scan_resource_pointers(res, cb)) return true;
+        if (res && scan_resource_pointers(res, cb)) return true;
     }
     return false;
 }
@@ -470,18 +709,81 @@ bool scan_universe_references (ScanReferencesCB cb) {
         }
     }
     for (auto& [_, res] : universe().resources) {
-        if (scan_resource_references(res, cb)) return true;
+        if (res && scan_resource_references(res, cb)) return true;
     }
     return false;
 }
 
+bool scan_resources_pointers_parallel (
+    Slice<ResourceRef> reses, u32 threads, ParallelScanPointersCB cb
+) {
+    std::atomic<bool> stop = false;
+    for_resources_parallel(reses, threads, stop,
+        [&stop, cb](u32 t, ResourceRef res){
+            scan_resource_pointers(res,
+                [&stop, cb, t](AnyPtr item, const ScanRoute& rt){
+                    if (stop.load(std::memory_order_relaxed)) return true;
+                    if (!cb(t, item, rt)) return false;
+                    stop.store(true, std::memory_order_relaxed);
+                    return true;
+                }
+            );
+        }
+    );
+    return stop.load(std::memory_order_relaxed);
+}
+
+bool scan_resources_references_parallel (
+    Slice<ResourceRef> reses, u32 threads, ParallelScanReferencesCB cb,
+    bool pruned
+) {
+    std::atomic<bool> stop = false;
+    for_resources_parallel(reses, threads, stop,
+        [&stop, cb, pruned](u32 t, ResourceRef res){
+            auto item_cb = [&stop, cb, t](
+                const AnyRef& item, const ScanRoute& rt
+            ){
+                if (stop.load(std::memory_order_relaxed)) return true;
+                if (!cb(t, item, rt)) return false;
+                stop.store(true, std::memory_order_relaxed);
+                return true;
+            };
+            if (pruned) scan_resource_references_pruned(res, item_cb);
+            else scan_resource_references(res, item_cb);
+        }
+    );
+    return stop.load(std::memory_order_relaxed);
+}
+
+static UniqueArray<ResourceRef> loaded_resource_refs () {
+    UniqueArray<ResourceRef> r;
+    for (auto& [_, res] : universe().resources) {
+        if (res && res->state() == RS::Loaded) r.emplace_back(res);
+    }
+    return r;
+}
+
+bool scan_universe_pointers_parallel (u32 threads, ParallelScanPointersCB cb) {
+    return scan_resources_pointers_parallel(
+        loaded_resource_refs(), threads, cb
+    );
+}
+
+bool scan_universe_references_parallel (
+    u32 threads, ParallelScanReferencesCB cb
+) {
+    return scan_resources_references_parallel(
+        loaded_resource_refs(), threads, cb
+    );
+}
+
 SharedRoute find_pointer (AnyPtr item) {
     if (!item) return {};
     for (auto plr = first_plr; plr; plr = plr->next) {
         if (AnyRef(item) == plr->reference) return plr->route;
     }
-    if (get_route_cache()) {
-        if (auto it = search_route_cache(item)) {
+    if (keep_route_cache_count) {
+        if (auto it = search_route_caches(item)) {
              // Reject non-readonly pointer to readonly route
             if (it->first.readonly() && !item.readonly()) {
                 [[unlikely]] return {};
@@ -492,7 +794,7 @@ SharedRoute find_pointer (AnyPtr item) {
     }
     else {
         SharedRoute r;
-        scan_universe_pointers([&r, item](AnyPtr p, RouteRef rt){
+        scan_universe_pointers([&r, item](AnyPtr p, const ScanRoute& rt){
             if (p == item) {
                  // If we get a non-readonly pointer to a readonly route,
                  // reject it, but also don't keep searching.
@@ -517,9 +819,9 @@ SharedRoute find_reference (const AnyRef& item) {
      // we just gotta search the entire universe now, though this should happen
      // rarely if ever.  If this does become a problem, we could cache AnyRefs
      // instead of AnyPtrs, but then we'd have to define operator<=> on AnyRef.
-    if (item.addressable() && get_route_cache()) {
+    if (item.addressable() && keep_route_cache_count) {
         AnyPtr ptr = item.address();
-        if (auto it = search_route_cache(ptr)) {
+        if (auto it = search_route_caches(ptr)) {
             if (!contains(it->first.caps(), item.caps())) {
                 [[unlikely]] return {};
             }
@@ -531,7 +833,7 @@ SharedRoute find_reference (const AnyRef& item) {
          // Gotta do a global search
         SharedRoute r;
         scan_universe_references(
-            [&r, &item](const AnyRef& ref, RouteRef rt)
+            [&r, &item](const AnyRef& ref, const ScanRoute& rt)
         {
             if (ref == item) {
                 if (!contains(ref.caps(), item.caps())) {
@@ -566,6 +868,27 @@ SharedRoute reference_to_route (const AnyRef& item) {
     ));
 }
 
-bool currently_scanning = false;
+void invalidate_route_cache (ResourceRef res) noexcept {
+    auto data = static_cast<ResourceData*>(res.data);
+    data->route_cache = {};
+    data->have_route_cache = false;
+}
+
+void invalidate_route_caches () noexcept {
+    for (auto& [_, res] : universe().resources) {
+        if (res) invalidate_route_cache(res);
+    }
+}
+
+NOINLINE
+void ScanRoute::materialize_slow () const {
+    auto& p = parent->materialize();
+     // Scan was started with an empty base route
+    if (!p) return;
+    if (form == RF::Key) route = SharedRoute(p, key);
+    else route = SharedRoute(p, index);
+}
+
+thread_local bool currently_scanning = false;
 
 } using namespace ayu;
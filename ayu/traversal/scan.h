@@ -10,9 +10,9 @@
 namespace ayu {
 
  // Convert an AnyPtr to a Route.  This will be slow by itself, since it
- // must scan all loaded resources.  If a KeepRouteCache object is alive, the
- // first call to find_pointer will build a map of AnyPtrs to Routes,
- // and subsequent calls to find_pointer will be as fast as a hash lookup.
+ // must scan all loaded resources.  If a KeepRouteCache object is alive, this
+ // will instead search each resource's route cache (see KeepRouteCache), which
+ // is much faster.
  // Returns the empty Route if the pointer was not found or if a null pointer
  // was passed.
 SharedRoute find_pointer (AnyPtr);
@@ -28,15 +28,34 @@ SharedRoute find_reference (const AnyRef&);
 SharedRoute pointer_to_route (AnyPtr);
 SharedRoute reference_to_route (const AnyRef&);
 
- // While this is alive, a cache mapping pointers to routes will be kept, making
- // find_pointer and find_reference faster.  Do not modify any program data
- // while keeping the route cache, since there is no way for the cache to stay
- // up-to-date.
+ // While this is alive, find_pointer and find_reference will use route caches
+ // mapping pointers to routes instead of scanning.  Each loaded resource has its
+ // own route cache, which is built the first time it's needed and kept even
+ // after the last KeepRouteCache is destroyed, so it's only built once per
+ // resource no matter how many times things are saved.  When one is needed,
+ // all the missing ones are built at once on multiple threads.  A resource's
+ // route cache is thrown away when its value is replaced (by load, reload,
+ // unload, set_value, rename, or a rollback).
+ //
+ // There's no way for a route cache to notice when you modify a resource's value
+ // in place, so a route cache built before this KeepRouteCache (or its
+ // outermost enclosing one) is only trusted after checking that the route it
+ // gives still leads to the item.  If it doesn't, or if an item isn't found,
+ // the route cache is rebuilt.  So modifying resources between sessions is
+ // fine, it just makes the next session start slower.  Within a session
+ // nothing is checked, so do not modify any program data while a
+ // KeepRouteCache is alive.
 struct KeepRouteCache {
     KeepRouteCache ();
     ~KeepRouteCache ();
 };
 
+ // Throw away a resource's route cache, so it'll be rebuilt the next time it's
+ // needed.
+void invalidate_route_cache (ResourceRef) noexcept;
+ // Throw away all resources' route caches.
+void invalidate_route_caches () noexcept;
+
  // While this is alive, if find_pointer() or find_reference() is called with
  // this reference, skip the scanning process and return this route.  These must
  // only be destroyed in first-in-last-out order, which will be fine if you only
@@ -50,8 +69,46 @@ struct PushLikelyRef {
     PushLikelyRef* next;
 };
 
-using ScanPointersCB = CallbackRef<bool(AnyPtr, RouteRef)>;
-using ScanReferencesCB = CallbackRef<bool(const AnyRef&, RouteRef)>;
+ // The route of an item being scanned, as passed to scan callbacks.  This lives
+ // on the stack and is only valid during the callback, so the scanner doesn't
+ // have to allocate a Route for every item it visits.  Converting it to a
+ // SharedRoute allocates the Route (and its parents' Routes, if they haven't
+ // been allocated yet).  The Route is remembered, so converting again, or
+ // converting one of its children, is cheap.  If the scan was started with an
+ // empty base route, this converts to the empty Route.
+struct ScanRoute {
+     // Null if this is the base of the scan.
+    const ScanRoute* parent;
+     // Either RF::Key or RF::Index if this isn't the base.
+    RouteForm form;
+    u32 index;
+    AnyString key;
+    mutable SharedRoute route;
+
+    explicit ScanRoute (RouteRef base) :
+        parent(null), form(RF::Resource), index(0), route(base)
+    { }
+    ScanRoute (const ScanRoute& p, AnyString k) :
+        parent(&p), form(RF::Key), index(0), key(move(k))
+    { }
+    ScanRoute (const ScanRoute& p, u32 i) :
+        parent(&p), form(RF::Index), index(i)
+    { }
+     // Its address is its identity, so don't copy it.
+    ScanRoute (const ScanRoute&) = delete;
+
+    const SharedRoute& materialize () const {
+        if (!route && parent) [[unlikely]] materialize_slow();
+        return route;
+    }
+    operator SharedRoute () const { return materialize(); }
+
+    private:
+    void materialize_slow () const;
+};
+
+using ScanPointersCB = CallbackRef<bool(AnyPtr, const ScanRoute&)>;
+using ScanReferencesCB = CallbackRef<bool(const AnyRef&, const ScanRoute&)>;
 
 ///// Scanning operations
  // You probably don't need to use these directly, but you can if you want.  The
@@ -64,11 +121,12 @@ using ScanReferencesCB = CallbackRef<bool(const AnyRef&, RouteRef)>;
  //   base_item: AnyPtr to the item to start scanning at.
  //   base_rt: Route to the base item, or {} if you don't care.
  //   cb: Is called for each addressable item with its pointer and route
- //     (based on base_rt).  The callback is called for parent items before
- //     their child items and is first called with (base_item, base_rt) before
- //     any scanning.  If an item only has a delegate() descriptor, the callback
- //     will be called both for the parent item and the child item with the same
- //     route.  If the callback returns true, the scan will be stopped.
+ //     (based on base_rt, see ScanRoute).  The callback is called for parent
+ //     items before their child items and is first called with (base_item,
+ //     base_rt) before any scanning.  If an item only has a delegate()
+ //     descriptor, the callback will be called both for the parent item and the
+ //     child item with the same route.  If the callback returns true, the scan
+ //     will be stopped.
  //   returns: true if the callback ever returned true.
 bool scan_pointers (
     AnyPtr base_item, RouteRef base_rt, ScanPointersCB cb
@@ -79,9 +137,9 @@ bool scan_pointers (
  //   base_item: AnyRef to the item to start scanning at.
  //   base_rt: Route to the base item, or {} if you don't care.
  //   cb: Is called for each item with a reference to it and its route (based
- //     on base_rt).  The callback is called for parent items before their
- //     child items and is first called with (base_item, base_rt) before any
- //     scanning.  If an item only has a delegate() descriptor, the callback
+ //     on base_rt, see ScanRoute).  The callback is called for parent items
+ //     before their child items and is first called with (base_item, base_rt)
+ //     before any scanning.  If an item only has a delegate() descriptor, the callback
  //     will be called both for the parent item and the child item with the same
  //     route.  If the callback returns true, the scan will be stopped.
  //   returns: true if the callback ever returned true.
@@ -94,18 +152,74 @@ bool scan_references_ignoring_no_refs_to_children (
     const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb
 );
 
+ // Like scan_references, but skips subtrees that can't contain any pointers or
+ // AnyRefs, judging by their types.  Use this if you only care about pointers
+ // and AnyRefs; the callback will be called for all of those, but only for some
+ // other items.  Types whose children's types can only be known at runtime
+ // (computed attrs and elems, function accessors) are assumed to contain
+ // pointers, except that contiguous elems are skipped if their element type
+ // can't contain any, so large arrays of plain data are cheap to skip.
+bool scan_references_pruned (
+    const AnyRef& base_item, RouteRef base_rt, ScanReferencesCB cb
+);
+
  // Scan under a particular resource's data.  The route is automatically
  // determined from the resource's name.  This silently does nothing and returns
  // false if the resource's state is RS::Unloaded.
 bool scan_resource_pointers (ResourceRef res, ScanPointersCB cb);
 bool scan_resource_references (ResourceRef res, ScanReferencesCB cb);
+bool scan_resource_references_pruned (ResourceRef res, ScanReferencesCB cb);
  // Scan all loaded resources.
 bool scan_universe_pointers (ScanPointersCB cb);
 bool scan_universe_references (ScanReferencesCB cb);
 
- // This is true while there is an ongoing scan.  While this is true, you cannot
- // start a new scan.
-extern bool currently_scanning;
+///// Parallel scanning
+ // These scan multiple resources at once on different threads.  Each resource
+ // is scanned by only one thread, in no particular order.  The calling thread
+ // does some of the scanning too.  Resources that aren't loaded are skipped.
+ //
+ // The callback may be called from several threads at the same time, so unlike
+ // with the single-threaded scans, it must follow these rules:
+ //   - Its first parameter is the index of the thread calling it, which is less
+ //     than the number of threads passed in (or hardware_concurrency() if 0
+ //     was passed).  The easiest way to be thread-safe is to only modify
+ //     per-thread state indexed by this, and merge it after the scan.
+ //   - It must not modify any program data or do anything that touches the
+ //     resource system (including find_pointer and reference_from_route), since
+ //     those aren't thread-safe.
+ //   - It must not copy AnyRefs that are stored in program data, because
+ //     their accessors may be refcounted without atomics.  Copying the AnyRef
+ //     passed to the callback is fine.
+ //   - Allocations made on other threads come from malloc instead of lilac.
+ // The item descriptions' accessors may also be called from multiple threads.
+ // Accessors that only read from their parent item are fine.
+ //
+ // If the callback returns true, all threads will stop scanning as soon as
+ // they can, and this will return true.  If scanning throws on any thread, the
+ // other threads will stop and the exception will be rethrown here.
+using ParallelScanPointersCB =
+    CallbackRef<bool(u32 thread, AnyPtr, const ScanRoute&)>;
+using ParallelScanReferencesCB =
+    CallbackRef<bool(u32 thread, const AnyRef&, const ScanRoute&)>;
+
+bool scan_resources_pointers_parallel (
+    Slice<ResourceRef> reses, u32 threads, ParallelScanPointersCB cb
+);
+ // If pruned is true, this skips subtrees like scan_references_pruned.
+bool scan_resources_references_parallel (
+    Slice<ResourceRef> reses, u32 threads, ParallelScanReferencesCB cb,
+    bool pruned = false
+);
+ // Scans all loaded resources.  Unlike scan_universe_*, this does not scan the
+ // current base if it isn't a resource.
+bool scan_universe_pointers_parallel (u32 threads, ParallelScanPointersCB cb);
+bool scan_universe_references_parallel (
+    u32 threads, ParallelScanReferencesCB cb
+);
+
+ // This is true while there is an ongoing scan on this thread.  While this is
+ // true, you cannot start a new scan.
+extern thread_local bool currently_scanning;
 
  // reference_to_route or pointer_to_route failed to find the AnyRef.
 constexpr ErrorCode e_ReferenceNotFound = "ayu::e_ReferenceNotFound";
@@ -133,12 +247,14 @@ inline PushLikelyRef::~PushLikelyRef () {
 
 namespace in {
     inline u32 keep_route_cache_count = 0;
+     // Incremented whenever the first KeepRouteCache is created.
+    inline u32 route_cache_session = 0;
     void clear_route_cache ();
 }
 
 
 inline KeepRouteCache::KeepRouteCache () {
-    in::keep_route_cache_count++;
+    if (!in::keep_route_cache_count++) in::route_cache_session++;
 }
 inline KeepRouteCache::~KeepRouteCache () {
     if (!--in::keep_route_cache_count) in::clear_route_cache();
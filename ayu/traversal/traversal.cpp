@@ -117,7 +117,7 @@ void rethrow_with_scanned_route (const AnyRef& base_item) {
     try {
         scan_references_ignoring_no_refs_to_children(
             base_ref, base_rt,
-            [&](const AnyRef& item, RouteRef rt) {
+            [&](const AnyRef& item, const ScanRoute& rt) {
                 return item == base_item && (found_rt = rt, true);
             }
         );
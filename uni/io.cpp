@@ -5,7 +5,12 @@
 
 #ifdef _WIN32
 #include <io.h>
+#include <sys/stat.h>
 #include "utf.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 namespace uni {
@@ -61,6 +66,152 @@ UniqueString File::read (Str path_err) {
     return r;
 }
 
+AtomicFile::AtomicFile (AnyString p) :
+    path(move(p)), tmp_path(cat(path, ".tmp")), file(tmp_path, "wb")
+{ }
+
+AtomicFile::~AtomicFile () {
+    if (!tmp_path) return;
+    if (file) file.close(tmp_path);
+    remove_utf8(tmp_path.c_str());
+}
+
+void AtomicFile::finish (bool sync) {
+    if (!file) return;
+     // File::close only warns on failure, but a failed flush here means the
+     // new contents are incomplete, so check for it first.
+    if (fflush(file.handle) != 0) {
+        raise_io_error(e_WriteFailed, "Failed to write to ", tmp_path);
+    }
+    if (sync) {
+#ifdef _WIN32
+        if (_commit(_fileno(file.handle)) != 0) {
+#else
+        if (fsync(fileno(file.handle)) != 0) {
+#endif
+            raise_io_error(e_WriteFailed, "Failed to sync ", tmp_path);
+        }
+    }
+    file.close(tmp_path);
+}
+
+ // The rename isn't durable until the folder containing it is synced.  Returns
+ // false and leaves errno set on failure.
+static bool sync_folder_of (Str path) noexcept {
+#ifndef _WIN32
+    usize slash = path.size();
+    while (slash && path[slash - 1] != '/') slash--;
+    auto folder = UniqueString(slash ? path.slice(0, slash) : Str("."));
+    int fd = open(folder.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        int errnum = errno;
+        if (fd >= 0) ::close(fd);
+        errno = errnum;
+        return false;
+    }
+    ::close(fd);
+#endif
+    return true;
+}
+
+void AtomicFile::commit (bool sync) {
+    finish(sync);
+    if (rename_utf8(tmp_path.c_str(), path.c_str()) != 0) {
+        raise_io_error(e_WriteFailed, "Failed to rename into ", path);
+    }
+    tmp_path = {};
+    if (sync && !sync_folder_of(path)) {
+        raise_io_error(e_WriteFailed, "Failed to sync folder of ", path);
+    }
+}
+
+bool AtomicFile::commit_or_warn (bool sync) noexcept {
+    expect(!file);
+    if (rename_utf8(tmp_path.c_str(), path.c_str()) != 0) {
+        warn_close_failed("Warning: Failed to rename into ", path);
+        return false;
+    }
+    tmp_path = {};
+    if (sync && !sync_folder_of(path)) {
+        warn_close_failed("Warning: Failed to sync folder of ", path);
+        return false;
+    }
+    return true;
+}
+
+struct SharedMapping::Data {
+    usize ref_count;
+    usize size;
+    const char* address;
+#ifdef _WIN32
+    UniqueString buffer;
+#endif
+};
+
+SharedMapping::SharedMapping (const SharedMapping& o) noexcept :
+    data(o.data)
+{
+    if (data) ++data->ref_count;
+}
+
+SharedMapping::~SharedMapping () {
+    if (!data || --data->ref_count) return;
+#ifndef _WIN32
+     // mmap refuses zero-length mappings, so empty files don't have one.
+    if (data->size) {
+        int res = munmap(const_cast<char*>(data->address), data->size);
+        if (res < 0) [[unlikely]] {
+            warn_close_failed("Warning: Failed to unmap ", "");
+        }
+    }
+#endif
+    delete data;
+}
+
+Str SharedMapping::contents () const noexcept {
+    if (!data) return "";
+    return Str(data->address, data->size);
+}
+
+SharedMapping mapping_from_file (AnyString path) {
+    SharedMapping r;
+#ifdef _WIN32
+    auto buffer = string_from_file(path);
+    r.data = new SharedMapping::Data{1, buffer.size(), buffer.data(), move(buffer)};
+#else
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd < 0) raise_io_error(e_OpenFailed, "Failed to open ", path);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int errnum = errno;
+        ::close(fd);
+        errno = errnum;
+        raise_io_error(e_ReadFailed, "Failed to stat ", path);
+    }
+    usize size = st.st_size;
+    require(size < AnyString::max_size_);
+    const char* address = "";
+    if (size) {
+        void* res = mmap(null, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (res == MAP_FAILED) {
+            int errnum = errno;
+            ::close(fd);
+            errno = errnum;
+            raise_io_error(e_ReadFailed, "Failed to mmap ", path);
+        }
+         // Parsers read straight through, so ask for aggressive readahead.
+        madvise(res, size, MADV_SEQUENTIAL);
+        address = (const char*)res;
+    }
+     // The mapping stays valid after the file descriptor is closed.
+    if (::close(fd) < 0) [[unlikely]] {
+        warn_close_failed("Warning: Failed to close ", path);
+    }
+    r.data = new SharedMapping::Data{1, size, address};
+#endif
+    return r;
+}
+
 void Dir::raise_open_failed (Str path_err, int errnum) const {
     if (errnum) errno = errnum;
     raise_io_error(e_ListDirFailed, "Failed to open directory ", path_err);
@@ -127,4 +278,36 @@ int remove_utf8 (const char* filename) noexcept {
 #endif
 }
 
+int rename_utf8 (const char* from, const char* to) noexcept {
+#ifdef _WIN32
+     // _wrename won't replace an existing file.  This isn't atomic, but
+     // avoids pulling in windows.h for MoveFileExW.
+    auto to16 = to_utf16(to);
+    _wremove(reinterpret_cast<const wchar_t*>(to16.c_str()));
+    return _wrename(
+        reinterpret_cast<const wchar_t*>(to_utf16(from).c_str()),
+        reinterpret_cast<const wchar_t*>(to16.c_str())
+    );
+#else
+    return rename(from, to);
+#endif
+}
+
+bool stat_utf8 (const char* filename, FileInfo& info) noexcept {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_wstat64(
+        reinterpret_cast<const wchar_t*>(to_utf16(filename).c_str()), &st
+    ) < 0) return false;
+    info.size = st.st_size;
+    info.mtime = i64(st.st_mtime) * 1000000000;
+#else
+    struct stat st;
+    if (stat(filename, &st) < 0) return false;
+    info.size = st.st_size;
+    info.mtime = i64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
 } // uni
@@ -46,6 +46,9 @@ struct File {
     ) const;
 
     UniqueString read (Str path_err = "");
+     // Reads up to size bytes into buf and returns how many were read, which
+     // is only less than size at the end of the file.
+    usize read_some (char* buf, usize size, Str path_err = "");
     void write (Str, Str path_err = "");
 
      // Warns to stderr on failure.  Usually called automatically.
@@ -57,6 +60,86 @@ UniqueString string_from_file (AnyString path);
 
 void string_to_file (Str, AnyString path);
 
+ // Writes to a temporary file next to path, and renames it over path in
+ // commit(), so that path always has either its old contents or all of its new
+ // contents, even if the program crashes partway through writing.  If this is
+ // destroyed without being committed, the temporary file is deleted and path
+ // is left alone.  (On Windows, replacing the file isn't quite atomic, but the
+ // file is still never partly written.)
+struct AtomicFile {
+    AnyString path;
+    UniqueString tmp_path;
+    File file;
+     // Empty object
+    AtomicFile () { }
+     // Opens the temporary file, throws on failure
+    explicit AtomicFile (AnyString path);
+    AtomicFile (AtomicFile&&) = default;
+    AtomicFile& operator= (AtomicFile&& o) {
+        this->~AtomicFile();
+        return *new (this) AtomicFile(move(o));
+    }
+     // Deletes the temporary file if not committed
+    ~AtomicFile ();
+
+    void write (Str content) { file.write(content, tmp_path); }
+     // Flushes and closes the temporary file, throwing if its contents
+     // couldn't be written, so that all that's left for commit is the rename.
+     // If sync is true, also waits for the contents to reach the disk.
+    void finish (bool sync = false);
+     // Finishes the temporary file if that hasn't been done yet, and renames
+     // it to path.  If sync is true, also waits for the contents and the
+     // rename to reach the disk, so that they survive an OS crash or power
+     // failure, not just a program crash.  That's much slower, so it's off by
+     // default.
+    void commit (bool sync = false);
+     // Like commit, but warns on stderr and returns false instead of throwing.
+     // finish must have been called already.
+    bool commit_or_warn (bool sync = false) noexcept;
+};
+
+ // Write a whole file with AtomicFile
+void string_to_file_atomic (Str, AnyString path, bool sync = false);
+
+ // A read-only view of a whole file's contents, mapped into memory instead of
+ // copied.  Copies share the mapping through a (non-threadsafe) reference
+ // count, and the file is unmapped when the last one is destroyed.  On
+ // platforms without mmap, the file is read into a buffer instead.  If the
+ // file is modified while it's mapped, the contents may change underneath you.
+struct SharedMapping {
+    struct Data;
+    Data* data;
+     // Empty object
+    constexpr SharedMapping () : data(null) { }
+     // Shares the mapping
+    SharedMapping (const SharedMapping& o) noexcept;
+     // Move construct
+    constexpr SharedMapping (SharedMapping&& o) : data(o.data) {
+        o.data = null;
+    }
+    SharedMapping& operator= (const SharedMapping& o) noexcept {
+        this->~SharedMapping();
+        return *new (this) SharedMapping(o);
+    }
+    SharedMapping& operator= (SharedMapping&& o) noexcept {
+        this->~SharedMapping();
+        return *new (this) SharedMapping(move(o));
+    }
+     // Unmaps if this was the last reference
+    ~SharedMapping ();
+
+     // Check if anything is mapped.  An empty file is still mapped, though
+     // its contents are empty.
+    constexpr explicit operator bool () const { return data; }
+
+     // The contents of the file.  This is only valid for as long as this
+     // SharedMapping or a copy of it is alive.
+    Str contents () const noexcept;
+};
+
+ // Map a whole file into memory, throws on failure.
+SharedMapping mapping_from_file (AnyString path);
+
 constexpr ErrorCode e_OpenFailed = "uni::e_OpenFailed";
 constexpr ErrorCode e_ReadFailed = "uni::e_ReadFailed";
 constexpr ErrorCode e_WriteFailed = "uni::e_WriteFailed";
@@ -141,6 +224,19 @@ std::FILE* fopen_utf8 (const char* filename, const char* mode = "rb") noexcept;
  // Delete a file
 int remove_utf8 (const char* filename) noexcept;
 
+ // Rename a file, replacing the destination if it exists.
+int rename_utf8 (const char* from, const char* to) noexcept;
+
+ // Size and modification time of a file.
+struct FileInfo {
+    u64 size;
+     // In nanoseconds since the epoch.
+    i64 mtime;
+};
+ // stat but UTF-8 even on Windows.  Returns false if the file can't be
+ // examined (most likely because it doesn't exist).
+bool stat_utf8 (const char* filename, FileInfo& info) noexcept;
+
 ///// INLINES
 
 namespace in {
@@ -162,6 +258,14 @@ inline File File::try_open (AnyString path, const char* mode) noexcept {
     return r;
 }
 
+inline usize File::read_some (char* buf, usize size, Str path_err) {
+    usize did_read = fread(buf, 1, size, handle);
+    if (did_read < size && ferror(handle)) {
+        in::raise_io_error(e_ReadFailed, "Failed to read from ", path_err);
+    }
+    return did_read;
+}
+
 inline void File::write (Str content, Str path_err) {
     usize did_write = fwrite(content.data(), 1, content.size(), handle);
     if (did_write != content.size()) {
@@ -185,6 +289,12 @@ inline void string_to_file (Str content, AnyString path) {
     File(path, "wb").write(content, path);
 }
 
+inline void string_to_file_atomic (Str content, AnyString path, bool sync) {
+    AtomicFile file (move(path));
+    file.write(content);
+    file.commit(sync);
+}
+
 inline Dir::Dir (AnyString path) :
     Dir(try_open_at(AT_FDCWD, path))
 {
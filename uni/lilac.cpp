@@ -243,7 +243,7 @@ Block allocate_large (usize size) noexcept {
 NOINLINE
 Block allocate_block (usize size) noexcept {
     i32 sc = get_size_class(size);
-    if (sc >= 0) {
+    if (sc >= 0 && !use_malloc) {
         u32 slot_size = class_sizes[sc];
         return allocate_small(global.first_partial_pages[sc], slot_size);
     }
@@ -364,12 +364,9 @@ void* reallocate (void* p, usize s) noexcept {
         }
         else return p;
     }
-    else {
-        if (s > class_sizes[n_size_classes-1]) {
-            return std::realloc(p, s);
-        }
-        else return p;
-    }
+     // This may be smaller than the largest size class if it was allocated
+     // under a MallocScope.
+    else return std::realloc(p, s);
 }
 
 void dump_profile () noexcept {
@@ -44,10 +44,14 @@
  // size 0 will return a non-null pointer to a minimally-allocated region.
  //
  // You can override the global operator new and operator delete by linking
- // lilac-global-override.cpp into the program.  Only do this is your entire
- // program is singlethreaded, or at least never allocates memory on another
- // thread.  You cannot replace malloc and free because lilac relies on malloc
- // to reserve its initial memory pool and to handle large allocations.
+ // lilac-global-override.cpp into the program.  Only do this if your entire
+ // program is singlethreaded, or if every other thread does all its allocating
+ // and freeing under a MallocScope (see below).  Watch out for things that
+ // allocate on one thread and free on another; in particular, std::thread
+ // allocates its state on the thread that constructs it and frees it on the new
+ // thread, so construct std::threads under a MallocScope as well.  You cannot
+ // replace malloc and free because lilac relies on malloc to reserve its
+ // initial memory pool and to handle large allocations.
  //
  // Like other paging allocators, you can achieve worst-case fragmentation by
  // allocating a large amount of same-sized objects, deallocating all but one
@@ -102,6 +106,18 @@ Block allocate_block (usize) noexcept;
  // Dump some stats to stderr, but only if compiled with UNI_LILAC_PROFILE
 void dump_profile () noexcept;
 
+ // While one of these exists, allocations on the current thread are relayed
+ // to malloc instead of using the pool.  This lets other threads build objects
+ // (like uni arrays) that can be handed to the main thread, because freeing
+ // passes anything outside the pool to free.  The other thread must not free
+ // anything that was allocated in the pool (including its own std::thread
+ // state, so construct the std::thread under a MallocScope too), blocks
+ // allocated this way must be freed with deallocate() or
+ // deallocate_unknown_size(), and the pool must not be initialized while the
+ // other thread is running (allocating anything beforehand will initialize
+ // it).
+struct MallocScope;
+
 namespace in {
 
 ///// CUSTOMIZATION
@@ -208,8 +224,16 @@ struct alignas(64) Global {
 };
 inline Global global;
 
+inline thread_local bool use_malloc = false;
+
 } // in
 
+struct MallocScope {
+    bool old;
+    MallocScope () noexcept : old(in::use_malloc) { in::use_malloc = true; }
+    ~MallocScope () { in::use_malloc = old; }
+};
+
 ///// INLINES (and optimization attributes)
 
 [[
@@ -233,7 +257,7 @@ void deallocate (void* p, usize) noexcept {
 ]] ALWAYS_INLINE
 void* allocate_fixed_size (usize size) noexcept {
     i32 sc = in::get_size_class(size);
-    if (sc >= 0) {
+    if (sc >= 0 && !in::use_malloc) {
         auto& fp = in::global.first_partial_pages[sc];
         u32 slot_size = in::class_sizes[sc];
         return in::allocate_small(fp, slot_size).address;
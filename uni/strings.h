@@ -164,6 +164,12 @@ struct StringConversion<T> {
     char digits [in::max_digits<T>];
     u32 len;
     constexpr StringConversion (T v) {
+        if constexpr (std::is_same_v<T, double>) {
+            if (char* e = write_short_decimal(digits, v)) {
+                len = e - digits;
+                return;
+            }
+        }
         if (std::isfinite(v)) {
             auto [ptr, ec] = std::to_chars(digits, digits + in::max_digits<T>, v);
             expect(ec == std::errc());
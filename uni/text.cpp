@@ -1,5 +1,8 @@
 #include "text.h"
 
+#include <bit>
+#include <cmath>
+
 namespace uni {
 
  // From what I see, different implementations of natural sort vary on their
@@ -166,11 +169,12 @@ u32 count_decimal_digits (u64 v) noexcept {
      // and I can't convince it not to do that.  Some other perturbations make
      // it do that too, even with only two [[likely]]s.
     else if (v <= 9'999'999'999ULL) {
+         // Don't truncate to u32 here, this range goes above 2^32.
         u32 r = 6;
-        r += u32(v) > 999'999;
-        r += u32(v) > 9'999'999;
-        r += u32(v) > 99'999'999;
-        r += u32(v) > 999'999'999;
+        r += v > 999'999;
+        r += v > 9'999'999;
+        r += v > 99'999'999;
+        r += v > 999'999'999;
         return r;
     }
     else if (v <= 999'999'999'999'999ULL) {
@@ -213,11 +217,64 @@ char* write_decimal_digits (char* p, u32 count, u64 v) noexcept {
     goto end;
 }
 
+static constexpr double exact_powers_of_10 [23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+char* write_short_decimal (char* p, double v) noexcept {
+    double a = std::fabs(v);
+     // Outside of this range std::to_chars may use scientific notation (with
+     // chars_format::general it does at 1e6 and above).  This also rejects
+     // nan.
+    if (!(a >= 0.001 && a < 1e6)) return null;
+     // Pick the largest k such that a * 10^k < 2^50.  (78913 / 2^18 is a bit
+     // less than log10(2).)
+    i32 exp2 = i32(std::bit_cast<u64>(a) >> 52) - 1023;
+    u32 k = u32((49 - exp2) * 78913) >> 18;
+    expect(k < 23);
+     // If a == n / 10^k for some integer n, then since 10^k and n (< 2^53) are
+     // exact, the division is correctly rounded, and the string "n * 10^-k"
+     // will parse back to a.  Because ulp(a * 10^k) <= 1/4, at most one n can
+     // work, and it's within 1/4 of the computed product.  Any shorter form
+     // would also work at this k with trailing zeros, so we can find the
+     // shortest form by removing trailing zeros, and the digits will be the
+     // same as std::to_chars's.
+    double m = a * exact_powers_of_10[k];
+     // Signed conversion is a single instruction on x64, unsigned isn't.
+    i64 n = i64(m + 0.5);
+    double diff = std::fabs(m - double(n));
+     // The first check is cheap and rejects almost everything that won't
+     // work, so we usually don't have to divide.
+    if (diff > m * 0x1p-50) [[likely]] return null;
+    if (double(n) / exact_powers_of_10[k] != a) return null;
+    u64 u = n;
+    if (k >= 8 && u % 100'000'000 == 0) { u /= 100'000'000; k -= 8; }
+    if (k >= 4 && u % 10'000 == 0) { u /= 10'000; k -= 4; }
+    if (k >= 2 && u % 100 == 0) { u /= 100; k -= 2; }
+    if (k >= 1 && u % 10 == 0) { u /= 10; k -= 1; }
+     // Trailing zeros mean std::to_chars may use scientific notation.
+    if (u % 10 == 0) return null;
+    *p = '-';
+    p += v < 0;
+    if (k == 0) return write_decimal_digits(p, count_decimal_digits(u), u);
+     // u / 10^k isn't an integer, so this truncates correctly.
+    u64 whole = u64(a);
+    u64 frac = u - whole * u64(exact_powers_of_10[k]);
+    p = write_decimal_digits(p, count_decimal_digits(whole), whole);
+    *p++ = '.';
+    u32 frac_digits = count_decimal_digits(frac);
+    for (u32 i = frac_digits; i < k; i++) *p++ = '0';
+    return write_decimal_digits(p, frac_digits, frac);
+}
+
 } using namespace uni;
 
 #ifndef TAP_DISABLE_TESTS
+#include <charconv>
 #include "../tap/tap.h"
 #include "strings.h"
+#include "time.h"
 
 static tap::TestSet tests ("dirt/uni/text", []{
     using namespace tap;
@@ -248,12 +305,94 @@ static tap::TestSet tests ("dirt/uni/text", []{
     p = write_decimal_digits(s.begin(), 16, 5260715430874368);
     is(p, s.begin() + 16, "write_decimal_digits length");
     is(s, "5260715430874368", "write_decimal_digits contents");
+    is(count_decimal_digits(5000000000), 10u, "count_decimal_digits above 2^32");
     s = UniqueString(2, 0);
     is(count_decimal_digits(0), 1u, "count_decimal_digits");
     p = write_decimal_digits(s.begin(), 1, 0);
     is(p, s.begin() + 1, "write_decimal_digits length");
     is(s, "0\0", "write_decimal_digits contents");
     is(cat("asdf", -48829, "fdsa"), "asdf-48829fdsa", "cat with number");
+
+    auto short_decimal = [](double v, Str expected){
+        char buf [24];
+        char* e = write_short_decimal(buf, v);
+        if (!expected) ok(!e, cat("write_short_decimal gives up on ", v));
+        else if (!e) fail(cat("write_short_decimal ", expected));
+        else is(Str(buf, e), expected, cat("write_short_decimal ", expected));
+    };
+    short_decimal(0.5, "0.5");
+    short_decimal(-1234.5, "-1234.5");
+    short_decimal(145, "145");
+    short_decimal(0.001, "0.001");
+    short_decimal(0.1 + 0.2, "");
+    short_decimal(1000, "");
+    short_decimal(0.0001, "");
+    short_decimal(1e300, "");
+    short_decimal(1234567.5, "");
+    short_decimal(0.0/0.0, "");
+    short_decimal(1.0/0.0, "");
+    short_decimal(1.0/3.0, "");
+
+     // Compare against std::to_chars
+    u64 x = 0x123456789abcdef;
+    u32 fast_writes = 0;
+    u32 mismatches = 0;
+    for (u32 i = 0; i < 100000; i++) {
+        x = x * 6364136223846793005 + 1442695040888963407;
+        double v = double(i64(x >> 11)) / double(u64(1) << (x & 63));
+        if (i % 2) {
+            double scale = exact_powers_of_10[i % 7];
+            v = double(i64(v * scale)) / scale;
+        }
+        char a [24];
+        char b [24];
+        char g [24];
+        char* ae = write_short_decimal(a, v);
+        if (ae) {
+            fast_writes++;
+            char* be = std::to_chars(b, b+24, v).ptr;
+            char* ge = std::to_chars(g, g+24, v, std::chars_format::general).ptr;
+            if (Str(a, ae) != Str(b, be) || Str(a, ae) != Str(g, ge)) {
+                if (!mismatches++) diag(cat(Str(a, ae), " != ", Str(b, be)));
+            }
+        }
+    }
+    ok(fast_writes > 10000, "write_short_decimal handles a good portion of inputs");
+    is(mismatches, 0u, "write_short_decimal agrees with std::to_chars");
+
+     // Benchmark on numbers like you'd see in geometry or animation data: a
+     // third with three decimals, a third with six, and a third with full
+     // precision.
+    UniqueArray<double> numbers;
+    for (u32 i = 0; i < 100000; i++) {
+        x = x * 6364136223846793005 + 1442695040888963407;
+        double v = double(x >> 11) / double(u64(1) << 53) * 2000 - 1000;
+        if (i % 3 == 0) v = std::round(v * 1e3) / 1e3;
+        else if (i % 3 == 1) v = std::round(v * 1e6) / 1e6;
+        numbers.push_back(v);
+    }
+    auto buf = UniqueString(Capacity(numbers.size() * 25));
+    char* begin = buf.mut_data();
+    double start = uni::steady_clock();
+    char* std_end = begin;
+    for (double v : numbers) {
+        std_end = std::to_chars(std_end, std_end + 24, v).ptr;
+        *std_end++ = ' ';
+    }
+    double std_write = uni::steady_clock() - start;
+    start = uni::steady_clock();
+    char* end = begin;
+    for (double v : numbers) {
+        if (char* e = write_short_decimal(end, v)) end = e;
+        else end = std::to_chars(end, end + 24, v).ptr;
+        *end++ = ' ';
+    }
+    double fast_write = uni::steady_clock() - start;
+    ok(end == std_end, "Fast writes produce the same length");
+    diag(cat(
+        "Wrote ", numbers.size(), " numbers in ", fast_write * 1000,
+        "ms (std::to_chars: ", std_write * 1000, "ms)"
+    ));
     done_testing();
 });
 #endif
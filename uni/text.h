@@ -110,4 +110,13 @@ ReadResult<T> read_decimal_digits (
     return r;
 }
 
+ // Fast path for writing the shortest decimal that round-trips to v, for
+ // numbers with a short fixed-point form like 0.25 or 1234.5 (which are very
+ // common in hand-written data).  The output is exactly what std::to_chars
+ // would produce, with or without std::chars_format::general.  Returns null
+ // without writing anything if v isn't in this form (including if it's out of
+ // range or not finite), in which case you should call std::to_chars instead.
+ // Writes at most 24 chars.
+char* write_short_decimal (char* p, double v) noexcept;
+
 } // namespace uni